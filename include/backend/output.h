@@ -9,7 +9,8 @@
 #include "lang/workspace.h"
 
 struct output_path {
-	const char *private_dir, *summary, *tests, *install, *compiler_check_cache, *option_info;
+	const char *private_dir, *summary, *tests, *install, *compiler_check_cache, *option_info,
+		*regenerate_fingerprint, *bytecode_cache_dir;
 };
 
 extern const struct output_path output_path;
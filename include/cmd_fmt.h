@@ -0,0 +1,18 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#ifndef MUON_CMD_FMT_H
+#define MUON_CMD_FMT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+struct format_options {
+	const char *argv0, *cfg_path, *cache_path;
+	bool in_place, check_only, editorconfig, recursive;
+	uint32_t jobs;
+};
+
+bool format_run(struct format_options *opts, char *const *paths, uint32_t num_paths);
+#endif
@@ -38,6 +38,13 @@ struct test_options {
 	bool fail_fast, print_summary, no_rebuild, list;
 
 	enum test_category cat;
+
+	struct {
+		const char *baseline, *save_baseline;
+		uint32_t warmup, iterations, cpu;
+		float threshold; // allowed slowdown relative to the baseline, in percent
+		bool pin_cpu;
+	} bench;
 };
 
 bool tests_run(struct test_options *opts, const char *argv0);
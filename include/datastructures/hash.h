@@ -34,4 +34,6 @@ void hash_set_strn(struct hash *h, const char *key, uint64_t len, uint64_t val);
 void hash_unset(struct hash *h, const void *key);
 void hash_unset_strn(struct hash *h, const char *s, uint64_t len);
 void hash_clear(struct hash *h);
+
+uint64_t hash_bytes(const void *key, uint64_t len, uint64_t seed);
 #endif
@@ -24,6 +24,15 @@ enum error_diagnostic_store_replay_opts {
 	error_diagnostic_store_replay_werror = 1 << 2,
 };
 
+struct arr;
+
+struct error_diagnostic_message {
+	struct source_location location;
+	enum log_level lvl;
+	const char *msg;
+	uint32_t src_idx;
+};
+
 void error_unrecoverable(const char *fmt, ...) MUON_ATTR_FORMAT(printf, 1, 2);
 void error_message(struct source *src, struct source_location location, enum log_level lvl, const char *msg);
 void
@@ -33,6 +42,7 @@ void error_messagef(struct source *src, struct source_location location, enum lo
 
 void error_diagnostic_store_init(struct workspace *wk);
 void error_diagnostic_store_replay(enum error_diagnostic_store_replay_opts opts, bool *saw_error);
+void error_diagnostic_store_collect(struct arr *res);
 void
 error_diagnostic_store_push(uint32_t src_idx, struct source_location location, enum log_level lvl, const char *msg);
 void error_diagnostic_store_redirect(struct source *src, struct source_location location);
@@ -11,5 +11,5 @@
 
 extern const bool have_libarchive;
 
-bool muon_archive_extract(const char *buf, size_t size, const char *dest_path);
+bool muon_archive_extract(const char *path, const char *dest_path);
 #endif
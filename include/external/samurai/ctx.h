@@ -12,6 +12,7 @@
 #include <stdio.h>
 
 #include "platform/filesystem.h"
+#include "platform/run_cmd.h"
 #include "platform/timer.h"
 
 struct samu_buffer {
@@ -39,7 +40,7 @@ struct samu_hashtablekey {
 
 struct samu_buildoptions {
 	size_t maxjobs, maxfail;
-	_Bool verbose, explain, keepdepfile, keeprsp, dryrun;
+	_Bool verbose, explain, keepdepfile, keeprsp, dryrun, rusage;
 	const char *statusfmt;
 };
 
@@ -148,11 +149,20 @@ struct samu_pool {
 	struct samu_edge *work;
 };
 
+/* resource usage of a finished job, collected with -d rusage */
+struct samu_jobstat {
+	struct samu_string *name;
+	struct run_cmd_rusage rusage;
+};
+
 struct samu_build_ctx {
 	struct samu_edge *work;
 	size_t nstarted, nfinished, ntotal;
 	bool consoleused;
 	struct timer timer;
+
+	struct samu_jobstat *jobstats;
+	size_t njobstats, jobstatscap;
 };
 
 struct samu_deps_ctx {
@@ -23,6 +23,25 @@ struct az_opts {
 	enum error_diagnostic_store_replay_opts replay_opts;
 	const char *file_override, *internal_file, *get_definition_for;
 	uint64_t enabled_diagnostics;
+
+	// An array of struct source whose labels are absolute paths.  Project
+	// files matching one of these labels are read from the array instead
+	// of from disk.
+	const struct arr *file_overrides;
+	// If set, diagnostics are collected into this array of struct
+	// error_diagnostic_message rather than printed.
+	struct arr *diagnostics;
+	// Don't release the assignment table after analysis so it can be
+	// queried with az_lookup_assignment().  It is released by
+	// az_state_destroy().
+	bool retain_state;
+};
+
+struct az_assignment_info {
+	obj o;
+	uint32_t src_idx;
+	struct source_location location;
+	bool default_var;
 };
 
 enum az_branch_element_flag {
@@ -52,6 +71,9 @@ void az_set_error(void);
 extern struct func_impl_group az_func_impl_group;
 
 bool do_analyze(struct az_opts *opts);
+bool do_analyze_internal(struct workspace *wk, struct az_opts *opts);
+void az_state_destroy(void);
+bool az_lookup_assignment(const char *name, uint32_t src_idx, uint32_t off, struct az_assignment_info *res);
 
 void eval_trace_print(struct workspace *wk, obj trace);
 
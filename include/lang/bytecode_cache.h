@@ -0,0 +1,33 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#ifndef MUON_LANG_BYTECODE_CACHE_H
+#define MUON_LANG_BYTECODE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct workspace;
+struct source;
+
+struct bytecode_cache_key {
+	// names the cache file, derived from the source path and modes
+	uint8_t name[32];
+	// stored in the cache file, derived from everything the code depends on
+	uint8_t digest[32];
+};
+
+bool bytecode_cache_enabled(struct workspace *wk);
+void bytecode_cache_key_init(struct workspace *wk,
+	struct bytecode_cache_key *key,
+	const struct source *src,
+	uint32_t compile_mode,
+	uint32_t eval_mode);
+bool bytecode_cache_load(struct workspace *wk, const struct bytecode_cache_key *key, uint32_t *entry);
+void bytecode_cache_store(struct workspace *wk,
+	const struct bytecode_cache_key *key,
+	uint32_t entry,
+	uint32_t locations_start);
+#endif
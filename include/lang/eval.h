@@ -17,6 +17,7 @@ enum eval_mode {
 	eval_mode_repl = 1 << 0,
 	eval_mode_first = 1 << 1,
 	eval_mode_return_after_project = 1 << 2,
+	eval_mode_bytecode_cache = 1 << 3,
 };
 
 enum eval_project_file_flags {
@@ -7,6 +7,7 @@
 #define MUON_LANG_FMT_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "lang/source.h"
@@ -38,4 +39,5 @@ struct fmt_opts {
 };
 
 bool fmt(struct source *src, FILE *out, const char *cfg_path, bool check_only, bool editorconfig);
+bool fmt_opts_digest(struct source *src, const char *cfg_path, bool editorconfig, uint8_t digest[32]);
 #endif
@@ -136,6 +136,7 @@ struct lexer {
 	enum lexer_mode mode;
 	enum cm_lexer_mode cm_mode;
 	uint8_t enclosed_state;
+	bool scan_generic;
 };
 
 bool is_valid_inside_of_identifier(const char c);
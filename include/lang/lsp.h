@@ -0,0 +1,12 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#ifndef MUON_LANG_LSP_H
+#define MUON_LANG_LSP_H
+
+#include "lang/analyze.h"
+
+bool analyze_lsp(struct az_opts *opts);
+#endif
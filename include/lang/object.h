@@ -146,6 +146,11 @@ enum module {
 enum str_flags {
 	str_flag_big = 1 << 0,
 	str_flag_mutable = 1 << 1,
+	// The string is referenced only by the variable it was built in with +=,
+	// see str_apps_unique()
+	str_flag_unique = 1 << 2,
+	// The string is in the intern table, see make_strn_interned()
+	str_flag_interned = 1 << 3,
 };
 
 struct str {
@@ -302,6 +307,8 @@ enum dependency_type {
 
 enum dep_flags {
 	dep_flag_found = 1 << 0,
+	// dep holds a deduplicated closure that is never modified again
+	dep_flag_resolved = 1 << 1,
 };
 
 enum include_type {
@@ -486,6 +493,7 @@ struct obj_source_configuration {
 
 enum obj_iterator_type {
 	obj_iterator_type_array,
+	obj_iterator_type_array_concat,
 	obj_iterator_type_dict_small,
 	obj_iterator_type_dict_big,
 	obj_iterator_type_range,
@@ -498,12 +506,24 @@ struct range_params {
 
 struct obj_iterator {
 	enum obj_iterator_type type;
+	// only yield the keys of a dict, used for iterating over dict.keys()
+	bool keys_only;
 	union {
 		struct obj_array *array;
-		struct obj_dict_elem *dict_small;
+		// the elements of two arrays, as they were when iteration
+		// started, used for iterating over array + array
+		struct {
+			struct obj_array *array;
+			uint32_t len, next_len;
+			obj next;
+		} array_concat;
+		struct {
+			struct obj_dict_elem *elem;
+			uint32_t len;
+		} dict_small;
 		struct {
 			struct hash *h;
-			uint32_t i;
+			uint32_t i, len;
 		} dict_big;
 		struct range_params range;
 		struct {
@@ -616,6 +636,9 @@ bool obj_array_join(struct workspace *wk, bool flat, obj arr, obj join, obj *res
 void obj_array_tail(struct workspace *wk, obj arr, obj *res);
 void obj_array_set(struct workspace *wk, obj arr, int64_t i, obj v);
 void obj_array_del(struct workspace *wk, obj arr, int64_t i);
+void obj_dedup_hash_init(struct hash *h);
+typedef bool (*obj_array_dedup_filter)(struct workspace *wk, obj v);
+void obj_array_dedup_filtered(struct workspace *wk, obj arr, obj *res, obj_array_dedup_filter should_dedup);
 void obj_array_dedup(struct workspace *wk, obj arr, obj *res);
 void obj_array_dedup_in_place(struct workspace *wk, obj *arr);
 bool obj_array_flatten_one(struct workspace *wk, obj val, obj *res);
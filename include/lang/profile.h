@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#ifndef MUON_LANG_PROFILE_H
+#define MUON_LANG_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct workspace;
+
+enum profile_frame_type {
+	profile_frame_root,
+	profile_frame_eval,
+	profile_frame_func,
+	profile_frame_native,
+};
+
+void profile_init(struct workspace *wk);
+void profile_destroy(struct workspace *wk);
+void profile_push(struct workspace *wk, enum profile_frame_type type, uint32_t ip, uint32_t id, const char *name);
+void profile_pop(struct workspace *wk);
+bool profile_write(struct workspace *wk, const char *path);
+#endif
@@ -73,11 +73,14 @@ obj make_str(struct workspace *wk, const char *str);
 obj make_strn(struct workspace *wk, const char *str, uint32_t n);
 obj make_strf(struct workspace *wk, const char *fmt, ...) MUON_ATTR_FORMAT(printf, 2, 3);
 obj make_strfv(struct workspace *wk, const char *fmt, va_list args);
+obj make_strn_interned(struct workspace *wk, const char *str, uint32_t n);
+obj str_intern(struct workspace *wk, obj s);
 
 void str_app(struct workspace *wk, obj *s, const char *str);
 void str_appf(struct workspace *wk, obj *s, const char *fmt, ...) MUON_ATTR_FORMAT(printf, 3, 4);
 void str_appn(struct workspace *wk, obj *s, const char *str, uint32_t n);
 void str_apps(struct workspace *wk, obj *s, obj s_id);
+void str_apps_unique(struct workspace *wk, obj s, obj s_id);
 
 obj str_clone(struct workspace *wk_src, struct workspace *wk_dest, obj val);
 obj str_clone_mutable(struct workspace *wk, obj val);
@@ -27,7 +27,9 @@ enum op {
 	op_mod,
 	op_not,
 	op_eq,
+	op_neq,
 	op_in,
+	op_not_in,
 	op_gt,
 	op_lt,
 	op_negate,
@@ -39,6 +41,7 @@ enum op {
 	op_return_end,
 	op_call,
 	op_call_native,
+	op_call_native_kw,
 	op_member,
 	op_index,
 	op_iterator,
@@ -52,6 +55,12 @@ enum op {
 	op_dup,
 	op_swap,
 	op_typecheck,
+	// Superinstructions, not emitted for the analyzer
+	op_constant_load,
+	op_constant_store,
+	op_call_member,
+	op_iterator_keys,
+	op_iterator_concat,
 	// Analyzer only ops
 	op_az_branch,
 	op_az_merge,
@@ -95,6 +104,16 @@ struct object_stack {
 	uint32_t i, bucket;
 };
 
+/*
+ * Remembers which args_kw slot a keyword argument at an op_call_native_kw call
+ * site resolved to.  The key pointer is compared against the callee's table
+ * before the slot is trusted.
+ */
+struct vm_kwarg_cache_entry {
+	const char *key;
+	uint32_t slot;
+};
+
 struct source_location_mapping {
 	struct source_location loc;
 	uint32_t src_idx, ip;
@@ -162,7 +181,7 @@ struct vm_objects {
 	struct bucket_arr objs;
 	struct bucket_arr dict_elems, dict_hashes;
 	struct bucket_arr obj_aos[obj_type_count - _obj_aos_start];
-	struct hash obj_hash, str_hash;
+	struct hash obj_hash, str_hash, dedup_hash;
 	bool obj_clear_mark_set;
 };
 
@@ -175,6 +194,9 @@ struct vm {
 	struct object_stack stack;
 	struct arr call_stack, locations, code, src;
 	uint32_t ip, nargs, nkwargs;
+	/* kwarg slot caches for op_call_native_kw, indexed by kwarg_cache_base */
+	struct arr kwarg_cache;
+	uint32_t kwarg_cache_base;
 	obj scope_stack, default_scope_stack;
 	obj modules;
 
@@ -183,6 +205,7 @@ struct vm {
 	struct vm_behavior behavior;
 	struct vm_compiler_state compiler_state;
 	struct vm_dbg_state dbg_state;
+	struct profile *profile; // set by setup -p
 
 	enum language_mode lang_mode;
 
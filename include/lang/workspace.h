@@ -51,6 +51,9 @@ struct workspace {
 		char *const *argv;
 	} original_commandline;
 
+	/* set by setup -r, skip setup if no regenerate dependency changed */
+	bool regenerate_if_changed;
+
 	/* Global objects
 	 * These should probably be cleaned up into a separate struct.
 	 * ----------------- */
@@ -48,13 +48,21 @@ bool fs_ftell(FILE *file, uint64_t *res);
 const char *fs_user_home(void);
 bool fs_is_a_tty_from_fd(int fd);
 bool fs_is_a_tty(FILE *f);
+// returns true if fd becomes readable, or reaches end of file, within timeout_ms
+bool fs_wait_for_input(int fd, uint32_t timeout_ms);
 bool fs_chmod(const char *path, uint32_t mode);
+bool fs_touch(const char *path);
 bool fs_copy_metadata(const char *src, const char *dest);
 bool fs_remove(const char *path);
+bool fs_rename(const char *old_path, const char *new_path);
 bool fs_has_extension(const char *path, const char *ext);
 FILE *fs_make_tmp_file(const char *name, const char *suffix, char *buf, uint32_t len);
 bool fs_make_writeable_if_exists(const char *path);
 
+void fs_cache_enable(bool enable);
+void fs_cache_invalidate(const char *path);
+void fs_cache_invalidate_all(void);
+
 typedef enum iteration_result((*fs_dir_foreach_cb)(void *_ctx, const char *path));
 bool fs_dir_foreach(const char *path, void *_ctx, fs_dir_foreach_cb cb);
 
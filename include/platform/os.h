@@ -39,4 +39,6 @@ uint32_t os_parallel_job_count(void);
 
 void os_set_env(const struct str *k, const struct str *v);
 const char *os_get_env(const char *k);
+
+uint32_t os_get_pid(void);
 #endif
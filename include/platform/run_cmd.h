@@ -29,6 +29,11 @@ enum run_cmd_ctx_flags {
 	run_cmd_ctx_flag_async = 1 << 0,
 	run_cmd_ctx_flag_dont_capture = 1 << 1,
 	run_cmd_ctx_flag_tee = 1 << 2,
+	// the command only writes files the caller knows about and invalidates
+	// itself, so the filesystem cache can be kept
+	run_cmd_ctx_flag_known_outputs = 1 << 3,
+	// restrict the command to the cpu in run_cmd_ctx.cpu
+	run_cmd_ctx_flag_pin_cpu = 1 << 4,
 };
 
 #ifdef _WIN32
@@ -41,12 +46,21 @@ struct win_pipe_inst {
 };
 #endif
 
+struct run_cmd_rusage {
+	double user, sys; // cpu time in seconds
+	uint64_t max_rss; // peak resident set size in KiB
+	uint64_t nvcsw, nivcsw; // voluntary and involuntary context switches
+	bool have;
+};
+
 struct run_cmd_ctx {
 	struct sbuf err, out;
 	const char *err_msg; // set on error
 	const char *chdir; // set by caller
 	const char *stdin_path; // set by caller
+	uint32_t cpu; // set by caller, used with run_cmd_ctx_flag_pin_cpu
 	int status;
+	struct run_cmd_rusage rusage; // set when the child is reaped, if supported
 	enum run_cmd_ctx_flags flags;
 #ifdef _WIN32
 	HANDLE process, ioport;
@@ -86,6 +100,13 @@ bool run_cmd_argv(struct run_cmd_ctx *ctx, char *const *argv, const char *envstr
 enum run_cmd_state run_cmd_collect(struct run_cmd_ctx *ctx);
 void run_cmd_ctx_destroy(struct run_cmd_ctx *ctx);
 bool run_cmd_kill(struct run_cmd_ctx *ctx, bool force);
+// Check that commands can be restricted to cpu with run_cmd_ctx_flag_pin_cpu.
+bool run_cmd_check_cpu_affinity(uint32_t cpu);
+
+// cpu time of every child reaped so far, used to attribute child time when
+// profiling
+void run_cmd_record_rusage(const struct run_cmd_rusage *rusage);
+double run_cmd_children_cpu_time(void);
 
 // runs a command by passing a single string containing both the command and
 // arguments.
@@ -20,6 +20,7 @@
 #include "backend/ninja/rules.c"
 #include "backend/output.c"
 #include "backend/xcode.c"
+#include "cmd_fmt.c"
 #include "cmd_install.c"
 #include "cmd_subprojects.c"
 #include "cmd_test.c"
@@ -82,14 +83,17 @@
 #include "guess.c"
 #include "install.c"
 #include "lang/analyze.c"
+#include "lang/bytecode_cache.c"
 #include "lang/compiler.c"
 #include "lang/eval.c"
 #include "lang/fmt.c"
 #include "lang/func_lookup.c"
 #include "lang/lexer.c"
+#include "lang/lsp.c"
 #include "lang/object.c"
 #include "lang/object_iterators.c"
 #include "lang/parser.c"
+#include "lang/profile.c"
 #include "lang/serial.c"
 #include "lang/string.c"
 #include "lang/typecheck.c"
@@ -816,6 +816,7 @@ ca_regenerate_build_command(struct workspace *wk, bool opts_only)
 		obj_array_push(wk, regen_args, make_str(wk, "-C"));
 		obj_array_push(wk, regen_args, make_str(wk, wk->source_root));
 		obj_array_push(wk, regen_args, make_str(wk, "setup"));
+		obj_array_push(wk, regen_args, make_str(wk, "-r"));
 	}
 
 	obj key, val;
@@ -19,6 +19,8 @@ const struct output_path output_path = {
 	.install = "install.dat",
 	.compiler_check_cache = "compiler_check_cache.dat",
 	.option_info = "option_info.dat",
+	.regenerate_fingerprint = "regenerate_fingerprint.txt",
+	.bytecode_cache_dir = "bytecode_cache",
 };
 
 FILE *
@@ -0,0 +1,584 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "compat.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd_fmt.h"
+#include "datastructures/arr.h"
+#include "datastructures/hash.h"
+#include "iterator.h"
+#include "lang/fmt.h"
+#include "lang/string.h"
+#include "log.h"
+#include "platform/filesystem.h"
+#include "platform/mem.h"
+#include "platform/os.h"
+#include "platform/path.h"
+#include "platform/run_cmd.h"
+#include "platform/timer.h"
+#include "sha_256.h"
+#include "version.h"
+
+#define FORMAT_SLEEP_TIME 1000000 // 1ms
+#define FORMAT_MAX_BATCH 64
+// Below this many files spawning workers costs more than it saves
+#define FORMAT_PARALLEL_MIN_FILES 16
+
+struct format_file {
+	char *path;
+	uint8_t digest[32];
+	bool have_digest, ok;
+};
+
+/*
+ * Maps absolute paths to the digest of the content and formatter settings
+ * they last passed muon fmt -q with.
+ */
+struct format_cache {
+	struct hash paths; // path -> index into entries
+	struct arr entries; // struct format_cache_entry
+	bool dirty;
+};
+
+struct format_cache_entry {
+	char *path;
+	uint8_t digest[32];
+};
+
+struct format_ctx {
+	struct format_options *opts;
+	struct arr files; // struct format_file
+	struct format_cache cache;
+};
+
+/*
+ * A contiguous range of files handed to a worker process.  Batches are
+ * small relative to the file count so that idle workers keep picking up
+ * new batches until the queue is drained, and worker output is printed in
+ * batch order so it doesn't depend on scheduling.
+ */
+struct format_batch {
+	uint32_t start, len;
+	struct run_cmd_ctx cmd_ctx;
+	bool running, done, ok;
+};
+
+static char *
+format_strdup(const char *s)
+{
+	uint32_t len = strlen(s);
+	char *r = z_malloc(len + 1);
+	memcpy(r, s, len + 1);
+	return r;
+}
+
+static int32_t
+format_path_compare(const void *_a, const void *_b, void *_ctx)
+{
+	return strcmp(*(const char **)_a, *(const char **)_b);
+}
+
+static void
+format_free_paths(struct arr *paths)
+{
+	uint32_t i;
+	for (i = 0; i < paths->len; ++i) {
+		z_free(*(char **)arr_get(paths, i));
+	}
+	arr_destroy(paths);
+}
+
+/******************************************************************************
+ * file discovery
+ ******************************************************************************/
+
+static bool
+format_is_meson_file(const char *name)
+{
+	return strcmp(name, "meson.build") == 0 || strcmp(name, "meson.options") == 0
+	       || strcmp(name, "meson_options.txt") == 0;
+}
+
+static enum iteration_result
+format_collect_dir_iter(void *_ctx, const char *name)
+{
+	struct arr *entries = _ctx;
+
+	if (*name == '.') {
+		return ir_cont;
+	}
+
+	char *entry = format_strdup(name);
+	arr_push(entries, &entry);
+	return ir_cont;
+}
+
+static bool
+format_collect_dir(struct format_ctx *ctx, const char *dir)
+{
+	bool ret = true;
+	uint32_t i;
+	struct arr entries;
+	arr_init(&entries, 16, sizeof(char *));
+
+	if (!fs_dir_foreach(dir, &entries, format_collect_dir_iter)) {
+		ret = false;
+		goto ret;
+	}
+
+	// Sort so that the file order doesn't depend on the filesystem
+	arr_sort(&entries, NULL, format_path_compare);
+
+	SBUF_manual(path);
+	for (i = 0; i < entries.len; ++i) {
+		const char *name = *(const char **)arr_get(&entries, i);
+		path_join(0, &path, dir, name);
+
+		if (fs_dir_exists(path.buf)) {
+			if (fs_symlink_exists(path.buf)) {
+				continue;
+			}
+
+			if (!format_collect_dir(ctx, path.buf)) {
+				ret = false;
+			}
+		} else if (format_is_meson_file(name)) {
+			arr_push(&ctx->files, &(struct format_file){ .path = format_strdup(path.buf) });
+		}
+	}
+	sbuf_destroy(&path);
+
+ret:
+	format_free_paths(&entries);
+	return ret;
+}
+
+/******************************************************************************
+ * formatting
+ ******************************************************************************/
+
+static bool
+format_file(struct format_options *opts, const char *path)
+{
+	bool ret = true, opened_out = false;
+	FILE *out;
+
+	struct source src = { 0 };
+	if (!fs_read_entire_file(path, &src)) {
+		ret = false;
+		goto ret;
+	}
+
+	if (opts->in_place) {
+		if (!(out = fs_fopen(path, "wb"))) {
+			ret = false;
+			goto ret;
+		}
+		opened_out = true;
+	} else if (opts->check_only) {
+		out = NULL;
+	} else {
+		out = stdout;
+	}
+
+	ret = fmt(&src, out, opts->cfg_path, opts->check_only, opts->editorconfig);
+ret:
+	if (opened_out) {
+		fs_fclose(out);
+
+		if (!ret) {
+			fs_write(path, (const uint8_t *)src.src, src.len);
+		}
+	}
+	fs_source_destroy(&src);
+	return ret;
+}
+
+static bool
+format_batch_start(struct format_ctx *ctx, struct format_batch *b)
+{
+	const struct format_options *opts = ctx->opts;
+	uint32_t i, argc = 0;
+	const char **argv = z_calloc(b->len + 10, sizeof(const char *));
+
+	argv[argc++] = opts->argv0;
+	argv[argc++] = "fmt";
+	argv[argc++] = "-j";
+	argv[argc++] = "1";
+	if (opts->in_place) {
+		argv[argc++] = "-i";
+	}
+	if (opts->check_only) {
+		argv[argc++] = "-q";
+	}
+	if (opts->editorconfig) {
+		argv[argc++] = "-e";
+	}
+	if (opts->cfg_path) {
+		argv[argc++] = "-c";
+		argv[argc++] = opts->cfg_path;
+	}
+	argv[argc++] = "--";
+
+	for (i = 0; i < b->len; ++i) {
+		argv[argc++] = ((struct format_file *)arr_get(&ctx->files, b->start + i))->path;
+	}
+
+	b->cmd_ctx = (struct run_cmd_ctx){ .flags = run_cmd_ctx_flag_async };
+	bool ret = run_cmd_argv(&b->cmd_ctx, (char *const *)argv, NULL, 0);
+	if (!ret) {
+		LOG_E("failed to start formatter: %s", b->cmd_ctx.err_msg);
+	}
+
+	z_free((void *)argv);
+	return ret;
+}
+
+static bool
+format_run_parallel(struct format_ctx *ctx)
+{
+	const uint32_t num_files = ctx->files.len, jobs = ctx->opts->jobs;
+	uint32_t i, batch_size = num_files / (jobs * 4);
+
+	if (batch_size < 1) {
+		batch_size = 1;
+	} else if (batch_size > FORMAT_MAX_BATCH) {
+		batch_size = FORMAT_MAX_BATCH;
+	}
+
+	const uint32_t num_batches = (num_files + batch_size - 1) / batch_size;
+	struct format_batch *batches = z_calloc(num_batches, sizeof(struct format_batch)), *b;
+	for (i = 0; i < num_batches; ++i) {
+		batches[i].start = i * batch_size;
+		batches[i].len = num_files - batches[i].start < batch_size ? num_files - batches[i].start : batch_size;
+	}
+
+	bool ret = true, progress;
+	uint32_t next = 0, running = 0, flushed = 0;
+	while (flushed < num_batches) {
+		progress = false;
+
+		while (running < jobs && next < num_batches) {
+			b = &batches[next++];
+			if (format_batch_start(ctx, b)) {
+				b->running = true;
+				++running;
+			} else {
+				b->done = true;
+			}
+		}
+
+		for (i = flushed; i < next; ++i) {
+			b = &batches[i];
+			if (!b->running) {
+				continue;
+			}
+
+			switch (run_cmd_collect(&b->cmd_ctx)) {
+			case run_cmd_running: continue;
+			case run_cmd_error: LOG_E("error running formatter: %s", b->cmd_ctx.err_msg); break;
+			case run_cmd_finished: b->ok = b->cmd_ctx.status == 0; break;
+			}
+
+			b->running = false;
+			b->done = true;
+			--running;
+			progress = true;
+		}
+
+		while (flushed < num_batches && batches[flushed].done) {
+			b = &batches[flushed];
+			if (b->cmd_ctx.out.len) {
+				fs_fwrite(b->cmd_ctx.out.buf, b->cmd_ctx.out.len, stdout);
+			}
+			if (b->cmd_ctx.err.len) {
+				fs_fwrite(b->cmd_ctx.err.buf, b->cmd_ctx.err.len, stderr);
+			}
+
+			for (i = 0; i < b->len; ++i) {
+				((struct format_file *)arr_get(&ctx->files, b->start + i))->ok = b->ok;
+			}
+
+			ret &= b->ok;
+			run_cmd_ctx_destroy(&b->cmd_ctx);
+			++flushed;
+		}
+
+		if (!progress) {
+			timer_sleep(FORMAT_SLEEP_TIME);
+		}
+	}
+
+	z_free(batches);
+	return ret;
+}
+
+/******************************************************************************
+ * cache
+ ******************************************************************************/
+
+#define FORMAT_CACHE_HEADER "muon fmt cache 1"
+
+static void
+format_cache_set(struct format_cache *cache, const char *path, const uint8_t digest[32])
+{
+	uint64_t *idx;
+	struct format_cache_entry *e;
+
+	if ((idx = hash_get_strn(&cache->paths, path, strlen(path)))) {
+		e = arr_get(&cache->entries, *idx);
+	} else {
+		uint32_t i = arr_push(&cache->entries, &(struct format_cache_entry){ .path = format_strdup(path) });
+		e = arr_get(&cache->entries, i);
+		hash_set_strn(&cache->paths, e->path, strlen(e->path), i);
+	}
+
+	memcpy(e->digest, digest, 32);
+}
+
+static bool
+format_cache_hex_decode(const char *hex, uint8_t digest[32])
+{
+	uint32_t i;
+	for (i = 0; i < 32; ++i) {
+		char byte[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+		if (strspn(byte, "0123456789abcdef") != 2) {
+			return false;
+		}
+		digest[i] = strtoul(byte, NULL, 16);
+	}
+
+	return true;
+}
+
+/*
+ * The cache is a text file with a header line identifying the muon
+ * version, followed by lines of the form "<sha256 hex> <absolute path>".  A
+ * cache written by a different version of muon is ignored since the
+ * formatter itself may have changed.
+ */
+static void
+format_cache_load(struct format_cache *cache, const char *cache_path)
+{
+	hash_init_str(&cache->paths, 1024);
+	arr_init(&cache->entries, 1024, sizeof(struct format_cache_entry));
+
+	if (!fs_file_exists(cache_path)) {
+		return;
+	}
+
+	struct source src = { 0 };
+	if (!fs_read_entire_file(cache_path, &src)) {
+		return;
+	}
+
+	SBUF_manual(header);
+	sbuf_pushf(0, &header, FORMAT_CACHE_HEADER " %s%s\n", muon_version.version, muon_version.vcs_tag);
+
+	if (src.len < header.len || memcmp(src.src, header.buf, header.len) != 0) {
+		goto ret;
+	}
+
+	const char *line = src.src + header.len, *end = src.src + src.len, *nl;
+	uint8_t digest[32];
+	SBUF_manual(path);
+	for (; line < end; line = nl + 1) {
+		if (!(nl = memchr(line, '\n', end - line))) {
+			break;
+		}
+
+		if (nl - line < 66 || line[64] != ' ' || !format_cache_hex_decode(line, digest)) {
+			continue;
+		}
+
+		sbuf_clear(&path);
+		sbuf_pushn(0, &path, line + 65, nl - (line + 65));
+		format_cache_set(cache, path.buf, digest);
+	}
+	sbuf_destroy(&path);
+
+ret:
+	sbuf_destroy(&header);
+	fs_source_destroy(&src);
+}
+
+static bool
+format_cache_save(struct format_cache *cache, const char *cache_path)
+{
+	uint32_t i, j;
+	SBUF_manual(buf);
+	sbuf_pushf(0, &buf, FORMAT_CACHE_HEADER " %s%s\n", muon_version.version, muon_version.vcs_tag);
+
+	for (i = 0; i < cache->entries.len; ++i) {
+		const struct format_cache_entry *e = arr_get(&cache->entries, i);
+		for (j = 0; j < 32; ++j) {
+			sbuf_pushf(0, &buf, "%02x", e->digest[j]);
+		}
+		sbuf_pushf(0, &buf, " %s\n", e->path);
+	}
+
+	// Write to a temporary file first so that concurrent runs never see a
+	// partially written cache.
+	SBUF_manual(tmp_path);
+	sbuf_pushf(0, &tmp_path, "%s.%" PRIu32 ".tmp", cache_path, os_get_pid());
+
+	bool ret = fs_write(tmp_path.buf, (const uint8_t *)buf.buf, buf.len);
+	if (ret && !(ret = fs_rename(tmp_path.buf, cache_path))) {
+		fs_remove(tmp_path.buf);
+	}
+
+	sbuf_destroy(&tmp_path);
+	sbuf_destroy(&buf);
+	return ret;
+}
+
+static void
+format_cache_destroy(struct format_cache *cache)
+{
+	uint32_t i;
+	for (i = 0; i < cache->entries.len; ++i) {
+		z_free(((struct format_cache_entry *)arr_get(&cache->entries, i))->path);
+	}
+	arr_destroy(&cache->entries);
+	hash_destroy(&cache->paths);
+}
+
+/*
+ * Compute a digest over the file's content and the formatter settings that
+ * apply to it.  Returns false if the file couldn't be read, in which case
+ * it is left for the formatter to report.
+ */
+static bool
+format_file_digest(struct format_options *opts, struct format_file *file)
+{
+	bool ret = false;
+	uint8_t buf[64];
+	struct source src = { 0 };
+
+	if (!fs_file_exists(file->path) || !fs_read_entire_file(file->path, &src)) {
+		return false;
+	}
+
+	if (!fmt_opts_digest(&src, opts->cfg_path, opts->editorconfig, buf)) {
+		goto ret;
+	}
+
+	calc_sha_256(&buf[32], src.src, src.len);
+	calc_sha_256(file->digest, buf, sizeof(buf));
+	ret = true;
+ret:
+	fs_source_destroy(&src);
+	return ret;
+}
+
+/*
+ * Drop files from ctx->files whose content and settings are unchanged since
+ * they last passed.
+ */
+static void
+format_cache_filter(struct format_ctx *ctx)
+{
+	uint32_t i, kept = 0;
+	uint64_t *idx;
+	SBUF_manual(abs);
+
+	for (i = 0; i < ctx->files.len; ++i) {
+		struct format_file *file = arr_get(&ctx->files, i);
+
+		path_make_absolute(0, &abs, file->path);
+		z_free(file->path);
+		file->path = format_strdup(abs.buf);
+
+		if ((file->have_digest = format_file_digest(ctx->opts, file))
+			&& (idx = hash_get_strn(&ctx->cache.paths, file->path, strlen(file->path)))
+			&& memcmp(((struct format_cache_entry *)arr_get(&ctx->cache.entries, *idx))->digest,
+				   file->digest,
+				   32)
+				   == 0) {
+			z_free(file->path);
+			continue;
+		}
+
+		*(struct format_file *)arr_get(&ctx->files, kept) = *file;
+		++kept;
+	}
+
+	L("%d/%d files unchanged since last check", ctx->files.len - kept, ctx->files.len);
+	ctx->files.len = kept;
+	sbuf_destroy(&abs);
+}
+
+static void
+format_cache_update(struct format_ctx *ctx)
+{
+	uint32_t i;
+	for (i = 0; i < ctx->files.len; ++i) {
+		const struct format_file *file = arr_get(&ctx->files, i);
+		if (file->ok && file->have_digest) {
+			format_cache_set(&ctx->cache, file->path, file->digest);
+			ctx->cache.dirty = true;
+		}
+	}
+}
+
+/******************************************************************************
+ * entrypoint
+ ******************************************************************************/
+
+bool
+format_run(struct format_options *opts, char *const *paths, uint32_t num_paths)
+{
+	bool ret = true;
+	uint32_t i;
+	struct format_ctx ctx = { .opts = opts };
+	arr_init(&ctx.files, num_paths, sizeof(struct format_file));
+
+	for (i = 0; i < num_paths; ++i) {
+		if (opts->recursive && fs_dir_exists(paths[i])) {
+			if (!format_collect_dir(&ctx, paths[i])) {
+				ret = false;
+			}
+		} else {
+			arr_push(&ctx.files, &(struct format_file){ .path = format_strdup(paths[i]) });
+		}
+	}
+
+	if (opts->cache_path) {
+		format_cache_load(&ctx.cache, opts->cache_path);
+		format_cache_filter(&ctx);
+	}
+
+	if (!opts->jobs) {
+		opts->jobs = ctx.files.len < FORMAT_PARALLEL_MIN_FILES ? 1 : os_parallel_job_count();
+	}
+
+	if (opts->jobs > 1 && ctx.files.len > 1) {
+		ret &= format_run_parallel(&ctx);
+	} else {
+		for (i = 0; i < ctx.files.len; ++i) {
+			struct format_file *file = arr_get(&ctx.files, i);
+			file->ok = format_file(opts, file->path);
+			ret &= file->ok;
+		}
+	}
+
+	if (opts->cache_path) {
+		format_cache_update(&ctx);
+		if (ctx.cache.dirty && !format_cache_save(&ctx.cache, opts->cache_path)) {
+			ret = false;
+		}
+		format_cache_destroy(&ctx.cache);
+	}
+
+	for (i = 0; i < ctx.files.len; ++i) {
+		z_free(((struct format_file *)arr_get(&ctx.files, i))->path);
+	}
+	arr_destroy(&ctx.files);
+	return ret;
+}
@@ -9,6 +9,7 @@
 
 #include "cmd_subprojects.h"
 #include "lang/analyze.h"
+#include "log.h"
 #include "opts.h"
 #include "platform/os.h"
 #include "platform/path.h"
@@ -59,15 +60,34 @@ static bool
 cmd_subprojects_update(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 {
 	struct workspace *wk = _ctx;
+	uint32_t jobs = os_parallel_job_count();
 
-	OPTSTART("") {
+	OPTSTART("j:") {
+	case 'j': {
+		char *endptr;
+		unsigned long n = strtoul(optarg, &endptr, 10);
+
+		if (n < 1 || n > UINT32_MAX || *endptr) {
+			LOG_E("invalid number of jobs: %s", optarg);
+			return false;
+		}
+
+		jobs = n;
+		break;
 	}
-	OPTEND(argv[argi], " <list of subprojects>", "", NULL, -1)
+	}
+	OPTEND(argv[argi],
+		" <list of subprojects>",
+		"  -j <jobs> - set the number of subprojects updated in parallel\n",
+		NULL,
+		-1)
 
 	cmd_subprojects_args_to_list(wk, argc, argi, argv);
 
+	wk->vm.behavior.assign_variable(wk, "jobs", make_number(wk, jobs), 0, assign_local);
+
 	obj res;
-	return eval_str(wk, "import('subprojects').update(argv)", eval_mode_repl, &res);
+	return eval_str(wk, "import('subprojects').update(argv, jobs: jobs)", eval_mode_repl, &res);
 }
 
 static bool
@@ -136,6 +156,7 @@ cmd_subprojects(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 	struct workspace wk;
 	workspace_init_bare(&wk);
 	workspace_init_runtime(&wk);
+	wk.argv0 = argv[0];
 
 	SBUF(path);
 
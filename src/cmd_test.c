@@ -5,6 +5,7 @@
 
 #include "compat.h"
 
+#include <inttypes.h>
 #include <string.h>
 
 #include "args.h"
@@ -14,6 +15,7 @@
 #include "cmd_test.h"
 #include "embedded.h"
 #include "error.h"
+#include "external/tinyjson.h"
 #include "formats/tap.h"
 #include "functions/environment.h"
 #include "lang/serial.h"
@@ -29,6 +31,8 @@
 #include "util.h"
 
 #define SLEEP_TIME 10000000 // 10ms
+// benchmark durations are only as precise as the polling interval
+#define BENCH_SLEEP_TIME 100000 // 0.1ms
 
 enum test_result_status {
 	test_result_status_running,
@@ -49,6 +53,32 @@ struct test_result {
 		bool have;
 		uint32_t pass, total;
 	} subtests;
+	struct {
+		uint32_t i, run; // index into run_test_ctx.bench.results
+	} bench;
+};
+
+struct bench_sample {
+	float dur;
+	struct run_cmd_rusage rusage;
+};
+
+struct bench_result {
+	obj proj_name, name;
+	struct arr samples;
+	uint32_t runs_remaining;
+	enum test_result_status status;
+
+	struct {
+		float min, max, median, mean, stddev;
+		double user, sys;
+		uint64_t max_rss;
+	} stats;
+
+	struct {
+		bool have, regressed;
+		float median, change;
+	} baseline;
 };
 
 struct run_test_ctx {
@@ -77,8 +107,14 @@ struct run_test_ctx {
 	struct arr test_results;
 	struct arr jobs_sorted;
 
+	struct {
+		struct arr results;
+		obj baseline;
+	} bench;
+
 	struct test_result *jobs;
 	uint32_t busy_jobs;
+	uint64_t sleep_time;
 	bool serial;
 };
 
@@ -617,6 +653,298 @@ check_test_result_tap(struct workspace *wk, const struct run_test_ctx *ctx, stru
 	return tap_result.all_ok && res->status == 0 ? test_result_status_ok : test_result_status_failed;
 }
 
+/*
+ * Benchmarks
+ */
+
+static float
+bench_sqrt(float v)
+{
+	// newton's method, to avoid depending on libm
+	float x = v;
+	uint32_t i;
+
+	if (v <= 0.0f) {
+		return 0.0f;
+	}
+
+	for (i = 0; i < 32; ++i) {
+		x = 0.5f * (x + v / x);
+	}
+	return x;
+}
+
+static int32_t
+bench_sample_compare(const void *_a, const void *_b, void *_ctx)
+{
+	const struct bench_sample *a = _a, *b = _b;
+
+	if (a->dur < b->dur) {
+		return -1;
+	} else if (a->dur > b->dur) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+static void
+bench_calc_stats(struct bench_result *b)
+{
+	uint32_t i, n = b->samples.len;
+
+	if (!n) {
+		return;
+	}
+
+	arr_sort(&b->samples, NULL, bench_sample_compare);
+
+	const struct bench_sample *lo = arr_get(&b->samples, (n - 1) / 2), *hi = arr_get(&b->samples, n / 2);
+	b->stats.median = (lo->dur + hi->dur) / 2.0f;
+	b->stats.min = ((struct bench_sample *)arr_get(&b->samples, 0))->dur;
+	b->stats.max = ((struct bench_sample *)arr_get(&b->samples, n - 1))->dur;
+
+	for (i = 0; i < n; ++i) {
+		const struct bench_sample *sample = arr_get(&b->samples, i);
+		b->stats.mean += sample->dur;
+		b->stats.user += sample->rusage.user;
+		b->stats.sys += sample->rusage.sys;
+		b->stats.max_rss = MAX(b->stats.max_rss, sample->rusage.max_rss);
+	}
+
+	b->stats.mean /= n;
+	b->stats.user /= n;
+	b->stats.sys /= n;
+
+	if (n > 1) {
+		float var = 0.0f;
+		for (i = 0; i < n; ++i) {
+			const struct bench_sample *sample = arr_get(&b->samples, i);
+			var += (sample->dur - b->stats.mean) * (sample->dur - b->stats.mean);
+		}
+		b->stats.stddev = bench_sqrt(var / (n - 1));
+	}
+}
+
+static obj
+bench_result_key(struct workspace *wk, const struct bench_result *b)
+{
+	return make_strf(wk, "%s:%s", get_cstr(wk, b->proj_name), get_cstr(wk, b->name));
+}
+
+static void
+bench_compare_baseline(struct workspace *wk, struct run_test_ctx *ctx, struct bench_result *b)
+{
+	obj entry, median_us;
+	if (!ctx->bench.baseline || !b->samples.len) {
+		return;
+	} else if (!obj_dict_index(wk, ctx->bench.baseline, bench_result_key(wk, b), &entry)) {
+		return;
+	} else if (get_obj_type(wk, entry) != obj_dict || !obj_dict_index_str(wk, entry, "median_us", &median_us)
+		   || get_obj_type(wk, median_us) != obj_number) {
+		LOG_W("ignoring malformed baseline entry for benchmark '%s'", get_cstr(wk, b->name));
+		return;
+	}
+
+	b->baseline.have = true;
+	b->baseline.median = (float)get_obj_number(wk, median_us) / 1e6f;
+	if (b->baseline.median > 0.0f) {
+		b->baseline.change = (b->stats.median - b->baseline.median) / b->baseline.median * 100.0f;
+	}
+	b->baseline.regressed = b->baseline.change > ctx->opts->bench.threshold;
+}
+
+/* Records a single run of a benchmark.  Returns true when this was the last
+ * run, in which case res is updated to represent the aggregate result.
+ */
+static bool
+bench_record_run(struct workspace *wk, struct run_test_ctx *ctx, struct test_result *res)
+{
+	struct bench_result *b = arr_get(&ctx->bench.results, res->bench.i);
+
+	if (res->status == test_result_status_failed || res->status == test_result_status_timedout) {
+		b->status = res->status;
+	} else if (res->bench.run >= ctx->opts->bench.warmup) {
+		arr_push(&b->samples,
+			&(struct bench_sample){
+				.dur = res->dur,
+				.rusage = res->cmd_ctx.rusage,
+			});
+	}
+
+	assert(b->runs_remaining);
+	if (--b->runs_remaining) {
+		return false;
+	}
+
+	bench_calc_stats(b);
+	bench_compare_baseline(wk, ctx, b);
+
+	if (b->samples.len) {
+		res->dur = b->stats.median;
+	}
+
+	if (b->status != test_result_status_ok) {
+		res->status = b->status;
+	}
+	return true;
+}
+
+static void
+bench_print_results(struct workspace *wk, struct run_test_ctx *ctx)
+{
+	uint32_t i;
+
+	if (!ctx->bench.results.len) {
+		return;
+	}
+
+	log_plain("%-10s %-10s %-10s %-10s %-10s %-10s %-10s %s\n",
+		"median",
+		"min",
+		"stddev",
+		"user",
+		"sys",
+		"max rss",
+		"baseline",
+		"name");
+
+	for (i = 0; i < ctx->bench.results.len; ++i) {
+		const struct bench_result *b = arr_get(&ctx->bench.results, i);
+
+		if (!b->samples.len) {
+			log_plain("%-76s %s\n", "no successful runs", get_cstr(wk, b->name));
+			continue;
+		}
+
+		log_plain("%9.4fs %9.4fs %9.4fs %9.3fs %9.3fs %7" PRIu64 "KiB ",
+			b->stats.median,
+			b->stats.min,
+			b->stats.stddev,
+			b->stats.user,
+			b->stats.sys,
+			b->stats.max_rss);
+
+		if (b->baseline.have) {
+			if (log_clr()) {
+				log_plain("\033[%dm%+9.1f%%\033[0m ", b->baseline.regressed ? 31 : 32, b->baseline.change);
+			} else {
+				log_plain("%+9.1f%% ", b->baseline.change);
+			}
+		} else {
+			log_plain("%-10s ", "-");
+		}
+
+		log_plain("%s%s\n", get_cstr(wk, b->name), b->baseline.regressed ? " - regressed" : "");
+	}
+}
+
+static void
+bench_as_json(struct workspace *wk, struct run_test_ctx *ctx, struct sbuf *data)
+{
+	uint32_t i;
+	bool first = true;
+
+	sbuf_pushs(wk, data, "{\"benchmarks\":{");
+	for (i = 0; i < ctx->bench.results.len; ++i) {
+		const struct bench_result *b = arr_get(&ctx->bench.results, i);
+
+		if (!b->samples.len) {
+			continue;
+		}
+
+		if (!first) {
+			sbuf_push(wk, data, ',');
+		}
+		first = false;
+
+		// muon has no floating point numbers, so times are stored as integer
+		// microseconds to allow the baseline to be read back in.
+		sbuf_push_json_escaped_quoted(wk, data, get_str(wk, bench_result_key(wk, b)));
+		sbuf_pushf(wk,
+			data,
+			":{"
+			"\"samples\":%d,"
+			"\"median_us\":%" PRId64 ","
+			"\"min_us\":%" PRId64 ","
+			"\"max_us\":%" PRId64 ","
+			"\"mean_us\":%" PRId64 ","
+			"\"stddev_us\":%" PRId64 ","
+			"\"user_us\":%" PRId64 ","
+			"\"sys_us\":%" PRId64 ","
+			"\"max_rss_kib\":%" PRIu64 "}",
+			b->samples.len,
+			(int64_t)(b->stats.median * 1e6f),
+			(int64_t)(b->stats.min * 1e6f),
+			(int64_t)(b->stats.max * 1e6f),
+			(int64_t)(b->stats.mean * 1e6f),
+			(int64_t)(b->stats.stddev * 1e6f),
+			(int64_t)(b->stats.user * 1e6f),
+			(int64_t)(b->stats.sys * 1e6f),
+			b->stats.max_rss);
+	}
+	sbuf_pushs(wk, data, "}}");
+}
+
+static bool
+bench_load_baseline(struct workspace *wk, struct run_test_ctx *ctx)
+{
+	bool ret = false;
+	struct source src = { 0 };
+	obj baseline;
+
+	if (!fs_read_entire_file(ctx->opts->bench.baseline, &src)) {
+		return false;
+	}
+
+	// tinyjson modifies its input in place
+	char *json = z_malloc(src.len + 1);
+	memcpy(json, src.src, src.len);
+	json[src.len] = 0;
+
+	if (!muon_json_to_dict(wk, json, &baseline)) {
+		LOG_E("failed to parse benchmark baseline %s", ctx->opts->bench.baseline);
+		goto ret;
+	} else if (!obj_dict_index_str(wk, baseline, "benchmarks", &ctx->bench.baseline)
+		   || get_obj_type(wk, ctx->bench.baseline) != obj_dict) {
+		LOG_E("benchmark baseline %s is missing a 'benchmarks' object", ctx->opts->bench.baseline);
+		ctx->bench.baseline = 0;
+		goto ret;
+	}
+
+	ret = true;
+ret:
+	z_free(json);
+	fs_source_destroy(&src);
+	return ret;
+}
+
+static bool
+bench_save_baseline(struct workspace *wk, struct run_test_ctx *ctx)
+{
+	SBUF(data);
+	bench_as_json(wk, ctx, &data);
+
+	if (!fs_write(ctx->opts->bench.save_baseline, (const uint8_t *)data.buf, data.len)) {
+		return false;
+	}
+
+	LOG_I("wrote benchmark baseline to %s", ctx->opts->bench.save_baseline);
+	return true;
+}
+
+static void
+test_result_finish(struct workspace *wk, struct run_test_ctx *ctx, struct test_result *res)
+{
+	if (ctx->opts->cat == test_category_benchmark && !bench_record_run(wk, ctx, res)) {
+		run_cmd_ctx_destroy(&res->cmd_ctx);
+		return;
+	}
+
+	print_test_progress(wk, ctx, res, true);
+	arr_push(&ctx->test_results, res);
+}
+
 static void
 collect_tests(struct workspace *wk, struct run_test_ctx *ctx)
 {
@@ -638,8 +966,7 @@ collect_tests(struct workspace *wk, struct run_test_ctx *ctx)
 		enum run_cmd_state state = run_cmd_collect(&res->cmd_ctx);
 
 		if (state != run_cmd_running && res->status == test_result_status_timedout) {
-			print_test_progress(wk, ctx, res, true);
-			arr_push(&ctx->test_results, res);
+			test_result_finish(wk, ctx, res);
 			goto free_slot;
 		}
 
@@ -660,8 +987,7 @@ collect_tests(struct workspace *wk, struct run_test_ctx *ctx)
 		}
 		case run_cmd_error:
 			res->status = test_result_status_failed;
-			print_test_progress(wk, ctx, res, true);
-			arr_push(&ctx->test_results, res);
+			test_result_finish(wk, ctx, res);
 			break;
 		case run_cmd_finished: {
 			enum test_result_status status;
@@ -689,8 +1015,7 @@ collect_tests(struct workspace *wk, struct run_test_ctx *ctx)
 				res->status = test_result_status_failed;
 			}
 
-			print_test_progress(wk, ctx, res, true);
-			arr_push(&ctx->test_results, res);
+			test_result_finish(wk, ctx, res);
 			break;
 		}
 		}
@@ -718,7 +1043,9 @@ push_test(struct workspace *wk,
 	const char *argstr,
 	uint32_t argc,
 	const char *envstr,
-	uint32_t envc)
+	uint32_t envc,
+	uint32_t bench_i,
+	uint32_t bench_run)
 {
 	uint32_t i;
 	while (true) {
@@ -741,7 +1068,7 @@ push_test(struct workspace *wk,
 		}
 
 cont:
-		timer_sleep(SLEEP_TIME);
+		timer_sleep(ctx->sleep_time);
 		collect_tests(wk, ctx);
 	}
 found_slot:
@@ -755,12 +1082,18 @@ found_slot:
 		.test = test,
 		.timeout = (test->timeout ? get_obj_number(wk, test->timeout) : 30.0f)
 			   * ctx->setup.timeout_multiplier,
+		.bench = { .i = bench_i, .run = bench_run },
 
 		.cmd_ctx = {
 			.flags = run_cmd_ctx_flag_async,
 		},
 	};
 
+	if (ctx->opts->bench.pin_cpu) {
+		cmd_ctx->flags |= run_cmd_ctx_flag_pin_cpu;
+		cmd_ctx->cpu = ctx->opts->bench.cpu;
+	}
+
 	if (ctx->opts->verbosity > 1) {
 		if (res->test->protocol == test_protocol_tap) {
 			cmd_ctx->flags |= run_cmd_ctx_flag_tee;
@@ -783,8 +1116,7 @@ found_slot:
 
 		res->dur = timer_read(&res->t);
 		res->status = test_result_status_failed;
-		print_test_progress(wk, ctx, res, true);
-		arr_push(&ctx->test_results, res);
+		test_result_finish(wk, ctx, res);
 	}
 }
 
@@ -833,7 +1165,23 @@ run_test(struct workspace *wk, void *_ctx, obj t)
 
 	join_args_argstr(wk, &argstr, &argc, cmdline);
 	env_to_envstr(wk, &envstr, &envc, env);
-	push_test(wk, ctx, test, argstr, argc, envstr, envc);
+
+	if (ctx->opts->cat == test_category_benchmark) {
+		struct bench_result b = {
+			.proj_name = ctx->proj_name,
+			.name = test->name,
+			.runs_remaining = ctx->opts->bench.warmup + ctx->opts->bench.iterations,
+			.status = test_result_status_ok,
+		};
+		arr_init(&b.samples, ctx->opts->bench.iterations, sizeof(struct bench_sample));
+		uint32_t bench_i = arr_push(&ctx->bench.results, &b), run;
+
+		for (run = 0; run < b.runs_remaining; ++run) {
+			push_test(wk, ctx, test, argstr, argc, envstr, envc, bench_i, run);
+		}
+	} else {
+		push_test(wk, ctx, test, argstr, argc, envstr, envc, 0, 0);
+	}
 	return ir_cont;
 }
 
@@ -983,7 +1331,7 @@ run_project_tests(struct workspace *wk, void *_ctx, obj proj_name, obj arr)
 	}
 
 	while (ctx->busy_jobs) {
-		timer_sleep(SLEEP_TIME);
+		timer_sleep(ctx->sleep_time);
 		collect_tests(wk, ctx);
 	}
 
@@ -1067,6 +1415,23 @@ tests_as_json(struct workspace *wk, struct run_test_ctx *ctx, struct sbuf *data)
 			suite_str,
 			res->dur);
 
+		if (res->cmd_ctx.rusage.have) {
+			const struct run_cmd_rusage *ru = &res->cmd_ctx.rusage;
+			sbuf_pushf(wk,
+				data,
+				"\"rusage\":{"
+				"\"user\":%f,"
+				"\"sys\":%f,"
+				"\"max_rss_kib\":%" PRIu64 ","
+				"\"nvcsw\":%" PRIu64 ","
+				"\"nivcsw\":%" PRIu64 "},",
+				ru->user,
+				ru->sys,
+				ru->max_rss,
+				ru->nvcsw,
+				ru->nivcsw);
+		}
+
 		if (res->subtests.have) {
 			sbuf_pushf(wk,
 				data,
@@ -1075,6 +1440,42 @@ tests_as_json(struct workspace *wk, struct run_test_ctx *ctx, struct sbuf *data)
 				res->subtests.total);
 		}
 
+		if (ctx->opts->cat == test_category_benchmark) {
+			const struct bench_result *b = arr_get(&ctx->bench.results, res->bench.i);
+			sbuf_pushf(wk,
+				data,
+				"\"benchmark\":{"
+				"\"samples\":%d,"
+				"\"median\":%f,"
+				"\"min\":%f,"
+				"\"max\":%f,"
+				"\"mean\":%f,"
+				"\"stddev\":%f,"
+				"\"user\":%f,"
+				"\"sys\":%f,"
+				"\"max_rss_kib\":%" PRIu64,
+				b->samples.len,
+				b->stats.median,
+				b->stats.min,
+				b->stats.max,
+				b->stats.mean,
+				b->stats.stddev,
+				b->stats.user,
+				b->stats.sys,
+				b->stats.max_rss);
+
+			if (b->baseline.have) {
+				sbuf_pushf(wk,
+					data,
+					",\"baseline\":{\"median\":%f,\"change\":%f,\"regressed\":%s}",
+					b->baseline.median,
+					b->baseline.change,
+					b->baseline.regressed ? "true" : "false");
+			}
+
+			sbuf_pushs(wk, data, "},");
+		}
+
 		sbuf_pushs(wk, data, "\"stdout\":\"");
 		sbuf_push_json_escaped(wk, data, res->cmd_ctx.out.buf, res->cmd_ctx.out.len);
 		sbuf_pushs(wk, data, "\",\"stderr\":\"");
@@ -1154,15 +1555,19 @@ tests_run(struct test_options *opts, const char *argv0)
 	wk.argv0 = argv0;
 
 	if (!opts->jobs) {
-		opts->jobs = os_parallel_job_count();
+		// benchmarks are run serially by default so that they don't
+		// compete with each other for resources
+		opts->jobs = opts->cat == test_category_benchmark ? 1 : os_parallel_job_count();
 	}
 
 	struct run_test_ctx ctx = {
 		.opts = opts,
 		.setup = { .timeout_multiplier = 1.0f, },
+		.sleep_time = opts->cat == test_category_benchmark ? BENCH_SLEEP_TIME : SLEEP_TIME,
 	};
 
 	arr_init(&ctx.test_results, 32, sizeof(struct test_result));
+	arr_init(&ctx.bench.results, 32, sizeof(struct bench_result));
 	arr_init(&ctx.jobs_sorted, ctx.opts->jobs, sizeof(uint32_t));
 	for (uint32_t i = 0; i < ctx.opts->jobs; ++i) {
 		arr_push(&ctx.jobs_sorted, &i);
@@ -1216,6 +1621,14 @@ tests_run(struct test_options *opts, const char *argv0)
 		goto ret;
 	}
 
+	if (opts->bench.baseline && !bench_load_baseline(&wk, &ctx)) {
+		goto ret;
+	}
+
+	if (opts->bench.pin_cpu && !opts->list && !run_cmd_check_cpu_affinity(opts->bench.cpu)) {
+		goto ret;
+	}
+
 	if (!obj_dict_foreach(&wk, tests_dict, &ctx, run_project_tests)) {
 		goto ret;
 	}
@@ -1242,6 +1655,26 @@ tests_run(struct test_options *opts, const char *argv0)
 	case test_output_json: ret = tests_output_json(&wk, &ctx); break;
 	}
 
+	if (opts->cat == test_category_benchmark) {
+		bench_print_results(&wk, &ctx);
+
+		uint32_t i;
+		for (i = 0; i < ctx.bench.results.len; ++i) {
+			const struct bench_result *b = arr_get(&ctx.bench.results, i);
+			if (b->baseline.regressed) {
+				LOG_E("benchmark '%s' regressed by %.1f%% (threshold %.1f%%)",
+					get_cstr(&wk, b->name),
+					b->baseline.change,
+					opts->bench.threshold);
+				ret = false;
+			}
+		}
+
+		if (opts->bench.save_baseline && !bench_save_baseline(&wk, &ctx)) {
+			ret = false;
+		}
+	}
+
 	{
 		uint32_t i;
 		for (i = 0; i < ctx.test_results.len; ++i) {
@@ -1260,6 +1693,10 @@ tests_run(struct test_options *opts, const char *argv0)
 	}
 
 ret:
+	for (uint32_t i = 0; i < ctx.bench.results.len; ++i) {
+		arr_destroy(&((struct bench_result *)arr_get(&ctx.bench.results, i))->samples);
+	}
+	arr_destroy(&ctx.bench.results);
 	workspace_destroy_bare(&wk);
 	arr_destroy(&ctx.test_results);
 	arr_destroy(&ctx.jobs_sorted);
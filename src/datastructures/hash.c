@@ -8,6 +8,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_GROUP_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HASH_GROUP_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #include "datastructures/arr.h"
 #include "datastructures/hash.h"
 #include "platform/assert.h"
@@ -22,39 +34,133 @@
 
 #define LOAD_FACTOR 0.5f
 
+/*
+ * Metadata is scanned GROUP_WIDTH bytes at a time.  The first GROUP_WIDTH - 1
+ * bytes are mirrored after the end of the table so that a group starting
+ * near the end can be loaded without wrapping.
+ */
+#define GROUP_WIDTH 16
+
+/*
+ * String keys carry their hash, so it is computed once per lookup and stored
+ * with the key on insertion.  Resizing never rehashes, and most mismatches
+ * are rejected without comparing the strings.
+ */
 struct strkey {
 	const char *str;
-	uint64_t len;
+	uint64_t len, hv;
 };
 
-static uint64_t
-fnv_1a_64_str(const struct hash *hash, const void *_key)
+/*
+ * A wyhash-style hash: keys are consumed 8 or 16 bytes at a time and mixed
+ * with a 64x64->128 bit multiply.
+ */
+static const uint64_t hash_secret[4] = {
+	0x2d358dccaa6c78a5u,
+	0x8bb84b93962eacc9u,
+	0x4b33a62ed433d4a3u,
+	0x4d5a2da51de1aa47u,
+};
+
+static inline void
+hash_mum(uint64_t *a, uint64_t *b)
 {
-	const struct strkey *key = _key;
-	uint64_t h = 14695981039346656037u;
-	uint16_t i;
+#if defined(__SIZEOF_INT128__)
+	__extension__ unsigned __int128 r = *a;
+	r *= *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	const uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+	uint64_t lo = t + (rm1 << 32), hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl);
+	hi += lo < t;
+	*a = lo;
+	*b = hi;
+#endif
+}
 
-	for (i = 0; i < key->len; i++) {
-		h ^= key->str[i];
-		h *= 1099511628211u;
-	}
+static inline uint64_t
+hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
+	return a ^ b;
+}
 
-	return h;
+static inline uint64_t
+hash_read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
 }
 
-static uint64_t
-fnv_1a_64(const struct hash *hash, const void *_key)
+static inline uint64_t
+hash_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t
+hash_bytes(const void *key, uint64_t len, uint64_t seed)
 {
-	const uint8_t *key = _key;
-	uint64_t h = 14695981039346656037u;
-	uint16_t i;
+	const uint8_t *p = key;
+	uint64_t a, b, i = len;
+
+	seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (hash_read32(p) << 32) | hash_read32(p + ((len >> 3) << 2));
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+				seed1 = hash_mix(hash_read64(p + 16) ^ hash_secret[2], hash_read64(p + 24) ^ seed1);
+				seed2 = hash_mix(hash_read64(p + 32) ^ hash_secret[3], hash_read64(p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
 
-	for (i = 0; i < hash->keys.item_size; i++) {
-		h ^= key[i];
-		h *= 1099511628211u;
+		while (i > 16) {
+			seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
 	}
 
-	return h;
+	a ^= hash_secret[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+	return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+static uint64_t
+hash_func_str(const struct hash *hash, const void *_key)
+{
+	const struct strkey *key = _key;
+	return key->hv;
+}
+
+static uint64_t
+hash_func_bytes(const struct hash *hash, const void *key)
+{
+	return hash_bytes(key, hash->keys.item_size, 0);
 }
 
 struct hash_elem {
@@ -64,22 +170,57 @@ struct hash_elem {
 static void
 fill_meta_with_empty(struct hash *h)
 {
-	const uint32_t len = h->cap >> 3;
-	uint64_t *e = (uint64_t *)h->meta.e;
+	memset(h->meta.e, k_empty, h->cap + GROUP_WIDTH - 1);
+}
+
+static void
+set_meta(struct hash *h, uint64_t i, uint8_t v)
+{
+	uint8_t *meta = h->meta.e;
 
-	uint32_t i;
-	for (i = 0; i < len; ++i) {
-		e[i] = 9259542123273814144u;
-		/* this number is just k_empty (128) 8 times:
-		 * ((128 << 56) | (128 << 48) | (128 << 40) | (128 << 32)
-		 * | (128 << 24) | (128 << 16) | (128 << 8) | (128)) */
+	meta[i] = v;
+	for (i += h->cap; i < h->cap + GROUP_WIDTH - 1; i += h->cap) {
+		meta[i] = v;
 	}
 }
 
-static void
-prepare_table(struct hash *h)
+/*
+ * Return a mask with bit i set if byte i of the group equals v.
+ */
+static inline uint32_t
+group_match(const uint8_t *g, uint8_t v)
 {
-	fill_meta_with_empty(h);
+#if defined(HASH_GROUP_SSE2)
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)g), _mm_set1_epi8((char)v)));
+#elif defined(HASH_GROUP_NEON)
+	static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(g), vdupq_n_u8(v)), vld1q_u8(bits));
+	return (uint32_t)vaddv_u8(vget_low_u8(m)) | ((uint32_t)vaddv_u8(vget_high_u8(m)) << 8);
+#else
+	uint32_t i, r = 0;
+	for (i = 0; i < GROUP_WIDTH; ++i) {
+		r |= (uint32_t)(g[i] == v) << i;
+	}
+	return r;
+#endif
+}
+
+static inline uint32_t
+group_first(uint32_t mask)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return i;
+#else
+	uint32_t i;
+	for (i = 0; !(mask & 1); ++i) {
+		mask >>= 1;
+	}
+	return i;
+#endif
 }
 
 static bool
@@ -94,21 +235,21 @@ hash_init(struct hash *h, uint32_t cap, uint32_t keysize)
 	ASSERT_VALID_CAP(cap);
 
 	*h = (struct hash){ .cap = cap, .capm = cap - 1, .max_load = (uint32_t)((float)cap * LOAD_FACTOR) };
-	arr_init(&h->meta, h->cap, sizeof(uint8_t));
+	arr_init(&h->meta, h->cap + GROUP_WIDTH - 1, sizeof(uint8_t));
 	arr_init(&h->e, h->cap, sizeof(struct hash_elem));
 	arr_init(&h->keys, h->cap, keysize);
 
-	prepare_table(h);
+	fill_meta_with_empty(h);
 
 	h->keycmp = hash_keycmp_memcmp;
-	h->hash_func = fnv_1a_64;
+	h->hash_func = hash_func_bytes;
 }
 
 static bool
 hash_keycmp_strcmp(const struct hash *_h, const void *_a, const void *_b)
 {
 	const struct strkey *a = _a, *b = _b;
-	return a->len == b->len ? strncmp(a->str, b->str, a->len) == 0 : false;
+	return a->hv == b->hv && a->len == b->len && (a->str == b->str || memcmp(a->str, b->str, a->len) == 0);
 }
 
 void
@@ -116,7 +257,7 @@ hash_init_str(struct hash *h, uint32_t cap)
 {
 	hash_init(h, cap, sizeof(struct strkey));
 	h->keycmp = hash_keycmp_strcmp;
-	h->hash_func = fnv_1a_64_str;
+	h->hash_func = hash_func_str;
 }
 
 void
@@ -131,33 +272,49 @@ void
 hash_clear(struct hash *h)
 {
 	h->len = h->load = 0;
+	h->keys.len = 0;
 	fill_meta_with_empty(h);
 }
 
-static void
-probe(const struct hash *h, const void *key, struct hash_elem **ret_he, uint8_t **ret_meta, uint64_t *hv)
+/*
+ * Find the slot holding key, or the empty slot where it would be inserted.
+ * Probing is linear, one group at a time: every slot in the group whose
+ * metadata matches the low 7 bits of the hash is compared, up to the first
+ * empty slot.  Deleted slots are skipped.
+ */
+static uint64_t
+probe(const struct hash *h, const void *key, uint64_t *hv)
 {
-#define match ((meta & 0x7f) == h2 && h->keycmp(h, h->keys.e + (h->keys.item_size * he->keyi), key))
+	const uint8_t *meta = h->meta.e;
+	const struct hash_elem *e = (const struct hash_elem *)h->e.e;
+	uint64_t pos, slot;
+	uint32_t match, empty;
 
-	struct hash_elem *he;
 	*hv = h->hash_func(h, key);
-	const uint64_t h1 = *hv >> 7, h2 = *hv & 0x7f;
-	uint8_t meta;
-	uint64_t hvi = h1 & h->capm;
+	pos = (*hv >> 7) & h->capm;
 
-	meta = ((uint8_t *)h->meta.e)[hvi];
-	he = &((struct hash_elem *)h->e.e)[hvi];
+	while (true) {
+		match = group_match(&meta[pos], *hv & 0x7f);
+		empty = group_match(&meta[pos], k_empty);
 
-	while (meta == k_deleted || (k_full(meta) && !match)) {
-		hvi = (hvi + 1) & h->capm;
-		meta = ((uint8_t *)h->meta.e)[hvi];
-		he = &((struct hash_elem *)h->e.e)[hvi];
-	}
+		if (empty) {
+			match &= (empty & -empty) - 1;
+		}
+
+		while (match) {
+			slot = (pos + group_first(match)) & h->capm;
+			if (h->keycmp(h, h->keys.e + (h->keys.item_size * e[slot].keyi), key)) {
+				return slot;
+			}
+			match &= match - 1;
+		}
 
-	*ret_meta = &((uint8_t *)h->meta.e)[hvi];
-	*ret_he = he;
+		if (empty) {
+			return (pos + group_first(empty)) & h->capm;
+		}
 
-#undef match
+		pos = (pos + GROUP_WIDTH) & h->capm;
+	}
 }
 
 static void
@@ -167,9 +324,8 @@ resize(struct hash *h, uint32_t newcap)
 	assert(h->len <= newcap);
 
 	uint32_t i;
-	struct hash_elem *ohe, *he;
-	uint64_t hv;
-	uint8_t *meta;
+	struct hash_elem *ohe;
+	uint64_t hv, slot;
 	void *key;
 
 	struct hash newh = (struct hash){
@@ -177,17 +333,17 @@ resize(struct hash *h, uint32_t newcap)
 		.capm = newcap - 1,
 		.keys = h->keys,
 		.len = h->len,
-		.load = h->load,
+		.load = h->len,
 		.max_load = (uint32_t)((float)newcap * LOAD_FACTOR),
 
 		.hash_func = h->hash_func,
 		.keycmp = h->keycmp,
 	};
 
-	arr_init(&newh.meta, newh.cap, sizeof(uint8_t));
+	arr_init(&newh.meta, newh.cap + GROUP_WIDTH - 1, sizeof(uint8_t));
 	arr_init(&newh.e, newh.cap, sizeof(struct hash_elem));
 
-	prepare_table(&newh);
+	fill_meta_with_empty(&newh);
 
 	for (i = 0; i < h->cap; ++i) {
 		if (!k_full(((uint8_t *)h->meta.e)[i])) {
@@ -197,12 +353,12 @@ resize(struct hash *h, uint32_t newcap)
 		ohe = &((struct hash_elem *)h->e.e)[i];
 		key = h->keys.e + (h->keys.item_size * ohe->keyi);
 
-		probe(&newh, key, &he, &meta, &hv);
+		slot = probe(&newh, key, &hv);
 
-		assert(!k_full(*meta));
+		assert(!k_full(((uint8_t *)newh.meta.e)[slot]));
 
-		*he = *ohe;
-		*meta = hv & 0x7f;
+		((struct hash_elem *)newh.e.e)[slot] = *ohe;
+		set_meta(&newh, slot, hv & 0x7f);
 	}
 
 	arr_destroy(&h->meta);
@@ -213,33 +369,25 @@ resize(struct hash *h, uint32_t newcap)
 uint64_t *
 hash_get(const struct hash *h, const void *key)
 {
-	struct hash_elem *he;
-	uint64_t hv;
-	uint8_t *meta;
-
-	probe(h, key, &he, &meta, &hv);
+	uint64_t hv, slot = probe(h, key, &hv);
 
-	return k_full(*meta) ? &he->val : NULL;
+	return k_full(((uint8_t *)h->meta.e)[slot]) ? &((struct hash_elem *)h->e.e)[slot].val : NULL;
 }
 
 uint64_t *
 hash_get_strn(const struct hash *h, const char *str, uint64_t len)
 {
-	struct strkey key = { .str = str, .len = len };
+	struct strkey key = { .str = str, .len = len, .hv = hash_bytes(str, len, 0) };
 	return hash_get(h, &key);
 }
 
 void
 hash_unset(struct hash *h, const void *key)
 {
-	struct hash_elem *he;
-	uint64_t hv;
-	uint8_t *meta;
+	uint64_t hv, slot = probe(h, key, &hv);
 
-	probe(h, key, &he, &meta, &hv);
-
-	if (k_full(*meta)) {
-		*meta = k_deleted;
+	if (k_full(((uint8_t *)h->meta.e)[slot])) {
+		set_meta(h, slot, k_deleted);
 		--h->len;
 	}
 
@@ -249,7 +397,7 @@ hash_unset(struct hash *h, const void *key)
 void
 hash_unset_strn(struct hash *h, const char *s, uint64_t len)
 {
-	struct strkey key = { .str = s, .len = len };
+	struct strkey key = { .str = s, .len = len, .hv = hash_bytes(s, len, 0) };
 	hash_unset(h, &key);
 }
 
@@ -257,21 +405,19 @@ void
 hash_set(struct hash *h, const void *key, uint64_t val)
 {
 	if (h->load > h->max_load) {
-		resize(h, h->cap << 1);
+		/* If most of the load is from deleted slots, rehash in place. */
+		resize(h, h->len > h->max_load / 2 ? h->cap << 1 : h->cap);
 	}
 
-	struct hash_elem *he;
-	uint64_t hv;
-	uint8_t *meta;
-
-	probe(h, key, &he, &meta, &hv);
+	uint64_t hv, slot = probe(h, key, &hv);
+	struct hash_elem *he = &((struct hash_elem *)h->e.e)[slot];
 
-	if (k_full(*meta)) {
+	if (k_full(((uint8_t *)h->meta.e)[slot])) {
 		he->val = val;
 	} else {
 		he->keyi = arr_push(&h->keys, key);
 		he->val = val;
-		*meta = hv & 0x7f;
+		set_meta(h, slot, hv & 0x7f);
 		++h->len;
 		++h->load;
 	}
@@ -280,6 +426,6 @@ hash_set(struct hash *h, const void *key, uint64_t val)
 void
 hash_set_strn(struct hash *h, const char *s, uint64_t len, uint64_t val)
 {
-	struct strkey key = { .str = s, .len = len };
+	struct strkey key = { .str = s, .len = len, .hv = hash_bytes(s, len, 0) };
 	hash_set(h, &key, val);
 }
@@ -18,13 +18,6 @@
 #include "platform/assert.h"
 #include "platform/mem.h"
 
-struct error_diagnostic_message {
-	struct source_location location;
-	enum log_level lvl;
-	const char *msg;
-	uint32_t src_idx;
-};
-
 static struct {
 	struct arr messages;
 	bool init;
@@ -113,41 +106,92 @@ error_diagnostic_store_compare(const void *_a, const void *_b, void *ctx)
 	}
 }
 
-void
-error_diagnostic_store_replay(enum error_diagnostic_store_replay_opts opts, bool *saw_error)
+/*
+ * Sorts the stored messages and appends a deduplicated copy of them to the
+ * end of the message array.  Returns the index of the first deduplicated
+ * message.
+ */
+static uint32_t
+error_diagnostic_store_sort_and_dedup(void)
 {
-	error_diagnostic_store.init = false;
-	error_diagnostic_store.opts = opts;
-
 	uint32_t i;
 	struct error_diagnostic_message *msg;
-	struct source *last_src = 0, *cur_src;
 
 	arr_sort(&error_diagnostic_store.messages, NULL, error_diagnostic_store_compare);
 
-	size_t tail, initial_len = error_diagnostic_store.messages.len;
-	if (error_diagnostic_store.messages.len > 1) {
-		struct error_diagnostic_message *prev_msg, tmp;
-		tail = error_diagnostic_store.messages.len;
+	if (error_diagnostic_store.messages.len <= 1) {
+		return 0;
+	}
 
-		uint32_t initial_len = error_diagnostic_store.messages.len;
-		msg = arr_get(&error_diagnostic_store.messages, 0);
-		arr_push(&error_diagnostic_store.messages, msg);
-		for (i = 1; i < initial_len; ++i) {
-			prev_msg = arr_get(&error_diagnostic_store.messages, i - 1);
-			msg = arr_get(&error_diagnostic_store.messages, i);
+	struct error_diagnostic_message *prev_msg, tmp;
+	uint32_t tail = error_diagnostic_store.messages.len;
 
-			if (error_diagnostic_store_compare_except_lvl(prev_msg, msg, NULL) == 0) {
-				continue;
-			}
+	msg = arr_get(&error_diagnostic_store.messages, 0);
+	arr_push(&error_diagnostic_store.messages, msg);
+	for (i = 1; i < tail; ++i) {
+		prev_msg = arr_get(&error_diagnostic_store.messages, i - 1);
+		msg = arr_get(&error_diagnostic_store.messages, i);
 
-			tmp = *msg;
-			arr_push(&error_diagnostic_store.messages, &tmp);
+		if (error_diagnostic_store_compare_except_lvl(prev_msg, msg, NULL) == 0) {
+			continue;
 		}
-	} else {
-		tail = 0;
+
+		tmp = *msg;
+		arr_push(&error_diagnostic_store.messages, &tmp);
+	}
+
+	return tail;
+}
+
+static void
+error_diagnostic_store_destroy(uint32_t initial_len)
+{
+	uint32_t i;
+	struct error_diagnostic_message *msg;
+
+	for (i = 0; i < initial_len; ++i) {
+		msg = arr_get(&error_diagnostic_store.messages, i);
+		z_free((char *)msg->msg);
 	}
 
+	arr_destroy(&error_diagnostic_store.messages);
+	memset(&error_diagnostic_store, 0, sizeof(error_diagnostic_store));
+}
+
+void
+error_diagnostic_store_collect(struct arr *res)
+{
+	struct workspace *wk = error_diagnostic_store.wk;
+	error_diagnostic_store.init = false;
+
+	uint32_t i;
+	struct error_diagnostic_message *msg, tmp;
+	uint32_t initial_len = error_diagnostic_store.messages.len;
+	uint32_t tail = error_diagnostic_store_sort_and_dedup();
+
+	for (i = tail; i < error_diagnostic_store.messages.len; ++i) {
+		msg = arr_get(&error_diagnostic_store.messages, i);
+		tmp = *msg;
+		tmp.msg = get_cstr(wk, make_str(wk, msg->msg));
+		arr_push(res, &tmp);
+	}
+
+	error_diagnostic_store_destroy(initial_len);
+}
+
+void
+error_diagnostic_store_replay(enum error_diagnostic_store_replay_opts opts, bool *saw_error)
+{
+	error_diagnostic_store.init = false;
+	error_diagnostic_store.opts = opts;
+
+	uint32_t i;
+	struct error_diagnostic_message *msg;
+	struct source *last_src = 0, *cur_src;
+
+	uint32_t initial_len = error_diagnostic_store.messages.len;
+	uint32_t tail = error_diagnostic_store_sort_and_dedup();
+
 	*saw_error = false;
 	struct source src = { 0 }, null_src = {
 		.label = "",
@@ -189,13 +233,7 @@ error_diagnostic_store_replay(enum error_diagnostic_store_replay_opts opts, bool
 		error_message(&src, msg->location, msg->lvl, msg->msg);
 	}
 
-	for (i = 0; i < initial_len; ++i) {
-		msg = arr_get(&error_diagnostic_store.messages, i);
-		z_free((char *)msg->msg);
-	}
-
-	arr_destroy(&error_diagnostic_store.messages);
-	memset(&error_diagnostic_store, 0, sizeof(error_diagnostic_store));
+	error_diagnostic_store_destroy(initial_len);
 }
 
 void
@@ -11,6 +11,7 @@
 #include "external/libarchive.h"
 #include "lang/string.h"
 #include "log.h"
+#include "platform/filesystem.h"
 #include "platform/path.h"
 
 const bool have_libarchive = true;
@@ -38,7 +39,7 @@ copy_data(struct archive *ar, struct archive *aw)
 }
 
 bool
-muon_archive_extract(const char *buf, size_t size, const char *dest_path)
+muon_archive_extract(const char *path, const char *dest_path)
 {
 	bool res = false;
 	struct archive *a;
@@ -46,6 +47,7 @@ muon_archive_extract(const char *buf, size_t size, const char *dest_path)
 	struct archive_entry *entry;
 	int flags;
 	int r;
+	SBUF_manual(entry_path);
 
 	/* Select which attributes we want to restore. */
 	flags = ARCHIVE_EXTRACT_TIME;
@@ -60,14 +62,13 @@ muon_archive_extract(const char *buf, size_t size, const char *dest_path)
 	archive_write_disk_set_options(ext, flags);
 	archive_write_disk_set_standard_lookup(ext);
 
-	if ((r = archive_read_open_memory(a, buf, size))) {
+	// read the archive in blocks rather than loading it into memory
+	if ((r = archive_read_open_filename(a, path, 64 * 1024))) {
 		// may not work, a might not be initialized ??
 		LOG_E("error opening archive: %s\n", archive_error_string(a));
 		goto ret;
 	}
 
-	SBUF_manual(path);
-
 	while (true) {
 		if ((r = archive_read_next_header(a, &entry)) == ARCHIVE_EOF) {
 			break;
@@ -78,9 +79,9 @@ muon_archive_extract(const char *buf, size_t size, const char *dest_path)
 			goto ret;
 		}
 
-		path_join(NULL, &path, dest_path, archive_entry_pathname(entry));
+		path_join(NULL, &entry_path, dest_path, archive_entry_pathname(entry));
 
-		archive_entry_copy_pathname(entry, path.buf);
+		archive_entry_copy_pathname(entry, entry_path.buf);
 
 		if ((r = archive_write_header(ext, entry)) < ARCHIVE_OK) {
 			LOG_W("%s\n", archive_error_string(ext));
@@ -103,7 +104,7 @@ muon_archive_extract(const char *buf, size_t size, const char *dest_path)
 
 	res = true;
 ret:
-	sbuf_destroy(&path);
+	sbuf_destroy(&entry_path);
 
 	if (a) {
 		archive_read_close(a);
@@ -114,5 +115,7 @@ ret:
 		archive_write_close(ext);
 		archive_write_free(ext);
 	}
+
+	fs_cache_invalidate_all();
 	return res;
 }
@@ -7,12 +7,10 @@
 
 #include <curl/curl.h>
 #include <stdbool.h>
-#include <string.h>
 
 #include "external/libcurl.h"
 #include "log.h"
 #include "platform/assert.h"
-#include "platform/mem.h"
 
 const bool have_libcurl = true;
 
@@ -42,8 +40,8 @@ muon_curl_deinit(void)
 }
 
 struct write_data_ctx {
-	uint8_t *buf;
-	uint64_t len, cap;
+	muon_curl_write_cb cb;
+	void *ctx;
 };
 
 static size_t
@@ -52,19 +50,16 @@ write_data(void *src, size_t size, size_t nmemb, void *_ctx)
 	struct write_data_ctx *ctx = _ctx;
 	uint64_t want_to_write = size * nmemb;
 
-	if (want_to_write + ctx->len > ctx->cap) {
-		ctx->cap = want_to_write + ctx->len;
-		ctx->buf = z_realloc(ctx->buf, ctx->cap);
+	if (!ctx->cb(ctx->ctx, src, want_to_write)) {
+		// returning a short count makes curl abort the transfer
+		return 0;
 	}
 
-	memcpy(&ctx->buf[ctx->len], src, want_to_write);
-	ctx->len += want_to_write;
-
-	return nmemb;
+	return want_to_write;
 }
 
 bool
-muon_curl_fetch(const char *url, uint8_t **buf, uint64_t *len)
+muon_curl_fetch(const char *url, muon_curl_write_cb cb, void *cb_ctx)
 {
 	CURL *curl_handle;
 	CURLcode err;
@@ -90,6 +85,11 @@ muon_curl_fetch(const char *url, uint8_t **buf, uint64_t *len)
 		goto err1;
 	}
 
+	/* don't pass error pages on to cb */
+	if ((err = curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1L)) != CURLE_OK) {
+		goto err1;
+	}
+
 	/* set URL to get here */
 	if ((err = curl_easy_setopt(curl_handle, CURLOPT_URL, url)) != CURLE_OK) {
 		goto err1;
@@ -110,8 +110,8 @@ muon_curl_fetch(const char *url, uint8_t **buf, uint64_t *len)
 		goto err1;
 	}
 
-	struct write_data_ctx ctx = { 0 };
-	/* write the page body to this file handle */
+	struct write_data_ctx ctx = { .cb = cb, .ctx = cb_ctx };
+	/* pass the page body to cb as it arrives */
 	if ((err = curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &ctx)) != CURLE_OK) {
 		goto err1;
 	}
@@ -121,9 +121,6 @@ muon_curl_fetch(const char *url, uint8_t **buf, uint64_t *len)
 		goto err1;
 	}
 
-	*buf = ctx.buf;
-	*len = ctx.len;
-
 	/* cleanup curl stuff */
 	curl_easy_cleanup(curl_handle);
 	return true;
@@ -7,6 +7,7 @@
 #include "compat.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
 
 #include "external/samurai/ctx.h"
 #include "log.h"
@@ -388,6 +389,71 @@ samu_edgedone(struct samu_ctx *ctx, const char **filtered_output, struct samu_jo
 	}
 }
 
+static void
+samu_recordrusage(struct samu_ctx *ctx, struct samu_job *j)
+{
+	struct samu_build_ctx *b = &ctx->build;
+	size_t newcap;
+
+	if (!j->cmd_ctx.rusage.have)
+		return;
+	if (b->njobstats == b->jobstatscap) {
+		newcap = b->jobstatscap ? b->jobstatscap * 2 : 64;
+		b->jobstats = samu_xreallocarray(&ctx->arena, b->jobstats, b->jobstatscap, newcap, sizeof(b->jobstats[0]));
+		b->jobstatscap = newcap;
+	}
+	b->jobstats[b->njobstats++] = (struct samu_jobstat){
+		.name = j->edge->nout ? j->edge->out[0]->path : j->cmd,
+		.rusage = j->cmd_ctx.rusage,
+	};
+}
+
+static int
+samu_jobstatcmp(const void *a, const void *b)
+{
+	const struct samu_jobstat *ja = a, *jb = b;
+
+	if (ja->rusage.max_rss > jb->rusage.max_rss)
+		return -1;
+	if (ja->rusage.max_rss < jb->rusage.max_rss)
+		return 1;
+	return 0;
+}
+
+/* print a summary of the resources used by the jobs of this build */
+static void
+samu_printrusage(struct samu_ctx *ctx)
+{
+	struct samu_build_ctx *b = &ctx->build;
+	struct run_cmd_rusage total = { 0 };
+	size_t i;
+
+	if (!b->njobstats)
+		return;
+
+	for (i = 0; i < b->njobstats; ++i) {
+		total.user += b->jobstats[i].rusage.user;
+		total.sys += b->jobstats[i].rusage.sys;
+		total.nvcsw += b->jobstats[i].rusage.nvcsw;
+		total.nivcsw += b->jobstats[i].rusage.nivcsw;
+	}
+
+	qsort(b->jobstats, b->njobstats, sizeof(b->jobstats[0]), samu_jobstatcmp);
+
+	samu_printf(ctx, "resource usage of %zu jobs: %.2fs user, %.2fs sys\n", b->njobstats, total.user, total.sys);
+	samu_printf(ctx, "context switches: %" PRIu64 " voluntary, %" PRIu64 " involuntary\n", total.nvcsw, total.nivcsw);
+	samu_printf(ctx, "%12s %9s %9s %s\n", "max rss", "user", "sys", "output");
+	for (i = 0; i < b->njobstats && i < 10; ++i) {
+		samu_printf(ctx, "%9" PRIu64 "KiB %8.2fs %8.2fs %s\n",
+			b->jobstats[i].rusage.max_rss,
+			b->jobstats[i].rusage.user,
+			b->jobstats[i].rusage.sys,
+			b->jobstats[i].name->s);
+	}
+
+	b->njobstats = 0;
+}
+
 static void
 samu_jobdone(struct samu_ctx *ctx, struct samu_job *j)
 {
@@ -404,6 +470,9 @@ samu_jobdone(struct samu_ctx *ctx, struct samu_job *j)
 
 	++ctx->build.nfinished;
 
+	if (ctx->buildopts.rusage)
+		samu_recordrusage(ctx, j);
+
 	if (!ctx->build.consoleused || j->failed) {
 		if (filtered_output) {
 			fputs(filtered_output, stdout);
@@ -508,6 +577,8 @@ samu_build(struct samu_ctx *ctx)
 				++numfail;
 		}
 	}
+	if (ctx->buildopts.rusage)
+		samu_printrusage(ctx);
 	if (numfail > 0) {
 		if (numfail < ctx->buildopts.maxfail)
 			samu_fatal("cannot make progress due to previous errors");
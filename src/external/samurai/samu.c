@@ -56,6 +56,8 @@ samu_debugflag(struct samu_ctx *ctx, const char *flag)
 		ctx->buildopts.keepdepfile = true;
 	else if (strcmp(flag, "keeprsp") == 0)
 		ctx->buildopts.keeprsp = true;
+	else if (strcmp(flag, "rusage") == 0)
+		ctx->buildopts.rusage = true;
 	else
 		samu_fatal("unknown debug flag '%s'", flag);
 }
@@ -178,7 +178,7 @@ compiler_check(struct workspace *wk, struct compiler_check_opts *opts, const cha
 	struct build_dep dep = { 0 };
 	if (opts->deps && opts->deps->set) {
 		have_dep = true;
-		dep_process_deps(wk, opts->deps->val, &dep);
+		dep_process_deps(wk, opts->deps->val, &dep, 0);
 
 		obj_array_extend_nodup(wk, compiler_args, dep.compile_args);
 	}
@@ -242,7 +242,7 @@ compiler_check(struct workspace *wk, struct compiler_check_opts *opts, const cha
 	}
 
 	bool ret = false;
-	struct run_cmd_ctx cmd_ctx = { 0 };
+	struct run_cmd_ctx cmd_ctx = { .flags = run_cmd_ctx_flag_known_outputs };
 
 	const char *argstr;
 	uint32_t argc;
@@ -275,7 +275,9 @@ compiler_check(struct workspace *wk, struct compiler_check_opts *opts, const cha
 		L("compiling: '%s'", get_cstr(wk, source_path));
 	}
 
-	if (!run_cmd(&cmd_ctx, argstr, argc, NULL, 0)) {
+	bool ran = run_cmd(&cmd_ctx, argstr, argc, NULL, 0);
+	fs_cache_invalidate(output_path);
+	if (!ran) {
 		vm_error_at(wk, err_node, "error: %s", cmd_ctx.err_msg);
 		goto ret;
 	}
@@ -2232,7 +2234,7 @@ func_compiler_preprocess(struct workspace *wk, obj self, obj *res)
 	struct build_dep dep = { 0 };
 	if (akw[kw_dependencies].set) {
 		have_dep = true;
-		dep_process_deps(wk, akw[kw_dependencies].val, &dep);
+		dep_process_deps(wk, akw[kw_dependencies].val, &dep, 0);
 		obj_array_extend_nodup(wk, base_cmd, dep.compile_args);
 	}
 
@@ -304,6 +304,8 @@ func_dependency_as_system(struct workspace *wk, obj self, obj *res)
 
 	dep_process_includes(wk, old_includes, inc_type, dep->dep.include_directories);
 	dep->include_type = inc_type;
+	// changing include types may introduce duplicates
+	dep->flags &= ~dep_flag_resolved;
 
 	return true;
 }
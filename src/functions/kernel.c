@@ -421,7 +421,7 @@ func_add_project_dependencies(struct workspace *wk, obj _, obj *res)
 	enum machine_kind machine = coerce_machine_kind(wk, &akw[kw_native]);
 
 	struct build_dep d = { 0 };
-	dep_process_deps(wk, an[0].val, &d);
+	dep_process_deps(wk, an[0].val, &d, 0);
 
 	obj lang;
 	obj_array_for(wk, akw[kw_language].val, lang) {
@@ -537,7 +537,7 @@ create_target(struct workspace *wk,
 	}
 
 	if (akw[bt_kw_dependencies].set) {
-		dep_process_deps(wk, akw[bt_kw_dependencies].val, &tgt->dep_internal);
+		dep_process_deps(wk, akw[bt_kw_dependencies].val, &tgt->dep_internal, 0);
 	}
 
 	if (akw[bt_kw_override_options].set) { // override options
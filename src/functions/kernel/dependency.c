@@ -6,6 +6,7 @@
 
 #include "compat.h"
 
+#include <stddef.h>
 #include <string.h>
 
 #include "buf_size.h"
@@ -857,7 +858,8 @@ func_declare_dependency(struct workspace *wk, obj _, obj *res)
 	}
 
 	if (akw[kw_dependencies].set) {
-		dep_process_deps(wk, akw[kw_dependencies].val, &dep->dep);
+		dep_process_deps(wk, akw[kw_dependencies].val, &dep->dep, build_dep_merge_flag_share);
+		dep->flags |= dep_flag_resolved;
 	}
 
 	return true;
@@ -1026,11 +1028,9 @@ build_dep_merge(struct workspace *wk,
 	}
 }
 
-static enum iteration_result
-dedup_link_args_iter(struct workspace *wk, void *_ctx, obj val)
+static bool
+link_arg_is_deduped(struct workspace *wk, obj val)
 {
-	obj new_args = *(obj *)_ctx;
-
 	static const char *known[] = {
 		"-pthread",
 	};
@@ -1040,61 +1040,110 @@ dedup_link_args_iter(struct workspace *wk, void *_ctx, obj val)
 	uint32_t i;
 	for (i = 0; i < ARRAY_LEN(known); ++i) {
 		if (strcmp(known[i], s) == 0) {
-			if (obj_array_in(wk, new_args, val)) {
-				return ir_cont;
-			} else {
-				break;
-			}
+			return true;
 		}
 	}
 
-	obj_array_push(wk, new_args, val);
-	return ir_cont;
+	return false;
 }
 
-static enum iteration_result
-dedup_compile_args_iter(struct workspace *wk, void *_ctx, obj val)
+static bool
+compile_arg_is_deduped(struct workspace *wk, obj val)
 {
-	obj new_args = *(obj *)_ctx;
-
 	const struct str *s = get_str(wk, val);
 
-	if (str_eql(s, &WKSTR("-pthread")) || str_startswith(s, &WKSTR("-W")) || str_startswith(s, &WKSTR("-D"))) {
-		if (obj_array_in(wk, new_args, val)) {
-			return ir_cont;
+	return str_eql(s, &WKSTR("-pthread")) || str_startswith(s, &WKSTR("-W")) || str_startswith(s, &WKSTR("-D"));
+}
+
+/*
+ * The fields of a struct build_dep that are merged from dependencies, in the
+ * same order build_dep_merge() visits them.
+ */
+static const uint32_t build_dep_merged_fields[] = {
+	offsetof(struct build_dep, link_with),
+	offsetof(struct build_dep, link_with_not_found),
+	offsetof(struct build_dep, link_whole),
+	offsetof(struct build_dep, include_directories),
+	offsetof(struct build_dep, link_args),
+	offsetof(struct build_dep, frameworks),
+	offsetof(struct build_dep, compile_args),
+	offsetof(struct build_dep, rpath),
+	offsetof(struct build_dep, order_deps),
+	offsetof(struct build_dep, sources),
+	offsetof(struct build_dep, objects),
+};
+
+static obj *
+build_dep_field(struct build_dep *dep, uint32_t off)
+{
+	return (obj *)((char *)dep + off);
+}
+
+static bool
+build_dep_field_is_deduped(struct workspace *wk, uint32_t off, obj val)
+{
+	if (off == offsetof(struct build_dep, link_args)) {
+		return link_arg_is_deduped(wk, val);
+	} else if (off == offsetof(struct build_dep, compile_args)) {
+		return compile_arg_is_deduped(wk, val);
+	} else {
+		return true;
+	}
+}
+
+static void
+dedup_build_dep_field(struct workspace *wk, struct build_dep *dep, uint32_t off)
+{
+	obj *arr = build_dep_field(dep, off);
+
+	if (off == offsetof(struct build_dep, link_args)) {
+		obj_array_dedup_filtered(wk, *arr, arr, link_arg_is_deduped);
+	} else if (off == offsetof(struct build_dep, compile_args)) {
+		obj_array_dedup_filtered(wk, *arr, arr, compile_arg_is_deduped);
+	} else {
+		obj_array_dedup_in_place(wk, arr);
+	}
+}
+
+/*
+ * Returns true if appending the deduplicated closure to the deduplicated
+ * array own would require deduplicating again.
+ */
+static bool
+build_dep_field_overlaps(struct workspace *wk, uint32_t off, obj own, obj closure)
+{
+	if (!get_obj_array(wk, own)->len) {
+		return false;
+	}
+
+	obj v;
+	obj_array_for(wk, closure, v) {
+		if (build_dep_field_is_deduped(wk, off, v) && obj_array_in(wk, own, v)) {
+			return true;
 		}
 	}
 
-	obj_array_push(wk, new_args, val);
-	return ir_cont;
+	return false;
 }
 
+/*
+ * Deduplicate every field of dep, except for the merged fields whose bit is
+ * set in skip.  Those are known to already be deduplicated.
+ */
 static void
-dedup_build_dep(struct workspace *wk, struct build_dep *dep)
+dedup_build_dep(struct workspace *wk, struct build_dep *dep, uint32_t skip)
 {
-	obj_array_dedup_in_place(wk, &dep->link_with);
-	obj_array_dedup_in_place(wk, &dep->link_with_not_found);
-	obj_array_dedup_in_place(wk, &dep->link_whole);
-	obj_array_dedup_in_place(wk, &dep->frameworks);
 	obj_array_dedup_in_place(wk, &dep->raw.deps);
 	obj_array_dedup_in_place(wk, &dep->raw.order_deps);
 	obj_array_dedup_in_place(wk, &dep->raw.link_with);
 	obj_array_dedup_in_place(wk, &dep->raw.link_whole);
-	obj_array_dedup_in_place(wk, &dep->include_directories);
-	obj_array_dedup_in_place(wk, &dep->rpath);
-	obj_array_dedup_in_place(wk, &dep->order_deps);
-	obj_array_dedup_in_place(wk, &dep->sources);
-	obj_array_dedup_in_place(wk, &dep->objects);
-
-	obj new_link_args;
-	make_obj(wk, &new_link_args, obj_array);
-	obj_array_foreach(wk, dep->link_args, &new_link_args, dedup_link_args_iter);
-	dep->link_args = new_link_args;
-
-	obj new_compile_args;
-	make_obj(wk, &new_compile_args, obj_array);
-	obj_array_foreach(wk, dep->compile_args, &new_compile_args, dedup_compile_args_iter);
-	dep->compile_args = new_compile_args;
+
+	uint32_t i;
+	for (i = 0; i < ARRAY_LEN(build_dep_merged_fields); ++i) {
+		if (!(skip & (1 << i))) {
+			dedup_build_dep_field(wk, dep, build_dep_merged_fields[i]);
+		}
+	}
 }
 
 struct dep_process_link_with_ctx {
@@ -1204,7 +1253,7 @@ dep_process_link_with(struct workspace *wk, uint32_t err_node, obj arr, struct b
 		return false;
 	}
 
-	dedup_build_dep(wk, dest);
+	dedup_build_dep(wk, dest, 0);
 	return true;
 }
 
@@ -1227,18 +1276,18 @@ dep_process_link_whole(struct workspace *wk, uint32_t err_node, obj arr, struct
 		return false;
 	}
 
-	dedup_build_dep(wk, dest);
+	dedup_build_dep(wk, dest, 0);
 	return true;
 }
 
 static enum iteration_result
 dep_process_deps_iter(struct workspace *wk, void *_ctx, obj val)
 {
-	struct build_dep *dest = _ctx;
+	obj found = *(obj *)_ctx;
 
 	/* obj_fprintf(wk, log_file(), "dep: %o\n", val); */
 
-	if (skip_if_present(wk, dest->raw.deps, val)) {
+	if (skip_if_present(wk, 0, val)) {
 		return ir_cont;
 	}
 
@@ -1247,20 +1296,85 @@ dep_process_deps_iter(struct workspace *wk, void *_ctx, obj val)
 		return ir_cont;
 	}
 
-	build_dep_merge(wk, dest, &dep->dep, build_dep_merge_flag_merge_all);
-
+	obj_array_push(wk, found, val);
 	return ir_cont;
 }
 
+/*
+ * Merge the closures of every found dependency in deps into dest.
+ *
+ * A dependency flagged dep_flag_resolved carries an already deduplicated
+ * closure that is never modified again.  When such a closure is the only
+ * contributor to a field, and none of its elements are already present in
+ * dest, it is appended without being deduplicated again.  With
+ * build_dep_merge_flag_share it is linked into dest rather than copied, so
+ * that a chain of declared dependencies shares a single copy of each
+ * closure.  This is only valid if dest is itself never modified afterwards.
+ */
 void
-dep_process_deps(struct workspace *wk, obj deps, struct build_dep *dest)
+dep_process_deps(struct workspace *wk, obj deps, struct build_dep *dest, enum build_dep_merge_flag flags)
 {
 	build_dep_init(wk, dest);
 	dest->raw.deps = deps;
 
+	obj found, v;
+	make_obj(wk, &found, obj_array);
+
 	hash_clear(&wk->vm.objects.obj_hash);
 
-	obj_array_foreach(wk, deps, dest, dep_process_deps_iter);
+	obj_array_foreach(wk, deps, &found, dep_process_deps_iter);
+
+	obj_array_for(wk, found, v) {
+		const struct obj_dependency *dep = get_obj_dependency(wk, v);
+		dest->link_language = coalesce_link_languages(dep->dep.link_language, dest->link_language);
+	}
+
+	uint32_t i, skip = 0;
+	for (i = 0; i < ARRAY_LEN(build_dep_merged_fields); ++i) {
+		const uint32_t off = build_dep_merged_fields[i];
+		obj *dest_arr = build_dep_field(dest, off), shared = 0;
+		uint32_t contributors = 0;
+		bool resolved = true;
+
+		obj_array_for(wk, found, v) {
+			struct obj_dependency *dep = get_obj_dependency(wk, v);
+			obj src_arr = *build_dep_field(&dep->dep, off);
+
+			if (!src_arr || !get_obj_array(wk, src_arr)->len) {
+				continue;
+			}
+
+			++contributors;
+			shared = src_arr;
+			resolved &= (dep->flags & dep_flag_resolved) == dep_flag_resolved;
+		}
+
+		if (contributors == 1 && resolved) {
+			dedup_build_dep_field(wk, dest, off);
+
+			if (!build_dep_field_overlaps(wk, off, *dest_arr, shared)) {
+				if (!(flags & build_dep_merge_flag_share)) {
+					obj_array_extend(wk, *dest_arr, shared);
+				} else if (get_obj_array(wk, *dest_arr)->len) {
+					obj_array_extend_nodup(wk, *dest_arr, shared);
+				} else {
+					*dest_arr = shared;
+				}
+
+				skip |= 1 << i;
+				continue;
+			}
+		}
+
+		obj_array_for(wk, found, v) {
+			struct obj_dependency *dep = get_obj_dependency(wk, v);
+			obj src_arr = *build_dep_field(&dep->dep, off);
+
+			if (src_arr) {
+				obj_array_extend(wk, *dest_arr, src_arr);
+			}
+		}
+	}
 
-	dedup_build_dep(wk, dest);
+	dedup_build_dep(wk, dest, skip);
 }
@@ -364,7 +364,7 @@ func_module_fs_hash(struct workspace *wk, obj self, obj *res)
 	char buf[65] = { 0 };
 	uint32_t i, bufi = 0;
 	for (i = 0; i < 32; ++i) {
-		snprintf(&buf[bufi], 3, "%x", hash[i]);
+		snprintf(&buf[bufi], 3, "%02x", hash[i]);
 		bufi += 2;
 	}
 
@@ -5,10 +5,13 @@
 
 #include "compat.h"
 
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "buf_size.h"
 #include "coerce.h"
+#include "compilers.h"
 #include "embedded.h"
 #include "external/tinyjson.h"
 #include "functions/external_program.h"
@@ -21,6 +24,60 @@
 #include "platform/path.h"
 #include "platform/run_cmd.h"
 
+/*
+ * Build a key for caching the result of running the interpreter at path in
+ * the compiler check cache.  The key covers the interpreter's identity and
+ * the environment variables that influence it, so the cached result is
+ * discarded when the interpreter is replaced or reconfigured.
+ */
+static obj
+python_cache_key(struct workspace *wk, const char *path, const char *kind, const char *src)
+{
+	static const char *env_vars[] = {
+		"PYTHONHOME",
+		"PYTHONPATH",
+		"PYTHONNOUSERSITE",
+		"PYTHONUSERBASE",
+		"VIRTUAL_ENV",
+	};
+
+	struct stat sb;
+	if (!fs_stat(path, &sb)) {
+		return 0;
+	}
+
+	SBUF(argstr);
+	uint32_t i, argc = 0;
+
+	sbuf_pushs(wk, &argstr, kind);
+	sbuf_push(wk, &argstr, 0);
+	++argc;
+
+	sbuf_pushf(wk,
+		&argstr,
+		"%s:%" PRId64 ":%" PRId64 ":%" PRId64,
+		path,
+		(int64_t)sb.st_mtime,
+		(int64_t)sb.st_ino,
+		(int64_t)sb.st_size);
+	sbuf_push(wk, &argstr, 0);
+	++argc;
+
+	for (i = 0; i < ARRAY_LEN(env_vars); ++i) {
+		const char *v = getenv(env_vars[i]);
+		sbuf_pushf(wk, &argstr, "%s=%s", env_vars[i], v ? v : "");
+		sbuf_push(wk, &argstr, 0);
+		++argc;
+	}
+
+	return compiler_check_cache_key(wk,
+		&(struct compiler_check_cache_key){
+			.argstr = argstr.buf,
+			.argc = argc,
+			.src = src,
+		});
+}
+
 static bool
 introspect_python_interpreter(struct workspace *wk, const char *path, struct obj_python_installation *python)
 {
@@ -29,46 +86,64 @@ introspect_python_interpreter(struct workspace *wk, const char *path, struct obj
 		return false;
 	}
 
-	struct run_cmd_ctx cmd_ctx = { 0 };
-	char *const var_args[] = { (char *)path, "-c", (char *)src.src, 0 };
-	if (!run_cmd_argv(&cmd_ctx, var_args, NULL, 0) || cmd_ctx.status != 0) {
-		return false;
-	}
-
 	obj res_introspect;
-	bool success = muon_json_to_dict(wk, cmd_ctx.out.buf, &res_introspect);
+	struct compiler_check_cache_value cache_val = { 0 };
+	obj cache_key = python_cache_key(wk, path, "python_info", src.src);
 
-	if (!success) {
-		goto end;
+	if (cache_key && compiler_check_cache_get(wk, cache_key, &cache_val)) {
+		res_introspect = cache_val.value;
+	} else {
+		struct run_cmd_ctx cmd_ctx = { 0 };
+		char *const var_args[] = { (char *)path, "-c", (char *)src.src, 0 };
+		if (!run_cmd_argv(&cmd_ctx, var_args, NULL, 0) || cmd_ctx.status != 0) {
+			run_cmd_ctx_destroy(&cmd_ctx);
+			return false;
+		}
+
+		bool ok = muon_json_to_dict(wk, cmd_ctx.out.buf, &res_introspect);
+		run_cmd_ctx_destroy(&cmd_ctx);
+
+		if (!ok) {
+			return false;
+		}
+
+		compiler_check_cache_set(
+			wk, cache_key, &(struct compiler_check_cache_value){ .success = true, .value = res_introspect });
 	}
 
 	if (!obj_dict_index_str(wk, res_introspect, "version", &python->language_version)) {
-		success = false;
-		goto end;
+		return false;
 	}
 
 	if (!obj_dict_index_str(wk, res_introspect, "sysconfig_paths", &python->sysconfig_paths)) {
-		success = false;
-		goto end;
+		return false;
 	}
 
 	if (!obj_dict_index_str(wk, res_introspect, "variables", &python->sysconfig_vars)) {
-		success = false;
-		goto end;
+		return false;
 	}
 
 	if (!obj_dict_index_str(wk, res_introspect, "install_paths", &python->install_paths)) {
-		success = false;
-		goto end;
+		return false;
 	}
-end:
-	run_cmd_ctx_destroy(&cmd_ctx);
-	return success;
+
+	return true;
 }
 
+/*
+ * Only modules that were found are cached.  Installing a module doesn't
+ * change the interpreter, so a cached miss could never be invalidated.
+ */
 static bool
 python_module_present(struct workspace *wk, const char *pythonpath, const char *mod)
 {
+	struct compiler_check_cache_value cache_val = { 0 };
+	obj cache_key = python_cache_key(wk, pythonpath, "python_module", mod);
+
+	if (cache_key && compiler_check_cache_get(wk, cache_key, &cache_val) && cache_val.success) {
+		return true;
+	}
+
 	struct run_cmd_ctx cmd_ctx = { 0 };
 
 	SBUF(importstr);
@@ -76,10 +151,15 @@ python_module_present(struct workspace *wk, const char *pythonpath, const char *
 
 	char *const *args = (char *const[]){ (char *)pythonpath, "-c", importstr.buf, 0 };
 
-	bool present = run_cmd_argv(&cmd_ctx, args, NULL, 0) && cmd_ctx.status == 0;
+	bool ran = run_cmd_argv(&cmd_ctx, args, NULL, 0);
+	bool present = ran && cmd_ctx.status == 0;
 
 	run_cmd_ctx_destroy(&cmd_ctx);
 
+	if (cache_key && present) {
+		compiler_check_cache_set(wk, cache_key, &(struct compiler_check_cache_value){ .success = true });
+	}
+
 	return present;
 }
 
@@ -11,9 +11,14 @@
 #include "lang/object_iterators.h"
 #include "lang/typecheck.h"
 #include "log.h"
+#include "platform/mem.h"
 #include "platform/path.h"
+#include "platform/run_cmd.h"
+#include "platform/timer.h"
 #include "wrap.h"
 
+#define SUBPROJECTS_UPDATE_SLEEP_TIME 10000000 // 10ms
+
 struct subprojects_common_ctx {
 	uint32_t failed;
 	bool force, print;
@@ -116,21 +121,169 @@ cont:
 	return ir_cont;
 }
 
+static enum iteration_result
+subprojects_collect_names_iter(struct workspace *wk, struct subprojects_common_ctx *ctx, const char *path)
+{
+	SBUF(name);
+	path_basename(wk, &name, path);
+	obj_array_push(wk, *ctx->res, make_strn(wk, name.buf, name.len - 5));
+	return ir_cont;
+}
+
+struct subprojects_update_job {
+	struct run_cmd_ctx cmd_ctx;
+	obj name;
+	bool running, done, ok;
+};
+
+static bool
+subprojects_update_job_start(struct workspace *wk, struct subprojects_update_job *job)
+{
+	char *const argv[] = {
+		(char *)wk->argv0,
+		"subprojects",
+		"-d",
+		(char *)subprojects_dir(wk),
+		"update",
+		"-j",
+		"1",
+		(char *)get_cstr(wk, job->name),
+		NULL,
+	};
+
+	job->cmd_ctx = (struct run_cmd_ctx){ .flags = run_cmd_ctx_flag_async };
+	if (!run_cmd_argv(&job->cmd_ctx, argv, NULL, 0)) {
+		LOG_E("failed to update %s: %s", get_cstr(wk, job->name), job->cmd_ctx.err_msg);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Update each wrap in its own muon process, running at most jobs at a time.
+ * Downloads and git clones are dominated by network latency, so this keeps
+ * several transfers in flight.  Output is buffered and printed in order.
+ */
+static uint32_t
+subprojects_update_parallel(struct workspace *wk, obj names, uint32_t jobs)
+{
+	const uint32_t len = get_obj_array(wk, names)->len;
+	struct subprojects_update_job *job_list = z_calloc(len, sizeof(struct subprojects_update_job)), *job;
+	uint32_t i = 0, next = 0, running = 0, flushed = 0, failed = 0;
+	bool progress;
+
+	obj name;
+	obj_array_for(wk, names, name) {
+		job_list[i++].name = name;
+	}
+
+	while (flushed < len) {
+		progress = false;
+
+		while (running < jobs && next < len) {
+			job = &job_list[next];
+			if (subprojects_update_job_start(wk, job)) {
+				job->running = true;
+				++running;
+			} else {
+				job->done = true;
+			}
+			++next;
+		}
+
+		for (i = flushed; i < next; ++i) {
+			job = &job_list[i];
+			if (!job->running) {
+				continue;
+			}
+
+			switch (run_cmd_collect(&job->cmd_ctx)) {
+			case run_cmd_running: continue;
+			case run_cmd_error: LOG_E("error updating subproject: %s", job->cmd_ctx.err_msg); break;
+			case run_cmd_finished: job->ok = job->cmd_ctx.status == 0; break;
+			}
+
+			job->running = false;
+			job->done = true;
+			--running;
+			progress = true;
+		}
+
+		while (flushed < len && job_list[flushed].done) {
+			job = &job_list[flushed];
+			if (job->cmd_ctx.out.len) {
+				fs_fwrite(job->cmd_ctx.out.buf, job->cmd_ctx.out.len, stdout);
+			}
+			if (job->cmd_ctx.err.len) {
+				fs_fwrite(job->cmd_ctx.err.buf, job->cmd_ctx.err.len, stderr);
+			}
+
+			if (!job->ok) {
+				++failed;
+			}
+
+			run_cmd_ctx_destroy(&job->cmd_ctx);
+			++flushed;
+		}
+
+		if (!progress) {
+			timer_sleep(SUBPROJECTS_UPDATE_SLEEP_TIME);
+		}
+	}
+
+	z_free(job_list);
+	return failed;
+}
+
 static bool
 func_subprojects_update(struct workspace *wk, obj self, obj *res)
 {
 	struct args_norm an[] = { { TYPE_TAG_LISTIFY | tc_string, .optional = true }, ARG_TYPE_NULL };
+	enum kwargs {
+		kw_jobs,
+	};
+	struct args_kw akw[] = {
+		[kw_jobs] = { "jobs", tc_number },
+		0,
+	};
 
-	if (!pop_args(wk, an, 0)) {
+	if (!pop_args(wk, an, akw)) {
 		return false;
 	}
 
+	int64_t jobs = 1;
+	if (akw[kw_jobs].set) {
+		jobs = get_obj_number(wk, akw[kw_jobs].val);
+		if (jobs < 1) {
+			vm_error_at(wk, akw[kw_jobs].node, "jobs must be at least 1");
+			return false;
+		}
+	}
+
 	make_obj(wk, res, obj_array);
 	struct subprojects_common_ctx ctx = {
 		.print = true,
 		.res = res,
 	};
 
+	if (jobs > 1 && wk->argv0) {
+		obj names;
+		make_obj(wk, &names, obj_array);
+		ctx.res = &names;
+
+		if (!subprojects_foreach(wk, an[0].val, &ctx, subprojects_collect_names_iter)) {
+			return false;
+		}
+
+		ctx.res = res;
+
+		if (get_obj_array(wk, names)->len > 1) {
+			*res = names;
+			return subprojects_update_parallel(wk, names, jobs) == 0;
+		}
+	}
+
 	subprojects_foreach(wk, an[0].val, &ctx, func_subprojects_update_iter);
 
 	return ctx.failed == 0;
@@ -198,6 +351,7 @@ func_subprojects_list(struct workspace *wk, obj self, obj *res)
 	};
 	struct args_kw akw[] = {
 		[kw_print] = { "print", tc_bool },
+		0,
 	};
 
 	if (!pop_args(wk, an, akw)) {
@@ -250,6 +404,7 @@ func_subprojects_clean(struct workspace *wk, obj self, obj *res)
 	};
 	struct args_kw akw[] = {
 		[kw_force] = { "force", tc_bool },
+		0,
 	};
 
 	if (!pop_args(wk, an, akw)) {
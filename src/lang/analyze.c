@@ -842,6 +842,19 @@ az_scope_stack_dup(struct workspace *wk, obj scope_stack)
 	return r;
 }
 
+static bool
+az_eval_source(struct workspace *wk, struct source *src, enum build_language lang, enum eval_project_file_flags flags)
+{
+	obj res;
+
+	enum eval_mode eval_mode = 0;
+	if (flags & eval_project_file_flag_first) {
+		eval_mode |= eval_mode_first;
+	}
+
+	return eval(wk, src, lang, eval_mode, &res);
+}
+
 static bool
 az_eval_project_file(struct workspace *wk,
 	const char *path,
@@ -850,27 +863,24 @@ az_eval_project_file(struct workspace *wk,
 {
 	const char *newpath = path;
 	if (analyzer.opts->file_override && strcmp(analyzer.opts->file_override, path) == 0) {
-		bool ret = false;
 		struct source src = { 0 };
 		if (!fs_read_entire_file("-", &src)) {
 			return false;
 		}
 		src.label = get_cstr(wk, make_str(wk, path));
 
-		obj res;
-
-		enum eval_mode eval_mode = 0;
-		if (flags & eval_project_file_flag_first) {
-			eval_mode |= eval_mode_first;
-		}
+		return az_eval_source(wk, &src, lang, flags);
+	}
 
-		if (!eval(wk, &src, lang, eval_mode, &res)) {
-			goto ret;
+	if (analyzer.opts->file_overrides) {
+		uint32_t i;
+		for (i = 0; i < analyzer.opts->file_overrides->len; ++i) {
+			const struct source *override = arr_get(analyzer.opts->file_overrides, i);
+			if (strcmp(override->label, path) == 0) {
+				struct source src = *override;
+				return az_eval_source(wk, &src, lang, flags);
+			}
 		}
-
-		ret = true;
-ret:
-		return ret;
 	}
 
 	if (analyzer.opts->analyze_project_call_only) {
@@ -1370,6 +1380,7 @@ do_analyze_internal(struct workspace *wk, struct az_opts *opts)
 {
 	bool res = false;
 	analyzer.opts = opts;
+	analyzer.error = false;
 	workspace_init_bare(wk);
 
 	bucket_arr_init(&assignments, 512, sizeof(struct assignment));
@@ -1581,6 +1592,12 @@ do_analyze_internal(struct workspace *wk, struct az_opts *opts)
 		if (!found) {
 			LOG_W("couldn't find definition for %s", analyzer.opts->get_definition_for);
 		}
+	} else if (analyzer.opts->diagnostics) {
+		error_diagnostic_store_collect(analyzer.opts->diagnostics);
+
+		if (analyzer.error) {
+			res = false;
+		}
 	} else {
 		error_diagnostic_store_replay(analyzer.opts->replay_opts, &saw_error);
 
@@ -1589,11 +1606,59 @@ do_analyze_internal(struct workspace *wk, struct az_opts *opts)
 		}
 	}
 
+	if (!analyzer.opts->retain_state) {
+		az_state_destroy();
+	}
+	return res;
+}
+
+void
+az_state_destroy(void)
+{
 	bucket_arr_destroy(&assignments);
+	hash_destroy(&analyzer.branch_map);
 	arr_destroy(&az_entrypoint_stack);
 	arr_destroy(&az_entrypoint_stacks);
 	arr_destroy(&analyzer.visited_ops);
-	return res;
+}
+
+/*
+ * Look up the assignment of name that is most likely visible at offset off in
+ * source src_idx.  Assignments preceding off in the same file are preferred,
+ * followed by the most recent assignment from any other file.
+ */
+bool
+az_lookup_assignment(const char *name, uint32_t src_idx, uint32_t off, struct az_assignment_info *res)
+{
+	uint32_t i;
+	struct assignment *a, *local = 0, *other = 0;
+
+	for (i = 0; i < assignments.len; ++i) {
+		a = bucket_arr_get(&assignments, i);
+		if (strcmp(a->name, name) != 0) {
+			continue;
+		}
+
+		if (a->src_idx == src_idx && !a->default_var) {
+			if (a->location.off <= off) {
+				local = a;
+			}
+		} else {
+			other = a;
+		}
+	}
+
+	if (!(a = local ? local : other)) {
+		return false;
+	}
+
+	*res = (struct az_assignment_info){
+		.o = a->o,
+		.src_idx = a->src_idx,
+		.location = a->location,
+		.default_var = a->default_var,
+	};
+	return true;
 }
 
 bool
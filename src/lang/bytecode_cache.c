@@ -0,0 +1,493 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "compat.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "backend/output.h"
+#include "lang/bytecode_cache.h"
+#include "lang/func_lookup.h"
+#include "lang/object.h"
+#include "lang/source.h"
+#include "lang/vm.h"
+#include "lang/workspace.h"
+#include "log.h"
+#include "platform/filesystem.h"
+#include "platform/os.h"
+#include "platform/path.h"
+#include "sha_256.h"
+#include "version.h"
+
+/*
+ * Compiled project files are cached in the private dir.  There is one cache
+ * file per source path and set of compile modes, so an edited file replaces
+ * its old entry instead of adding another one.  Each file records a digest
+ * of the source text, the muon version, the native function table, and the
+ * modes, and is only used if that digest still matches.  Files are written
+ * to a temporary name and renamed into place, so a concurrent or interrupted
+ * configure never sees a partial entry.  Code is stored relative to its
+ * entry point and object operands are replaced with indices into a table of
+ * constants, so a cached segment can be appended anywhere in the code of a
+ * later process.
+ *
+ * The file layout is:
+ *   magic, version, key digest, code length, location count
+ *   code
+ *   locations (ip, off, len)
+ *   constant count, constants (type, payload)
+ */
+
+#define BYTECODE_CACHE_MAGIC_LEN 8
+static const char bytecode_cache_magic[BYTECODE_CACHE_MAGIC_LEN + 1] = "muoncode";
+static const uint32_t bytecode_cache_version = 3;
+
+enum bytecode_cache_operand {
+	bytecode_cache_operand_int,
+	bytecode_cache_operand_obj,
+	bytecode_cache_operand_ip,
+	bytecode_cache_operand_kwarg_cache,
+};
+
+/*
+ * Describes the operands of op.  Returns false for ops that can't be
+ * relocated, i.e. ops that reference function objects or analyzer state.
+ * New ops with operands must be added here before code using them is
+ * cached.
+ */
+static bool
+bytecode_cache_op_operands(uint8_t op, enum bytecode_cache_operand operands[4])
+{
+	switch (op) {
+	case op_iterator:
+	case op_store:
+	case op_constant_list:
+	case op_constant_dict:
+	case op_typecheck: operands[0] = bytecode_cache_operand_int; return true;
+	case op_iterator_next:
+	case op_iterator_keys:
+	case op_iterator_concat:
+	case op_jmp_if_true:
+	case op_jmp_if_false:
+	case op_jmp_if_disabler:
+	case op_jmp_if_disabler_keep:
+	case op_jmp: operands[0] = bytecode_cache_operand_ip; return true;
+	case op_constant:
+	case op_member:
+	case op_constant_load: operands[0] = bytecode_cache_operand_obj; return true;
+	case op_constant_store:
+		operands[0] = bytecode_cache_operand_obj;
+		operands[1] = bytecode_cache_operand_int;
+		return true;
+	case op_call:
+		operands[0] = bytecode_cache_operand_int;
+		operands[1] = bytecode_cache_operand_int;
+		return true;
+	case op_call_member:
+		operands[0] = bytecode_cache_operand_obj;
+		operands[1] = bytecode_cache_operand_int;
+		operands[2] = bytecode_cache_operand_int;
+		return true;
+	case op_call_native:
+		operands[0] = bytecode_cache_operand_int;
+		operands[1] = bytecode_cache_operand_int;
+		operands[2] = bytecode_cache_operand_int;
+		return true;
+	case op_call_native_kw:
+		operands[0] = bytecode_cache_operand_int;
+		operands[1] = bytecode_cache_operand_int;
+		operands[2] = bytecode_cache_operand_int;
+		operands[3] = bytecode_cache_operand_kwarg_cache;
+		return true;
+	default: return op < op_count && op_operands[op] == 0;
+	}
+}
+
+static void
+bytecode_cache_put_operand(uint8_t *code, uint32_t v)
+{
+	v = vm_constant_host_to_bc(v);
+	code[0] = (v >> 16) & 0xff;
+	code[1] = (v >> 8) & 0xff;
+	code[2] = v & 0xff;
+}
+
+static void
+bytecode_cache_path(struct workspace *wk, struct sbuf *path, const struct bytecode_cache_key *key)
+{
+	uint32_t i;
+	SBUF(name);
+
+	for (i = 0; i < sizeof(key->name); ++i) {
+		sbuf_pushf(wk, &name, "%02x", key->name[i]);
+	}
+
+	path_join(wk, path, wk->muon_private, output_path.bytecode_cache_dir);
+	path_push(wk, path, name.buf);
+}
+
+bool
+bytecode_cache_enabled(struct workspace *wk)
+{
+	return wk->muon_private && !wk->vm.in_analyzer;
+}
+
+void
+bytecode_cache_key_init(struct workspace *wk,
+	struct bytecode_cache_key *key,
+	const struct source *src,
+	uint32_t compile_mode,
+	uint32_t eval_mode)
+{
+	// native functions are referenced by index, so the table layout is part
+	// of the key along with the version
+	static uint8_t native_funcs_digest[32];
+	static bool native_funcs_digest_init;
+
+	struct sha_256 sha;
+	uint32_t i, modes[] = { compile_mode, eval_mode, wk->vm.lang_mode };
+
+	if (!native_funcs_digest_init) {
+		sha_256_init(&sha);
+		for (i = 0; native_funcs[i].name; ++i) {
+			sha_256_update(&sha, native_funcs[i].name, strlen(native_funcs[i].name) + 1);
+		}
+		sha_256_final(&sha, native_funcs_digest);
+		native_funcs_digest_init = true;
+	}
+
+	sha_256_init(&sha);
+	sha_256_update(&sha, src->label, strlen(src->label) + 1);
+	sha_256_update(&sha, modes, sizeof(modes));
+	sha_256_final(&sha, key->name);
+
+	sha_256_init(&sha);
+	sha_256_update(&sha, muon_version.version, strlen(muon_version.version) + 1);
+	sha_256_update(&sha, muon_version.vcs_tag, strlen(muon_version.vcs_tag) + 1);
+	sha_256_update(&sha, native_funcs_digest, sizeof(native_funcs_digest));
+	sha_256_update(&sha, modes, sizeof(modes));
+	sha_256_update(&sha, src->src, src->len);
+	sha_256_final(&sha, key->digest);
+}
+
+/******************************************************************************
+ * store
+ ******************************************************************************/
+
+static void
+bytecode_cache_push_u32(struct workspace *wk, struct sbuf *buf, uint32_t v)
+{
+	sbuf_pushn(wk, buf, (const char *)&v, sizeof(v));
+}
+
+static bool
+bytecode_cache_push_constant(struct workspace *wk, struct sbuf *buf, obj o)
+{
+	switch (get_obj_type(wk, o)) {
+	case obj_number: {
+		int64_t n = get_obj_number(wk, o);
+		bytecode_cache_push_u32(wk, buf, obj_number);
+		sbuf_pushn(wk, buf, (const char *)&n, sizeof(n));
+		return true;
+	}
+	case obj_string: {
+		const struct str *s = get_str(wk, o);
+		bytecode_cache_push_u32(wk, buf, obj_string);
+		bytecode_cache_push_u32(wk, buf, s->len);
+		sbuf_pushn(wk, buf, s->s, s->len);
+		return true;
+	}
+	default: return false;
+	}
+}
+
+void
+bytecode_cache_store(struct workspace *wk,
+	const struct bytecode_cache_key *key,
+	uint32_t entry,
+	uint32_t locations_start)
+{
+	enum bytecode_cache_operand operands[4];
+	uint32_t i, ip, v[4], code_start, len = wk->vm.code.len - entry, nconstants = 0;
+	uint8_t *code;
+	SBUF_manual(buf);
+	SBUF_manual(constants);
+	SBUF(path);
+	SBUF(tmp_path);
+
+	sbuf_pushn(wk, &buf, bytecode_cache_magic, BYTECODE_CACHE_MAGIC_LEN);
+	bytecode_cache_push_u32(wk, &buf, bytecode_cache_version);
+	sbuf_pushn(wk, &buf, (const char *)key->digest, sizeof(key->digest));
+	bytecode_cache_push_u32(wk, &buf, len);
+	bytecode_cache_push_u32(wk, &buf, wk->vm.locations.len - locations_start);
+
+	code_start = buf.len;
+	sbuf_pushn(wk, &buf, (const char *)wk->vm.code.e + entry, len);
+	code = (uint8_t *)buf.buf + code_start;
+
+	for (ip = 0; ip < len;) {
+		uint8_t op = code[ip];
+		if (!bytecode_cache_op_operands(op, operands)) {
+			goto ret;
+		}
+
+		++ip;
+		for (i = 0; i < op_operands[op]; ++i) {
+			v[i] = vm_get_constant(code, &ip);
+		}
+
+		for (i = 0; i < op_operands[op]; ++i) {
+			switch (operands[i]) {
+			case bytecode_cache_operand_int: continue;
+			case bytecode_cache_operand_kwarg_cache: v[i] = 0; break;
+			case bytecode_cache_operand_ip:
+				if (v[i] < entry || v[i] > wk->vm.code.len) {
+					goto ret;
+				}
+				v[i] -= entry;
+				break;
+			case bytecode_cache_operand_obj:
+				if (v[i] < compile_time_constant_objects_end) {
+					continue;
+				} else if (!bytecode_cache_push_constant(wk, &constants, v[i])) {
+					goto ret;
+				}
+
+				v[i] = compile_time_constant_objects_end + nconstants;
+				++nconstants;
+				break;
+			}
+
+			bytecode_cache_put_operand(&code[ip - op_operand_size * (op_operands[op] - i)], v[i]);
+		}
+	}
+
+	for (i = locations_start; i < wk->vm.locations.len; ++i) {
+		const struct source_location_mapping *m = arr_get(&wk->vm.locations, i);
+		bytecode_cache_push_u32(wk, &buf, m->ip - entry);
+		bytecode_cache_push_u32(wk, &buf, m->loc.off);
+		bytecode_cache_push_u32(wk, &buf, m->loc.len);
+	}
+
+	bytecode_cache_push_u32(wk, &buf, nconstants);
+	sbuf_pushn(wk, &buf, constants.buf, constants.len);
+
+	path_join(wk, &path, wk->muon_private, output_path.bytecode_cache_dir);
+	if (!fs_dir_exists(path.buf) && !fs_mkdir_p(path.buf)) {
+		goto ret;
+	}
+
+	bytecode_cache_path(wk, &path, key);
+	sbuf_pushf(wk, &tmp_path, "%s.%" PRIu32 ".tmp", path.buf, os_get_pid());
+	if (fs_write(tmp_path.buf, (const uint8_t *)buf.buf, buf.len) && !fs_rename(tmp_path.buf, path.buf)) {
+		fs_remove(tmp_path.buf);
+	}
+ret:
+	sbuf_destroy(&buf);
+	sbuf_destroy(&constants);
+}
+
+/******************************************************************************
+ * load
+ ******************************************************************************/
+
+struct bytecode_cache_reader {
+	const uint8_t *p, *end;
+};
+
+static const uint8_t *
+bytecode_cache_read(struct bytecode_cache_reader *r, uint64_t len)
+{
+	const uint8_t *p = r->p;
+
+	if ((uint64_t)(r->end - r->p) < len) {
+		return 0;
+	}
+
+	r->p += len;
+	return p;
+}
+
+static bool
+bytecode_cache_read_u32(struct bytecode_cache_reader *r, uint32_t *v)
+{
+	const uint8_t *p;
+
+	if (!(p = bytecode_cache_read(r, sizeof(*v)))) {
+		return false;
+	}
+
+	memcpy(v, p, sizeof(*v));
+	return true;
+}
+
+static bool
+bytecode_cache_read_constant(struct workspace *wk, struct bytecode_cache_reader *r, obj *res)
+{
+	uint32_t type, len;
+	const uint8_t *p;
+
+	if (!bytecode_cache_read_u32(r, &type)) {
+		return false;
+	}
+
+	switch (type) {
+	case obj_number: {
+		int64_t n;
+		if (!(p = bytecode_cache_read(r, sizeof(n)))) {
+			return false;
+		}
+
+		memcpy(&n, p, sizeof(n));
+		make_obj(wk, res, obj_number);
+		set_obj_number(wk, *res, n);
+		return true;
+	}
+	case obj_string:
+		if (!bytecode_cache_read_u32(r, &len) || !(p = bytecode_cache_read(r, len))) {
+			return false;
+		}
+
+		*res = make_strn_interned(wk, (const char *)p, len);
+		return true;
+	default: return false;
+	}
+}
+
+static bool
+bytecode_cache_relocate(struct workspace *wk, uint32_t base, const struct arr *constants)
+{
+	enum bytecode_cache_operand operands[4];
+	uint32_t i, j, ip, v[4], len = wk->vm.code.len - base;
+	uint8_t *code = wk->vm.code.e + base;
+
+	for (ip = 0; ip < len;) {
+		uint8_t op = code[ip];
+		if (!bytecode_cache_op_operands(op, operands) || ip + OP_WIDTH(op) > len) {
+			return false;
+		}
+
+		++ip;
+		for (i = 0; i < op_operands[op]; ++i) {
+			v[i] = vm_get_constant(code, &ip);
+		}
+
+		for (i = 0; i < op_operands[op]; ++i) {
+			switch (operands[i]) {
+			case bytecode_cache_operand_int: continue;
+			case bytecode_cache_operand_kwarg_cache:
+				// the call's keyword argument count precedes the cache operand
+				v[i] = wk->vm.kwarg_cache.len;
+				for (j = 0; j < v[1]; ++j) {
+					arr_push(&wk->vm.kwarg_cache, &(struct vm_kwarg_cache_entry){ 0 });
+				}
+				break;
+			case bytecode_cache_operand_ip:
+				if (v[i] > len) {
+					return false;
+				}
+				v[i] += base;
+				break;
+			case bytecode_cache_operand_obj:
+				if (v[i] < compile_time_constant_objects_end) {
+					continue;
+				} else if (v[i] - compile_time_constant_objects_end >= constants->len) {
+					return false;
+				}
+
+				v[i] = *(obj *)arr_get(constants, v[i] - compile_time_constant_objects_end);
+				break;
+			}
+
+			bytecode_cache_put_operand(&code[ip - op_operand_size * (op_operands[op] - i)], v[i]);
+		}
+	}
+
+	return true;
+}
+
+bool
+bytecode_cache_load(struct workspace *wk, const struct bytecode_cache_key *key, uint32_t *entry)
+{
+	bool res = false;
+	const uint8_t *p, *code, *locations;
+	uint32_t i, v, len, nlocations, nconstants;
+	uint32_t base = wk->vm.code.len, locations_base = wk->vm.locations.len,
+		 kwarg_cache_base = wk->vm.kwarg_cache.len;
+	struct bytecode_cache_reader r;
+	struct source cached = { 0 };
+	struct arr constants;
+	SBUF(path);
+
+	arr_init(&constants, 64, sizeof(obj));
+
+	bytecode_cache_path(wk, &path, key);
+	if (!fs_file_exists(path.buf) || !fs_read_entire_file(path.buf, &cached)) {
+		goto ret;
+	}
+
+	r = (struct bytecode_cache_reader){ (const uint8_t *)cached.src, (const uint8_t *)cached.src + cached.len };
+
+	if (!(p = bytecode_cache_read(&r, BYTECODE_CACHE_MAGIC_LEN))
+		|| memcmp(p, bytecode_cache_magic, BYTECODE_CACHE_MAGIC_LEN) != 0) {
+		goto ret;
+	} else if (!bytecode_cache_read_u32(&r, &v) || v != bytecode_cache_version) {
+		goto ret;
+	} else if (!(p = bytecode_cache_read(&r, sizeof(key->digest)))
+		   || memcmp(p, key->digest, sizeof(key->digest)) != 0) {
+		goto ret;
+	} else if (!bytecode_cache_read_u32(&r, &len) || !len || !bytecode_cache_read_u32(&r, &nlocations)) {
+		goto ret;
+	} else if (!(code = bytecode_cache_read(&r, len))
+		   || !(locations = bytecode_cache_read(&r, (uint64_t)nlocations * 3 * sizeof(uint32_t)))
+		   || !bytecode_cache_read_u32(&r, &nconstants)) {
+		goto ret;
+	}
+
+	for (i = 0; i < nconstants; ++i) {
+		obj o;
+		if (!bytecode_cache_read_constant(wk, &r, &o)) {
+			goto ret;
+		}
+		arr_push(&constants, &o);
+	}
+
+	arr_grow_by(&wk->vm.code, len);
+	memcpy(wk->vm.code.e + base, code, len);
+
+	if (!bytecode_cache_relocate(wk, base, &constants)) {
+		goto ret;
+	}
+
+	for (i = 0; i < nlocations; ++i) {
+		uint32_t loc[3];
+		memcpy(loc, locations + i * sizeof(loc), sizeof(loc));
+
+		if (loc[0] > len) {
+			goto ret;
+		}
+
+		arr_push(&wk->vm.locations,
+			&(struct source_location_mapping){
+				.ip = base + loc[0],
+				.loc = { .off = loc[1], .len = loc[2] },
+				.src_idx = wk->vm.src.len - 1,
+			});
+	}
+
+	*entry = base;
+	res = true;
+ret:
+	if (!res) {
+		wk->vm.code.len = base;
+		wk->vm.locations.len = locations_base;
+		wk->vm.kwarg_cache.len = kwarg_cache_base;
+	}
+
+	arr_destroy(&constants);
+	fs_source_destroy(&cached);
+	return res;
+}
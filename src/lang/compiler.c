@@ -65,6 +65,20 @@ push_op_store(struct workspace *wk, enum op_store_flags flags)
 	push_constant(wk, flags);
 }
 
+static void
+push_op_constant_store(struct workspace *wk, obj id, enum op_store_flags flags)
+{
+	if (wk->vm.in_analyzer) {
+		push_code(wk, op_constant);
+		push_constant(wk, id);
+		push_op_store(wk, flags);
+	} else {
+		push_code(wk, op_constant_store);
+		push_constant(wk, id);
+		push_constant(wk, flags);
+	}
+}
+
 static void vm_comp_error(struct workspace *wk, struct node *n, const char *fmt, ...) MUON_ATTR_FORMAT(printf, 3, 4);
 static void
 vm_comp_error(struct workspace *wk, struct node *n, const char *fmt, ...)
@@ -117,6 +131,288 @@ enum vm_compile_block_flags {
 	vm_compile_block_start_scope = 1 << 2,
 };
 
+/*
+ * Returns true if any keyword argument in args is the special kwargs: dict,
+ * whose keys are only known at runtime.
+ */
+static bool
+vm_comp_args_have_kwargs_dict(struct workspace *wk, struct node *args)
+{
+	struct node *arg;
+
+	for (arg = args; arg && arg->l; arg = arg->r) {
+		if (arg->l->type == node_type_kw && str_eql(get_str(wk, arg->l->r->data.str), &WKSTR("kwargs"))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/******************************************************************************
+ * constant folding
+ ******************************************************************************/
+
+static bool
+vm_comp_node_is_literal(const struct node *n)
+{
+	return n->type == node_type_string || n->type == node_type_number || n->type == node_type_bool;
+}
+
+static void
+vm_comp_fold_to_literal(struct node *n, enum node_type type, union literal_data data)
+{
+	n->type = type;
+	n->data = data;
+	n->l = 0;
+	n->r = 0;
+}
+
+static void
+vm_comp_fold_to_bool(struct node *n, bool v)
+{
+	vm_comp_fold_to_literal(n, node_type_bool, (union literal_data){ .num = v });
+}
+
+static void
+vm_comp_fold_to_number(struct node *n, int64_t v)
+{
+	vm_comp_fold_to_literal(n, node_type_number, (union literal_data){ .num = v });
+}
+
+static void
+vm_comp_fold_to_string(struct node *n, obj s)
+{
+	vm_comp_fold_to_literal(n, node_type_string, (union literal_data){ .str = s });
+}
+
+/*
+ * Returns true if n is a literal that always evaluates to v.  The analyzer
+ * needs to see every branch, so it never gets an answer.
+ */
+static bool
+vm_comp_node_is_bool(struct workspace *wk, const struct node *n, bool v)
+{
+	return !wk->vm.in_analyzer && n->type == node_type_bool && (bool)n->data.num == v;
+}
+
+/*
+ * Integer arithmetic is only folded when it can't overflow or trap, so that
+ * anything unusual still happens at runtime.
+ */
+static bool
+vm_comp_fold_number(enum node_type t, int64_t a, int64_t b, int64_t *res)
+{
+	const int64_t add_max = INT64_C(1) << 62, mul_max = INT64_C(1) << 31;
+
+	switch (t) {
+	case node_type_add:
+	case node_type_sub:
+		if (a <= -add_max || a >= add_max || b <= -add_max || b >= add_max) {
+			return false;
+		}
+		*res = t == node_type_add ? a + b : a - b;
+		return true;
+	case node_type_mul:
+		if (a <= -mul_max || a >= mul_max || b <= -mul_max || b >= mul_max) {
+			return false;
+		}
+		*res = a * b;
+		return true;
+	case node_type_div:
+	case node_type_mod:
+		if (b == 0 || (a == INT64_MIN && b == -1)) {
+			return false;
+		}
+		*res = t == node_type_div ? a / b : a % b;
+		return true;
+	default: return false;
+	}
+}
+
+static bool
+vm_comp_dict_keys_are_literal(const struct node *n)
+{
+	for (; n && n->l; n = n->r) {
+		if (n->l->r->type != node_type_string) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Concatenate the array or dict literal r onto l and store the result in n.
+ * Elements keep their own nodes, so they are still evaluated in order at
+ * runtime.  r may also be a single literal, which is appended to an array.
+ */
+static void
+vm_comp_fold_concat(struct node *n, struct node *l, struct node *r)
+{
+	struct source_location loc = n->location;
+	struct node *last;
+
+	*n = *l;
+	n->location = loc;
+
+	if (r->type == node_type_array || r->type == node_type_dict) {
+		n->data.len.args += r->data.len.args;
+		n->data.len.kwargs += r->data.len.kwargs;
+		r->type = node_type_list;
+	} else {
+		// l is no longer referenced and can hold the appended element
+		*l = (struct node){ .type = node_type_list, .l = r, .location = r->location };
+		r = l;
+		++n->data.len.args;
+	}
+
+	for (last = n; last->r; last = last->r) {
+	}
+
+	if (last->l) {
+		last->r = r;
+	} else {
+		// l was empty or ended with a trailing comma
+		last->l = r->l;
+		last->r = r->r;
+	}
+}
+
+static void
+vm_comp_fold_node(struct workspace *wk, struct node *n)
+{
+	struct node *l = n->l, *r = n->r;
+	int64_t num;
+
+	switch (n->type) {
+	case node_type_negate:
+		if (l->type == node_type_number && l->data.num != INT64_MIN) {
+			vm_comp_fold_to_number(n, -l->data.num);
+		}
+		break;
+	case node_type_not:
+		if (l->type == node_type_bool) {
+			vm_comp_fold_to_bool(n, !l->data.num);
+		}
+		break;
+	case node_type_add:
+	case node_type_sub:
+	case node_type_mul:
+	case node_type_div:
+	case node_type_mod:
+		if (l->type == node_type_number && r->type == node_type_number) {
+			if (vm_comp_fold_number(n->type, l->data.num, r->data.num, &num)) {
+				vm_comp_fold_to_number(n, num);
+			}
+		} else if (l->type == node_type_string && r->type == node_type_string) {
+			const struct str *a = get_str(wk, l->data.str), *b = get_str(wk, r->data.str);
+
+			if (n->type == node_type_add) {
+				vm_comp_fold_to_string(n, str_intern(wk, str_join(wk, l->data.str, r->data.str)));
+			} else if (n->type == node_type_div && !str_has_null(a) && !str_has_null(b)) {
+				SBUF(buf);
+				path_join(wk, &buf, a->s, b->s);
+				vm_comp_fold_to_string(n, str_intern(wk, sbuf_into_str(wk, &buf)));
+			}
+		} else if (n->type == node_type_add && l->type == node_type_array
+			   && (r->type == node_type_array || vm_comp_node_is_literal(r))) {
+			vm_comp_fold_concat(n, l, r);
+		} else if (n->type == node_type_add && l->type == node_type_dict && r->type == node_type_dict
+			   && vm_comp_dict_keys_are_literal(l) && vm_comp_dict_keys_are_literal(r)) {
+			vm_comp_fold_concat(n, l, r);
+		}
+		break;
+	case node_type_eq:
+	case node_type_neq:
+		if (vm_comp_node_is_literal(l) && l->type == r->type) {
+			bool eql;
+			if (l->type == node_type_string) {
+				eql = str_eql(get_str(wk, l->data.str), get_str(wk, r->data.str));
+			} else {
+				eql = l->data.num == r->data.num;
+			}
+			vm_comp_fold_to_bool(n, eql == (n->type == node_type_eq));
+		}
+		break;
+	case node_type_lt:
+	case node_type_gt:
+	case node_type_leq:
+	case node_type_geq:
+		if (l->type == node_type_number && r->type == node_type_number) {
+			bool res;
+			switch (n->type) {
+			case node_type_lt: res = l->data.num < r->data.num; break;
+			case node_type_gt: res = l->data.num > r->data.num; break;
+			case node_type_leq: res = l->data.num <= r->data.num; break;
+			default: res = l->data.num >= r->data.num; break;
+			}
+			vm_comp_fold_to_bool(n, res);
+		}
+		break;
+	case node_type_in:
+	case node_type_not_in:
+		if (l->type == node_type_string && r->type == node_type_string) {
+			bool in = str_contains(get_str(wk, r->data.str), get_str(wk, l->data.str));
+			vm_comp_fold_to_bool(n, in == (n->type == node_type_in));
+		}
+		break;
+	case node_type_and:
+	case node_type_or:
+		if (l->type == node_type_bool) {
+			// false and x, true or x: x is never evaluated
+			if (l->data.num == (n->type == node_type_or)) {
+				vm_comp_fold_to_bool(n, l->data.num);
+			} else if (r->type == node_type_bool) {
+				vm_comp_fold_to_bool(n, r->data.num);
+			}
+		}
+		break;
+	case node_type_ternary:
+		if (l->type == node_type_bool) {
+			*n = *(l->data.num ? r->l : r->r);
+		}
+		break;
+	default: break;
+	}
+}
+
+/*
+ * Fold literal subexpressions of n in place, bottom up.  Statement blocks
+ * nested in n are folded when they are compiled.
+ */
+static void
+vm_comp_fold(struct workspace *wk, struct node *n)
+{
+	struct node *peek, *prev = 0;
+	uint32_t stack_base = wk->vm.compiler_state.node_stack.len;
+
+	// the analyzer needs to see every expression and branch as written
+	if (wk->vm.in_analyzer) {
+		return;
+	}
+
+	while (wk->vm.compiler_state.node_stack.len > stack_base || n) {
+		if (n) {
+			if (n->type == node_type_foreach || n->type == node_type_if || n->type == node_type_func_def) {
+				prev = n;
+				n = 0;
+			} else {
+				arr_push(&wk->vm.compiler_state.node_stack, &n);
+				n = n->l;
+			}
+		} else {
+			peek = *(struct node **)arr_peek(&wk->vm.compiler_state.node_stack, 1);
+			if (peek->r && prev != peek->r) {
+				n = peek->r;
+			} else {
+				vm_comp_fold_node(wk, peek);
+				prev = *(struct node **)arr_pop(&wk->vm.compiler_state.node_stack);
+			}
+		}
+	}
+}
+
 static void vm_compile_block(struct workspace *wk, struct node *n, enum vm_compile_block_flags flags);
 static void vm_compile_expr(struct workspace *wk, struct node *n);
 
@@ -150,15 +446,9 @@ vm_comp_node(struct workspace *wk, struct node *n)
 	case node_type_mod: push_code(wk, op_mod); break;
 	case node_type_not: push_code(wk, op_not); break;
 	case node_type_eq: push_code(wk, op_eq); break;
-	case node_type_neq:
-		push_code(wk, op_eq);
-		push_code(wk, op_not);
-		break;
+	case node_type_neq: push_code(wk, op_neq); break;
 	case node_type_in: push_code(wk, op_in); break;
-	case node_type_not_in:
-		push_code(wk, op_in);
-		push_code(wk, op_not);
-		break;
+	case node_type_not_in: push_code(wk, op_not_in); break;
 	case node_type_lt: push_code(wk, op_lt); break;
 	case node_type_gt: push_code(wk, op_gt); break;
 	case node_type_leq:
@@ -170,9 +460,14 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		push_code(wk, op_not);
 		break;
 	case node_type_id:
-		push_code(wk, op_constant);
-		push_constant(wk, n->data.str);
-		push_code(wk, op_load);
+		if (wk->vm.in_analyzer) {
+			push_code(wk, op_constant);
+			push_constant(wk, n->data.str);
+			push_code(wk, op_load);
+		} else {
+			push_code(wk, op_constant_load);
+			push_constant(wk, n->data.str);
+		}
 		break;
 	case node_type_maybe_id:
 		push_code(wk, op_constant);
@@ -204,16 +499,14 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		push_constant(wk, n->data.len.kwargs);
 		break;
 	case node_type_assign:
-		if (!(n->data.type & op_store_flag_member)) {
-			switch (n->l->type) {
-			case node_type_id_lit:
-				push_code(wk, op_constant);
-				push_constant(wk, n->l->data.str);
-				break;
-			default: vm_compile_expr(wk, n->l); break;
-			}
+		if (n->data.type & op_store_flag_member) {
+			push_op_store(wk, n->data.type);
+		} else if (n->l->type == node_type_id_lit) {
+			push_op_constant_store(wk, n->l->data.str, n->data.type);
+		} else {
+			vm_compile_expr(wk, n->l);
+			push_op_store(wk, n->data.type);
 		}
-		push_op_store(wk, n->data.type);
 		break;
 	case node_type_member: {
 		push_code(wk, op_member);
@@ -307,9 +600,44 @@ vm_comp_node(struct workspace *wk, struct node *n)
 			}
 		}
 
+		if (!known && !wk->vm.in_analyzer && n->r->type == node_type_member) {
+			/*
+			 * The callee was just compiled to an op_member, replace it
+			 * with a fused member call.  The member's location is kept
+			 * since it also points at the method name.
+			 */
+			uint32_t member_ip = wk->vm.code.len - OP_WIDTH(op_member), operand_ip = member_ip + 1;
+			assert(wk->vm.code.e[member_ip] == op_member);
+			obj member_name = vm_get_constant(wk->vm.code.e, &operand_ip);
+
+			wk->vm.code.len = member_ip;
+			push_code(wk, op_call_member);
+			push_constant(wk, member_name);
+			push_constant(wk, n->l->data.len.args);
+			push_constant(wk, n->l->data.len.kwargs);
+			break;
+		}
+
 		push_location(wk, n);
 
-		if (known) {
+		if (known && n->l->data.len.kwargs && !vm_comp_args_have_kwargs_dict(wk, n->l)) {
+			/*
+			 * Every keyword is a literal, so give the call site its
+			 * own slot cache.  Slots are resolved the first time the
+			 * call runs, since native argument tables only exist at
+			 * runtime.
+			 */
+			uint32_t i, cache_base = wk->vm.kwarg_cache.len;
+			for (i = 0; i < n->l->data.len.kwargs; ++i) {
+				arr_push(&wk->vm.kwarg_cache, &(struct vm_kwarg_cache_entry){ 0 });
+			}
+
+			push_code(wk, op_call_native_kw);
+			push_constant(wk, n->l->data.len.args);
+			push_constant(wk, n->l->data.len.kwargs);
+			push_constant(wk, idx);
+			push_constant(wk, cache_base);
+		} else if (known) {
 			push_code(wk, op_call_native);
 			push_constant(wk, n->l->data.len.args);
 			push_constant(wk, n->l->data.len.kwargs);
@@ -360,16 +688,62 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		 * jmp >-----------`   |
 		 *    <----------------`
 		 */
-		uint32_t break_jmp_patch_tgt, loop_body_start;
-		struct node *ida = n->l->l->l, *idb = n->l->l->r;
+		uint32_t break_jmp_patch_tgt, loop_body_start, fused_iterator_end_tgt = 0;
+		struct node *ida = n->l->l->l, *idb = n->l->l->r, *iterable = n->l->r;
+
+		vm_comp_fold(wk, iterable);
+
+		if (!wk->vm.in_analyzer && !idb && iterable->type == node_type_call
+			&& iterable->r->type == node_type_member && !iterable->l->data.len.args
+			&& !iterable->l->data.len.kwargs
+			&& str_eql(get_str(wk, iterable->r->r->data.str), &WKSTR("keys"))) {
+			/* <receiver>
+			 * iterator_keys >-----,
+			 * call_member keys    |
+			 * iterator            |
+			 *    <----------------`
+			 */
+			vm_compile_expr(wk, iterable->r->l);
+
+			push_location(wk, iterable->r);
+			push_code(wk, op_iterator_keys);
+			fused_iterator_end_tgt = wk->vm.code.len;
+			push_constant(wk, 0);
 
-		vm_compile_expr(wk, n->l->r);
+			push_code(wk, op_call_member);
+			push_constant(wk, iterable->r->r->data.str);
+			push_constant(wk, 0);
+			push_constant(wk, 0);
+		} else if (!wk->vm.in_analyzer && !idb && iterable->type == node_type_add) {
+			/* <lhs>
+			 * <rhs>
+			 * iterator_concat >---,
+			 * add                 |
+			 * iterator            |
+			 *    <----------------`
+			 */
+			vm_compile_expr(wk, iterable->l);
+			vm_compile_expr(wk, iterable->r);
+
+			push_location(wk, iterable);
+			push_code(wk, op_iterator_concat);
+			fused_iterator_end_tgt = wk->vm.code.len;
+			push_constant(wk, 0);
+
+			push_code(wk, op_add);
+		} else {
+			vm_compile_expr(wk, iterable);
+		}
 
 		push_location(wk, n);
 
 		push_code(wk, op_iterator);
 		push_constant(wk, idb ? 2 : 1);
 
+		if (fused_iterator_end_tgt) {
+			push_constant_at(wk->vm.code.len, arr_get(&wk->vm.code, fused_iterator_end_tgt));
+		}
+
 		uint32_t az_merge_point_tgt = 0;
 		if (wk->vm.in_analyzer) {
 			push_code(wk, op_az_branch);
@@ -385,15 +759,11 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		break_jmp_patch_tgt = wk->vm.code.len;
 		push_constant(wk, 0);
 
-		push_code(wk, op_constant);
-		push_constant(wk, ida->data.str);
-		push_op_store(wk, 0);
+		push_op_constant_store(wk, ida->data.str, 0);
 		push_code(wk, op_pop);
 
 		if (idb) {
-			push_code(wk, op_constant);
-			push_constant(wk, idb->data.str);
-			push_op_store(wk, 0);
+			push_op_constant_store(wk, idb->data.str, 0);
 			push_code(wk, op_pop);
 		}
 
@@ -479,12 +849,27 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		}
 
 		while (n) {
+			struct node *cond = n->l->l;
+
+			if (cond) {
+				vm_comp_fold(wk, cond);
+
+				if (vm_comp_node_is_bool(wk, cond, false)) {
+					// this branch can never be taken
+					n = n->r;
+					continue;
+				} else if (vm_comp_node_is_bool(wk, cond, true)) {
+					// this branch is always taken, so it acts like else
+					cond = 0;
+				}
+			}
+
 			if (wk->vm.in_analyzer) {
 				obj_array_push(wk, az_branches, make_az_branch_element(wk, wk->vm.code.len, 0));
 			}
 
-			if (n->l->l) {
-				vm_compile_expr(wk, n->l->l);
+			if (cond) {
+				vm_compile_expr(wk, cond);
 				push_code(wk, op_jmp_if_disabler);
 				arr_push(&wk->vm.compiler_state.if_jmp_stack, &wk->vm.code.len);
 				++patch_tgts;
@@ -502,10 +887,11 @@ vm_comp_node(struct workspace *wk, struct node *n)
 			++patch_tgts;
 			push_constant(wk, 0);
 
-			if (n->l->l) {
-				push_constant_at(wk->vm.code.len, arr_get(&wk->vm.code, else_jmp));
+			if (!cond) {
+				break;
 			}
 
+			push_constant_at(wk->vm.code.len, arr_get(&wk->vm.code, else_jmp));
 			n = n->r;
 		}
 
@@ -699,6 +1085,9 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		func->akw[func->nkwargs].key = 0;
 		func->return_type = n->data.type;
 		func->lang_mode = wk->vm.lang_mode;
+		if (n->l->l) {
+			func->name = get_cstr(wk, n->l->l->data.str);
+		}
 
 		if (ndefargs) {
 			push_code(wk, op_constant_dict);
@@ -714,9 +1103,7 @@ vm_comp_node(struct workspace *wk, struct node *n)
 		push_constant(wk, f);
 
 		if (n->l->l) {
-			push_code(wk, op_constant);
-			push_constant(wk, n->l->l->data.str);
-			push_op_store(wk, 0);
+			push_op_constant_store(wk, n->l->l->data.str, 0);
 		}
 		break;
 	}
@@ -765,6 +1152,7 @@ vm_compile_block(struct workspace *wk, struct node *n, enum vm_compile_block_fla
 	struct node *prev = 0;
 	while (n && n->l) {
 		assert(n->type == node_type_stmt);
+		vm_comp_fold(wk, n->l);
 		vm_compile_expr(wk, n->l);
 
 		if (n->l->type == node_type_if) {
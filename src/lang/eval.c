@@ -11,9 +11,11 @@
 #include "error.h"
 #include "external/readline.h"
 #include "functions/modules.h"
+#include "lang/bytecode_cache.h"
 #include "lang/compiler.h"
 #include "lang/eval.h"
 #include "lang/parser.h"
+#include "lang/profile.h"
 #include "log.h"
 #include "options.h"
 #include "platform/assert.h"
@@ -128,8 +130,17 @@ eval(struct workspace *wk, struct source *src, enum build_language lang, enum ev
 	}
 
 	uint32_t entry;
-	{
+	struct bytecode_cache_key bytecode_cache_key;
+	bool bytecode_cache = (mode & eval_mode_bytecode_cache) && lang == build_language_meson
+			      && bytecode_cache_enabled(wk);
+
+	if (bytecode_cache) {
+		bytecode_cache_key_init(wk, &bytecode_cache_key, src, compile_mode, mode);
+	}
+
+	if (!bytecode_cache || !bytecode_cache_load(wk, &bytecode_cache_key, &entry)) {
 		struct node *n = 0;
+		uint32_t locations_start = wk->vm.locations.len;
 
 		vm_compile_state_reset(wk);
 
@@ -155,6 +166,10 @@ eval(struct workspace *wk, struct source *src, enum build_language lang, enum ev
 		if (!vm_compile_ast(wk, n, compile_mode, &entry)) {
 			return false;
 		}
+
+		if (bytecode_cache) {
+			bytecode_cache_store(wk, &bytecode_cache_key, entry, locations_start);
+		}
 	}
 
 	if (wk->vm.dbg_state.eval_trace) {
@@ -179,9 +194,17 @@ eval(struct workspace *wk, struct source *src, enum build_language lang, enum ev
 
 	wk->vm.ip = entry;
 
+	if (wk->vm.profile) {
+		profile_push(wk, profile_frame_eval, 0, wk->vm.src.len - 1, 0);
+	}
+
 	*res = vm_execute(wk);
 	assert(call_stack_base == wk->vm.call_stack.len);
 
+	if (wk->vm.profile) {
+		profile_pop(wk);
+	}
+
 	if (wk->vm.dbg_state.eval_trace) {
 		stack_pop(&wk->stack, wk->vm.dbg_state.eval_trace_subdir);
 		if (wk->vm.dbg_state.eval_trace_subdir) {
@@ -221,7 +244,7 @@ eval_project_file(struct workspace *wk, const char *path, enum build_language la
 		return false;
 	}
 
-	enum eval_mode eval_mode = 0;
+	enum eval_mode eval_mode = eval_mode_bytecode_cache;
 	if (flags & eval_project_file_flag_first) {
 		eval_mode |= eval_mode_first;
 	}
@@ -22,6 +22,7 @@
 #include "log.h"
 #include "platform/assert.h"
 #include "platform/mem.h"
+#include "sha_256.h"
 
 enum fmt_frag_flag {
 	fmt_frag_flag_add_trailing_comma = 1 << 1,
@@ -1680,6 +1681,99 @@ fmt_assemble_out_blocks(struct fmt_ctx *f)
 	}
 }
 
+/*
+ * Resolve the formatting options for src from the defaults, .editorconfig,
+ * and cfg_path.  String options may point into *cfg_buf, which must be
+ * freed by the caller along with cfg_src.
+ */
+static bool
+fmt_load_opts(struct fmt_ctx *f,
+	struct source *src,
+	const char *cfg_path,
+	bool editorconfig,
+	struct source *cfg_src,
+	char **cfg_buf)
+{
+	f->opts = (struct fmt_opts){
+		.max_line_len = 80,
+		.indent_style = fmt_indent_style_space,
+		.indent_size = 4,
+		.tab_width = 8,
+		.space_array = false,
+		.kwargs_force_multiline = false,
+		.wide_colon = false,
+		.no_single_comma_function = false,
+		.insert_final_newline = true,
+		.end_of_line = fmt_guess_line_endings(src),
+		.sort_files = true,
+		.group_arg_value = true,
+		.simplify_string_literals = false,
+		.indent_before_comments = " ",
+		.use_editor_config = true,
+		.sticky_parens = false,
+		.continuation_indent = false,
+	};
+
+	if (editorconfig) {
+		try_parse_editorconfig(src, &f->opts);
+	}
+
+	if (cfg_path) {
+		if (!ini_parse(cfg_path, cfg_src, cfg_buf, fmt_cfg_parse_cb, f)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+fmt_opts_digest(struct source *src, const char *cfg_path, bool editorconfig, uint8_t digest[32])
+{
+	bool ret = false;
+	char *cfg_buf = NULL;
+	struct source cfg_src = { 0 };
+	struct fmt_ctx f = { 0 };
+	SBUF_manual(buf);
+
+	if (!fmt_load_opts(&f, src, cfg_path, editorconfig, &cfg_src, &cfg_buf)) {
+		goto ret;
+	}
+
+	const struct fmt_opts *o = &f.opts;
+	sbuf_pushf(0,
+		&buf,
+		"%d%d%d%d%d%d%d%d%d%d:%u:%u:%u:%u:%u:%s:%d",
+		o->space_array,
+		o->kwargs_force_multiline,
+		o->wide_colon,
+		o->no_single_comma_function,
+		o->insert_final_newline,
+		o->sort_files,
+		o->group_arg_value,
+		o->simplify_string_literals,
+		o->sticky_parens,
+		o->continuation_indent,
+		o->max_line_len,
+		o->indent_style,
+		o->indent_size,
+		o->tab_width,
+		o->end_of_line,
+		o->indent_before_comments,
+		// The source label determines the language mode
+		str_endswith(&WKSTR(src->label), &WKSTR(".meson")));
+
+	calc_sha_256(digest, buf.buf, buf.len);
+	ret = true;
+ret:
+	sbuf_destroy(&buf);
+	if (cfg_buf) {
+		z_free(cfg_buf);
+	}
+	fs_source_destroy(&cfg_src);
+	return ret;
+}
+
 bool
 fmt(struct source *src, FILE *out, const char *cfg_path, bool check_only, bool editorconfig)
 {
@@ -1691,41 +1785,16 @@ fmt(struct source *src, FILE *out, const char *cfg_path, bool check_only, bool e
 		.wk = &wk,
 		.out_buf = &out_buf,
 		.fmt_on = true,
-		.opts = {
-			.max_line_len = 80,
-			.indent_style = fmt_indent_style_space,
-			.indent_size = 4,
-			.tab_width = 8,
-			.space_array = false,
-			.kwargs_force_multiline = false,
-			.wide_colon = false,
-			.no_single_comma_function = false,
-			.insert_final_newline = true,
-			.end_of_line = fmt_guess_line_endings(src),
-			.sort_files = true,
-			.group_arg_value = true,
-			.simplify_string_literals = false,
-			.indent_before_comments = " ",
-			.use_editor_config = true,
-			.sticky_parens = false,
-			.continuation_indent = false,
-		},
 	};
 
 	bucket_arr_init(&f.frags, 1024, sizeof(struct fmt_frag));
 	arr_init(&f.out_blocks, 64, sizeof(struct fmt_out_block));
 	arr_init(&f.list_tmp, 64, sizeof(struct fmt_frag *));
 
-	if (editorconfig) {
-		try_parse_editorconfig(src, &f.opts);
-	}
-
 	char *cfg_buf = NULL;
 	struct source cfg_src = { 0 };
-	if (cfg_path) {
-		if (!ini_parse(cfg_path, &cfg_src, &cfg_buf, fmt_cfg_parse_cb, &f)) {
-			goto ret;
-		}
+	if (!fmt_load_opts(&f, src, cfg_path, editorconfig, &cfg_src, &cfg_buf)) {
+		goto ret;
 	}
 
 	enum vm_compile_mode compile_mode = vm_compile_mode_fmt;
@@ -11,10 +11,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEX_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define LEX_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #include "buf_size.h"
 #include "error.h"
 #include "lang/lexer.h"
 #include "platform/assert.h"
+#include "platform/os.h"
 
 /******************************************************************************
 * token printing
@@ -163,6 +176,82 @@ lex_advance_n(struct lexer *lexer, uint32_t n)
 	}
 }
 
+/*
+ * Return a mask with bit i set if byte i of the 16 byte group at p is one of
+ * the 4 bytes in set.
+ */
+static inline uint32_t
+lex_group_match(const char *p, const char set[4])
+{
+#if defined(LEX_SCAN_SSE2)
+	const __m128i g = _mm_loadu_si128((const __m128i *)p);
+	__m128i m = _mm_or_si128(_mm_cmpeq_epi8(g, _mm_set1_epi8(set[0])), _mm_cmpeq_epi8(g, _mm_set1_epi8(set[1])));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(g, _mm_set1_epi8(set[2])));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(g, _mm_set1_epi8(set[3])));
+	return (uint32_t)_mm_movemask_epi8(m);
+#elif defined(LEX_SCAN_NEON)
+	static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x16_t g = vld1q_u8((const uint8_t *)p);
+	uint8x16_t m = vorrq_u8(vceqq_u8(g, vdupq_n_u8(set[0])), vceqq_u8(g, vdupq_n_u8(set[1])));
+	m = vorrq_u8(m, vceqq_u8(g, vdupq_n_u8(set[2])));
+	m = vandq_u8(vorrq_u8(m, vceqq_u8(g, vdupq_n_u8(set[3]))), vld1q_u8(bits));
+	return (uint32_t)vaddv_u8(vget_low_u8(m)) | ((uint32_t)vaddv_u8(vget_high_u8(m)) << 8);
+#else
+	uint32_t i, r = 0;
+	for (i = 0; i < 16; ++i) {
+		r |= (uint32_t)(p[i] == set[0] || p[i] == set[1] || p[i] == set[2] || p[i] == set[3]) << i;
+	}
+	return r;
+#endif
+}
+
+static inline uint32_t
+lex_group_first(uint32_t mask)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return i;
+#else
+	uint32_t i;
+	for (i = 0; !(mask & 1); ++i) {
+		mask >>= 1;
+	}
+	return i;
+#endif
+}
+
+/*
+ * Return the index of the first byte in src[lexer->i, end) that is (or, if
+ * invert is set, is not) one of the bytes in set, or end if there is none.
+ */
+static uint32_t
+lex_scan(const struct lexer *lexer, uint32_t end, const char set[4], bool invert)
+{
+	const char *src = lexer->src;
+	const uint32_t flip = invert ? 0xffff : 0;
+	uint32_t i = lexer->i, mask;
+
+	if (!lexer->scan_generic) {
+		for (; i + 16 <= end; i += 16) {
+			if ((mask = lex_group_match(&src[i], set) ^ flip)) {
+				return i + lex_group_first(mask);
+			}
+		}
+	}
+
+	for (; i < end; ++i) {
+		bool in_set = src[i] == set[0] || src[i] == set[1] || src[i] == set[2] || src[i] == set[3];
+		if (in_set != invert) {
+			break;
+		}
+	}
+
+	return i;
+}
+
 struct lex_str_token_table {
 	struct str str;
 	int32_t token_type;
@@ -193,7 +282,7 @@ lex_str_token_lookup(struct lexer *lexer,
 static void
 lex_copy_str(struct lexer *lexer, struct token *token, uint32_t start, uint32_t end)
 {
-	token->data.str = make_strn(lexer->wk, &lexer->src[start], end - start);
+	token->data.str = make_strn_interned(lexer->wk, &lexer->src[start], end - start);
 	token->location.len = end - start;
 }
 
@@ -224,29 +313,67 @@ static const struct lex_str_token_table lex_2chr_tokens_func[] = {
 	{ WKSTR_STATIC("->"), token_type_returntype },
 };
 
-static const struct lex_str_token_table lex_keyword_tokens[] = {
-	{ WKSTR_STATIC("and"), token_type_and },
-	{ WKSTR_STATIC("break"), token_type_break },
-	{ WKSTR_STATIC("continue"), token_type_continue },
-	{ WKSTR_STATIC("elif"), token_type_elif },
-	{ WKSTR_STATIC("else"), token_type_else },
-	{ WKSTR_STATIC("endforeach"), token_type_endforeach },
-	{ WKSTR_STATIC("endif"), token_type_endif },
-	{ WKSTR_STATIC("false"), token_type_false },
-	{ WKSTR_STATIC("foreach"), token_type_foreach },
-	{ WKSTR_STATIC("if"), token_type_if },
-	{ WKSTR_STATIC("in"), token_type_in },
-	{ WKSTR_STATIC("not"), token_type_not },
-	{ WKSTR_STATIC("or"), token_type_or },
-	{ WKSTR_STATIC("true"), token_type_true },
+/*
+ * Keywords are stored in a perfect hash table indexed by
+ * lex_keyword_hash().  If a keyword is added, the multipliers must be
+ * adjusted so that all keywords still land in distinct slots.
+ */
+#define LEX_KEYWORD_HASH_SIZE 32
+#define LEX_KEYWORD_MAX_LEN 10
+
+struct lex_keyword {
+	struct str str;
+	enum token_type token_type;
+	bool functions_only;
 };
 
-static const struct lex_str_token_table lex_keyword_tokens_func[] = {
-	{ WKSTR_STATIC("endfunc"), token_type_endfunc },
-	{ WKSTR_STATIC("func"), token_type_func },
-	{ WKSTR_STATIC("return"), token_type_return },
+static const struct lex_keyword lex_keyword_tokens[LEX_KEYWORD_HASH_SIZE] = {
+	[0] = { WKSTR_STATIC("break"), token_type_break },
+	[1] = { WKSTR_STATIC("endfunc"), token_type_endfunc, true },
+	[2] = { WKSTR_STATIC("false"), token_type_false },
+	[4] = { WKSTR_STATIC("else"), token_type_else },
+	[7] = { WKSTR_STATIC("elif"), token_type_elif },
+	[8] = { WKSTR_STATIC("endif"), token_type_endif },
+	[11] = { WKSTR_STATIC("or"), token_type_or },
+	[12] = { WKSTR_STATIC("and"), token_type_and },
+	[13] = { WKSTR_STATIC("foreach"), token_type_foreach },
+	[14] = { WKSTR_STATIC("continue"), token_type_continue },
+	[17] = { WKSTR_STATIC("in"), token_type_in },
+	[19] = { WKSTR_STATIC("endforeach"), token_type_endforeach },
+	[21] = { WKSTR_STATIC("not"), token_type_not },
+	[23] = { WKSTR_STATIC("true"), token_type_true },
+	[25] = { WKSTR_STATIC("if"), token_type_if },
+	[26] = { WKSTR_STATIC("return"), token_type_return, true },
+	[27] = { WKSTR_STATIC("func"), token_type_func, true },
 };
 
+static uint32_t
+lex_keyword_hash(const struct str *str)
+{
+	return ((uint8_t)str->s[0] * 29 + (uint8_t)str->s[str->len - 1] * 3 + str->len) & (LEX_KEYWORD_HASH_SIZE - 1);
+}
+
+static bool
+lex_keyword_lookup(struct lexer *lexer, struct token *token, const struct str *str)
+{
+	const struct lex_keyword *kw;
+
+	if (str->len < 2 || str->len > LEX_KEYWORD_MAX_LEN) {
+		return false;
+	}
+
+	kw = &lex_keyword_tokens[lex_keyword_hash(str)];
+	if (kw->str.len != str->len || memcmp(kw->str.s, str->s, str->len) != 0) {
+		return false;
+	} else if (kw->functions_only && !(lexer->mode & lexer_mode_functions)) {
+		return false;
+	}
+
+	token->type = kw->token_type;
+	token->location.len = kw->str.len;
+	return true;
+}
+
 static void
 lex_number(struct lexer *lexer, struct token *token)
 {
@@ -461,31 +588,34 @@ typedef bool(lex_string_escape_fun)(struct lexer *lexer, struct token *token, st
 static void
 lex_basic_string(struct lexer *lexer, struct token *token, struct sbuf *buf, char end, lex_string_escape_fun escape)
 {
+	const char stop[4] = { end, '\\', '\n', 0 };
+	uint32_t run_end;
+
 	lex_advance(lexer);
 
-	for (; lexer->i < lexer->source->len && lexer->src[lexer->i] != end; lex_advance(lexer)) {
-		switch (lexer->src[lexer->i]) {
-		case 0:
-		case '\n': goto unterminated_string;
-		case '\\': {
-			if (!lex_string_escape(lexer, token, buf)) {
-				return;
-			}
+	// copy runs of plain characters in one go, stopping at escapes
+	while (true) {
+		run_end = lex_scan(lexer, lexer->source->len, stop, false);
+		sbuf_pushn(lexer->wk, buf, &lexer->src[lexer->i], run_end - lexer->i);
+		lexer->i = run_end;
+
+		if (lexer->i >= lexer->source->len || lexer->src[lexer->i] != '\\') {
 			break;
+		} else if (!lex_string_escape(lexer, token, buf)) {
+			return;
 		}
-		default: sbuf_push(lexer->wk, buf, lexer->src[lexer->i]); break;
-		}
+
+		lex_advance(lexer);
 	}
 
-	if (lexer->src[lexer->i] != end) {
-unterminated_string:
+	if (lexer->i >= lexer->source->len || lexer->src[lexer->i] != end) {
 		lex_error_token(lexer, token, "unterminated string");
 		return;
 	}
 
 	lex_advance(lexer);
 
-	token->data.str = sbuf_into_str(lexer->wk, buf);
+	token->data.str = str_intern(lexer->wk, sbuf_into_str(lexer->wk, buf));
 }
 
 static void
@@ -497,16 +627,23 @@ lex_string(struct lexer *lexer, struct token *token)
 	if (str_eql(&lexer_str(multiline_terminator.len), &multiline_terminator)) {
 		lex_advance_n(lexer, multiline_terminator.len);
 		uint32_t start = lexer->i;
-
-		while (lexer->source->len - lexer->i >= multiline_terminator.len
-			&& !str_eql(&lexer_str(multiline_terminator.len), &multiline_terminator)) {
+		// the last offset a terminator could start at, plus one
+		uint32_t limit = lexer->source->len - lexer->i >= multiline_terminator.len ?
+					 lexer->source->len - multiline_terminator.len + 1 :
+					 lexer->i;
+
+		while (lexer->i < limit) {
+			lexer->i = lex_scan(lexer, limit, "\'\'\'\'", false);
+			if (lexer->i == limit || str_eql(&lexer_str(multiline_terminator.len), &multiline_terminator)) {
+				break;
+			}
 			lex_advance(lexer);
 		}
 
 		if (str_eql(&lexer_str(multiline_terminator.len), &multiline_terminator)) {
 			sbuf_pushn(lexer->wk, &buf, &lexer->src[start], lexer->i - start);
 			lex_advance_n(lexer, 3);
-			token->data.str = sbuf_into_str(lexer->wk, &buf);
+			token->data.str = str_intern(lexer->wk, sbuf_into_str(lexer->wk, &buf));
 		} else {
 			lex_error_token(lexer, token, "unterminated multiline string");
 		}
@@ -582,9 +719,7 @@ restart:
 
 			start = lexer->i;
 
-			while (lexer->src[lexer->i] && lexer->src[lexer->i] != '\n') {
-				lex_advance(lexer);
-			}
+			lexer->i = lex_scan(lexer, lexer->source->len, "\n\n\0\0", false);
 
 			if (lexer->mode & lexer_mode_fmt) {
 				bool fmt_on;
@@ -611,7 +746,7 @@ restart:
 				}
 			}
 		} else {
-			lex_advance(lexer);
+			lexer->i = lex_scan(lexer, lexer->source->len, " \t\r\r", true);
 		}
 	}
 
@@ -627,10 +762,15 @@ restart:
 	token->location.off = lexer->i;
 
 	struct str lexer_str_2chr = lexer_str(2);
-	if (lex_str_token_lookup(lexer, token, lex_2chr_tokens, ARRAY_LEN(lex_2chr_tokens), &lexer_str_2chr)
-		|| ((lexer->mode & lexer_mode_functions)
-			&& lex_str_token_lookup(
-				lexer, token, lex_2chr_tokens_func, ARRAY_LEN(lex_2chr_tokens_func), &lexer_str_2chr))) {
+	// every 2 character token ends with '=' or '>'
+	if (lexer_str_2chr.len == 2 && (lexer_str_2chr.s[1] == '=' || lexer_str_2chr.s[1] == '>')
+		&& (lex_str_token_lookup(lexer, token, lex_2chr_tokens, ARRAY_LEN(lex_2chr_tokens), &lexer_str_2chr)
+			|| ((lexer->mode & lexer_mode_functions)
+				&& lex_str_token_lookup(lexer,
+					token,
+					lex_2chr_tokens_func,
+					ARRAY_LEN(lex_2chr_tokens_func),
+					&lexer_str_2chr)))) {
 		lex_advance_n(lexer, 2);
 		return;
 	}
@@ -648,20 +788,14 @@ restart:
 		return;
 	} else if (is_valid_start_of_identifier(lexer->src[lexer->i])) {
 		start = lexer->i;
-		struct str str = { &lexer->src[lexer->i] };
 
-		while (is_valid_inside_of_identifier(lexer->src[lexer->i])) {
-			lex_advance(lexer);
-			++str.len;
+		while (lexer->i < lexer->source->len && is_valid_inside_of_identifier(lexer->src[lexer->i])) {
+			++lexer->i;
 		}
 
-		if (lex_str_token_lookup(lexer, token, lex_keyword_tokens, ARRAY_LEN(lex_keyword_tokens), &str)
-			|| ((lexer->mode & lexer_mode_functions)
-				&& lex_str_token_lookup(lexer,
-					token,
-					lex_keyword_tokens_func,
-					ARRAY_LEN(lex_keyword_tokens_func),
-					&str))) {
+		struct str str = { &lexer->src[start], lexer->i - start };
+
+		if (lex_keyword_lookup(lexer, token, &str)) {
 			lexer_push_pop_enclosed_state(lexer, token->type);
 			return;
 		} else {
@@ -753,6 +887,13 @@ lexer_init(struct lexer *lexer, struct workspace *wk, struct source *src, enum l
 		.mode = mode,
 	};
 
+	/*
+	 * MUON_LEXER_IMPL=generic disables the 16 byte group scan in lex_scan(),
+	 * which is useful for benchmarking and for ruling out the vector paths.
+	 */
+	const char *impl = os_get_env("MUON_LEXER_IMPL");
+	lexer->scan_generic = impl && strcmp(impl, "generic") == 0;
+
 	stack_init(&lexer->stack, 2048);
 
 	if (lexer->mode & lexer_mode_fmt) {
@@ -845,9 +986,7 @@ restart:
 
 			start = lexer->i;
 
-			while (lexer->src[lexer->i] && lexer->src[lexer->i] != '\n') {
-				lex_advance(lexer);
-			}
+			lexer->i = lex_scan(lexer, lexer->source->len, "\n\n\0\0", false);
 
 			if (lexer->mode & lexer_mode_fmt) {
 				bool fmt_on;
@@ -874,7 +1013,7 @@ restart:
 				}
 			}
 		} else {
-			lex_advance(lexer);
+			lexer->i = lex_scan(lexer, lexer->source->len, " \t\r\r", true);
 		}
 	}
 
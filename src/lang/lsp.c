@@ -0,0 +1,865 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "compat.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "external/tinyjson.h"
+#include "lang/eval.h"
+#include "lang/lexer.h"
+#include "lang/lsp.h"
+#include "lang/object_iterators.h"
+#include "lang/string.h"
+#include "lang/typecheck.h"
+#include "lang/workspace.h"
+#include "log.h"
+#include "platform/filesystem.h"
+#include "platform/mem.h"
+#include "platform/path.h"
+
+/*
+ * A language server speaking JSON-RPC over stdin/stdout.  The analyzer
+ * workspace from the last run is kept alive so that definition and hover
+ * requests are answered without re-evaluating anything.  Edits only mark the
+ * analysis as stale when they touch a file that the last run actually
+ * evaluated with different contents.  A stale analysis keeps answering
+ * requests, and is only replaced once the client has been quiet for
+ * lsp_idle_ms, so a burst of keystrokes costs a single re-analysis.
+ */
+
+enum {
+	lsp_idle_ms = 200,
+};
+
+struct lsp_file {
+	struct source src;
+	bool closed;
+};
+
+struct lsp_server {
+	struct az_opts *opts;
+	struct workspace wk;
+	bool analyzed, stale, have_root, shutdown;
+	// positions are counted in bytes rather than utf-16 code units
+	bool utf8_positions;
+	// struct lsp_file, files opened by the client
+	struct arr files;
+	// struct source, passed to the analyzer as file_overrides
+	struct arr overrides;
+	// struct error_diagnostic_message
+	struct arr diagnostics;
+	// char *, paths that currently have published diagnostics
+	struct arr published;
+	// char *, replaced file contents that the last analysis still refers to
+	struct arr retired;
+
+	char *msg;
+	uint64_t msg_cap;
+};
+
+static char *
+lsp_strdup(const char *s, uint64_t len)
+{
+	char *r = z_malloc(len + 1);
+	memcpy(r, s, len);
+	r[len] = 0;
+	return r;
+}
+
+/******************************************************************************
+ * protocol
+ ******************************************************************************/
+
+static bool
+lsp_read_message(struct lsp_server *srv)
+{
+	char line[256];
+	uint64_t len = 0;
+	bool have_len = false;
+
+	while (true) {
+		if (!fgets(line, sizeof(line), stdin)) {
+			return false;
+		}
+
+		if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) {
+			if (have_len) {
+				break;
+			}
+		} else if (strncmp(line, "Content-Length:", 15) == 0) {
+			len = strtoull(&line[15], NULL, 10);
+			have_len = true;
+		}
+	}
+
+	if (len + 1 > srv->msg_cap) {
+		srv->msg_cap = len + 1;
+		srv->msg = z_realloc(srv->msg, srv->msg_cap);
+	}
+
+	if (len && fread(srv->msg, 1, len, stdin) != len) {
+		return false;
+	}
+
+	srv->msg[len] = 0;
+	return true;
+}
+
+static void
+lsp_send(struct sbuf *body)
+{
+	fprintf(stdout, "Content-Length: %u\r\n\r\n", body->len);
+	fs_fwrite(body->buf, body->len, stdout);
+	fflush(stdout);
+}
+
+static void
+lsp_push_id(struct workspace *wk, struct sbuf *buf, obj id)
+{
+	switch (get_obj_type(wk, id)) {
+	case obj_number: sbuf_pushf(wk, buf, "%" PRId64, get_obj_number(wk, id)); break;
+	case obj_string: sbuf_push_json_escaped_quoted(wk, buf, get_str(wk, id)); break;
+	default: sbuf_pushs(wk, buf, "null"); break;
+	}
+}
+
+static void
+lsp_respond(struct workspace *wk, obj id, const char *result)
+{
+	SBUF_manual(buf);
+	sbuf_pushs(wk, &buf, "{\"jsonrpc\":\"2.0\",\"id\":");
+	lsp_push_id(wk, &buf, id);
+	sbuf_pushf(wk, &buf, ",\"result\":%s}", result);
+	lsp_send(&buf);
+	sbuf_destroy(&buf);
+}
+
+static void
+lsp_respond_error(struct workspace *wk, obj id, int32_t code, const char *msg)
+{
+	SBUF_manual(buf);
+	sbuf_pushs(wk, &buf, "{\"jsonrpc\":\"2.0\",\"id\":");
+	lsp_push_id(wk, &buf, id);
+	sbuf_pushf(wk, &buf, ",\"error\":{\"code\":%d,\"message\":", code);
+	sbuf_push_json_escaped_quoted(wk, &buf, &WKSTR(msg));
+	sbuf_pushs(wk, &buf, "}}");
+	lsp_send(&buf);
+	sbuf_destroy(&buf);
+}
+
+/*
+ * Index into nested dicts using a dotted path, e.g. "textDocument.uri".
+ */
+static bool
+lsp_get(struct workspace *wk, obj o, const char *path, enum obj_type t, obj *res)
+{
+	const char *sep;
+
+	while (true) {
+		if (get_obj_type(wk, o) != obj_dict) {
+			return false;
+		}
+
+		sep = strchr(path, '.');
+		if (!obj_dict_index_strn(wk, o, path, sep ? (uint32_t)(sep - path) : strlen(path), &o)) {
+			return false;
+		}
+
+		if (!sep) {
+			break;
+		}
+		path = sep + 1;
+	}
+
+	if (get_obj_type(wk, o) != t) {
+		return false;
+	}
+
+	*res = o;
+	return true;
+}
+
+static bool
+lsp_get_path(struct workspace *wk, obj params, struct sbuf *buf, const char *key)
+{
+	obj uri;
+	if (!lsp_get(wk, params, key, obj_string, &uri)) {
+		return false;
+	}
+
+	const struct str *s = get_str(wk, uri);
+	if (!str_startswith(s, &WKSTR("file://"))) {
+		return false;
+	}
+
+	uint32_t i;
+	for (i = 7; i < s->len; ++i) {
+		if (s->s[i] == '%' && i + 2 < s->len && strspn(&s->s[i + 1], "0123456789abcdefABCDEF") >= 2) {
+			char hex[3] = { s->s[i + 1], s->s[i + 2], 0 };
+			sbuf_push(wk, buf, (char)strtol(hex, NULL, 16));
+			i += 2;
+		} else {
+			sbuf_push(wk, buf, s->s[i]);
+		}
+	}
+
+	return true;
+}
+
+static void
+lsp_push_uri(struct workspace *wk, struct sbuf *buf, const char *path)
+{
+	sbuf_pushs(wk, buf, "\"file://");
+	for (; *path; ++path) {
+		if (is_valid_inside_of_identifier(*path) || strchr("/-.~", *path)) {
+			sbuf_push(wk, buf, *path);
+		} else {
+			sbuf_pushf(wk, buf, "%%%02X", (uint8_t)*path);
+		}
+	}
+	sbuf_push(wk, buf, '"');
+}
+
+/*
+ * Returns the length of the utf-8 sequence starting at c, and the number of
+ * utf-16 code units needed to encode it in units.  Invalid bytes are treated
+ * as single characters.
+ */
+static uint32_t
+lsp_utf8_char_len(const struct lsp_server *srv, uint8_t c, uint32_t *units)
+{
+	uint32_t len = 1;
+
+	if (c >= 0xf0 && c < 0xf8) {
+		len = 4;
+	} else if (c >= 0xe0 && c < 0xf0) {
+		len = 3;
+	} else if (c >= 0xc0 && c < 0xe0) {
+		len = 2;
+	}
+
+	if (srv->utf8_positions) {
+		*units = len;
+	} else {
+		*units = len == 4 ? 2 : 1;
+	}
+
+	return len;
+}
+
+static uint32_t
+lsp_position_to_offset(const struct lsp_server *srv, const struct source *src, int64_t line, int64_t character)
+{
+	uint32_t off = 0, len, units;
+
+	while (line > 0 && off < src->len) {
+		if (src->src[off++] == '\n') {
+			--line;
+		}
+	}
+
+	while (character > 0 && off < src->len && src->src[off] != '\n') {
+		len = lsp_utf8_char_len(srv, src->src[off], &units);
+		if (units > character) {
+			break;
+		}
+
+		off += len;
+		character -= units;
+	}
+
+	return off > src->len ? src->len : off;
+}
+
+static void
+lsp_push_position(const struct lsp_server *srv,
+	struct workspace *wk,
+	struct sbuf *buf,
+	const struct source *src,
+	uint32_t off)
+{
+	uint32_t i, line = 0, character = 0, units;
+
+	for (i = 0; i < off && i < src->len;) {
+		if (src->src[i] == '\n') {
+			++line;
+			character = 0;
+			++i;
+		} else {
+			i += lsp_utf8_char_len(srv, src->src[i], &units);
+			character += units;
+		}
+	}
+
+	sbuf_pushf(wk, buf, "{\"line\":%d,\"character\":%d}", line, character);
+}
+
+static void
+lsp_push_range(const struct lsp_server *srv,
+	struct workspace *wk,
+	struct sbuf *buf,
+	const struct source *src,
+	struct source_location loc)
+{
+	sbuf_pushs(wk, buf, "{\"start\":");
+	lsp_push_position(srv, wk, buf, src, loc.off);
+	sbuf_pushs(wk, buf, ",\"end\":");
+	lsp_push_position(srv, wk, buf, src, loc.off + loc.len);
+	sbuf_push(wk, buf, '}');
+}
+
+/******************************************************************************
+ * analysis
+ ******************************************************************************/
+
+static bool
+lsp_find_src(struct lsp_server *srv, const char *path, uint32_t *src_idx)
+{
+	if (!srv->analyzed) {
+		return false;
+	}
+
+	uint32_t i;
+	for (i = 0; i < srv->wk.vm.src.len; ++i) {
+		const struct source *src = arr_get(&srv->wk.vm.src, i);
+		if (src->label && strcmp(src->label, path) == 0) {
+			*src_idx = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static struct lsp_file *
+lsp_find_file(struct lsp_server *srv, const char *path, uint32_t *idx)
+{
+	uint32_t i;
+	for (i = 0; i < srv->files.len; ++i) {
+		struct lsp_file *f = arr_get(&srv->files, i);
+		if (strcmp(f->src.label, path) == 0) {
+			if (idx) {
+				*idx = i;
+			}
+			return f;
+		}
+	}
+
+	return 0;
+}
+
+static void
+lsp_file_destroy(struct lsp_server *srv, uint32_t idx)
+{
+	struct lsp_file *f = arr_get(&srv->files, idx);
+	z_free((char *)f->src.label);
+	z_free((char *)f->src.src);
+	arr_del(&srv->files, idx);
+}
+
+static void
+lsp_publish_diagnostics_for(struct lsp_server *srv, const char *path)
+{
+	struct workspace *wk = &srv->wk;
+	static const uint32_t severity[log_level_count] = {
+		[log_error] = 1,
+		[log_warn] = 2,
+		[log_info] = 3,
+		[log_debug] = 4,
+	};
+
+	SBUF_manual(buf);
+	sbuf_pushs(wk, &buf, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+	lsp_push_uri(wk, &buf, path);
+	sbuf_pushs(wk, &buf, ",\"diagnostics\":[");
+
+	uint32_t i;
+	bool first = true;
+	for (i = 0; srv->analyzed && i < srv->diagnostics.len; ++i) {
+		const struct error_diagnostic_message *msg = arr_get(&srv->diagnostics, i);
+		if (msg->src_idx == UINT32_MAX) {
+			continue;
+		}
+
+		const struct source *src = arr_get(&wk->vm.src, msg->src_idx);
+		if (strcmp(src->label, path) != 0) {
+			continue;
+		}
+
+		if (!first) {
+			sbuf_push(wk, &buf, ',');
+		}
+		first = false;
+
+		sbuf_pushs(wk, &buf, "{\"range\":");
+		lsp_push_range(srv, wk, &buf, src, msg->location);
+		sbuf_pushf(wk, &buf, ",\"severity\":%d,\"source\":\"muon\",\"message\":", severity[msg->lvl]);
+		sbuf_push_json_escaped_quoted(wk, &buf, &WKSTR(msg->msg));
+		sbuf_push(wk, &buf, '}');
+	}
+
+	sbuf_pushs(wk, &buf, "]}}");
+	lsp_send(&buf);
+	sbuf_destroy(&buf);
+}
+
+static bool
+lsp_path_in(const struct arr *paths, const char *path)
+{
+	uint32_t i;
+	for (i = 0; i < paths->len; ++i) {
+		if (strcmp(*(const char **)arr_get(paths, i), path) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+lsp_publish_diagnostics(struct lsp_server *srv)
+{
+	uint32_t i;
+	struct arr published;
+	arr_init(&published, 16, sizeof(char *));
+
+	for (i = 0; i < srv->diagnostics.len; ++i) {
+		const struct error_diagnostic_message *msg = arr_get(&srv->diagnostics, i);
+		if (msg->src_idx == UINT32_MAX) {
+			continue;
+		}
+
+		const struct source *src = arr_get(&srv->wk.vm.src, msg->src_idx);
+		if (!src->label || !path_is_absolute(src->label) || lsp_path_in(&published, src->label)) {
+			continue;
+		}
+
+		char *path = lsp_strdup(src->label, strlen(src->label));
+		arr_push(&published, &path);
+		lsp_publish_diagnostics_for(srv, path);
+	}
+
+	// Clear diagnostics for files that no longer have any
+	for (i = 0; i < srv->published.len; ++i) {
+		char *path = *(char **)arr_get(&srv->published, i);
+		if (!lsp_path_in(&published, path)) {
+			lsp_publish_diagnostics_for(srv, path);
+		}
+		z_free(path);
+	}
+
+	arr_destroy(&srv->published);
+	srv->published = published;
+}
+
+static void
+lsp_reset_analysis(struct lsp_server *srv)
+{
+	if (!srv->analyzed) {
+		return;
+	}
+
+	az_state_destroy();
+	workspace_destroy(&srv->wk);
+	arr_clear(&srv->diagnostics);
+	srv->analyzed = false;
+
+	uint32_t i;
+	for (i = 0; i < srv->retired.len; ++i) {
+		z_free(*(char **)arr_get(&srv->retired, i));
+	}
+	arr_clear(&srv->retired);
+
+	// Closed files are only kept around while the analysis refers to them
+	for (i = 0; i < srv->files.len;) {
+		struct lsp_file *f = arr_get(&srv->files, i);
+		if (f->closed) {
+			lsp_file_destroy(srv, i);
+		} else {
+			++i;
+		}
+	}
+}
+
+static void
+lsp_analyze(struct lsp_server *srv)
+{
+	if ((srv->analyzed && !srv->stale) || !srv->have_root) {
+		return;
+	}
+
+	lsp_reset_analysis(srv);
+
+	uint32_t i;
+	arr_clear(&srv->overrides);
+	for (i = 0; i < srv->files.len; ++i) {
+		struct lsp_file *f = arr_get(&srv->files, i);
+		arr_push(&srv->overrides, &f->src);
+	}
+
+	srv->opts->file_overrides = &srv->overrides;
+	srv->opts->diagnostics = &srv->diagnostics;
+	srv->opts->retain_state = true;
+
+	do_analyze_internal(&srv->wk, srv->opts);
+	srv->analyzed = true;
+	srv->stale = false;
+
+	lsp_publish_diagnostics(srv);
+}
+
+static void
+lsp_set_root(struct lsp_server *srv, const char *path)
+{
+	if (srv->have_root) {
+		return;
+	}
+
+	struct workspace wk;
+	workspace_init_bare(&wk);
+
+	const char *root = determine_project_root(&wk, path);
+	if (root && path_chdir(root)) {
+		srv->have_root = true;
+	}
+
+	workspace_destroy_bare(&wk);
+}
+
+/******************************************************************************
+ * handlers
+ ******************************************************************************/
+
+/*
+ * Replace the contents of f.  The old contents are kept alive until the next
+ * analysis if the current one refers to them.
+ */
+static void
+lsp_file_set_src(struct lsp_server *srv, struct lsp_file *f, const struct str *text)
+{
+	uint32_t src_idx;
+
+	if (f->src.src) {
+		char *old = (char *)f->src.src;
+		if (lsp_find_src(srv, f->src.label, &src_idx)
+			&& ((const struct source *)arr_get(&srv->wk.vm.src, src_idx))->src == old) {
+			arr_push(&srv->retired, &old);
+		} else {
+			z_free(old);
+		}
+	}
+
+	f->src.src = lsp_strdup(text->s, text->len);
+	f->src.len = text->len;
+}
+
+static void
+lsp_did_open_or_change(struct lsp_server *srv, const char *path, const struct str *text)
+{
+	uint32_t src_idx;
+	struct lsp_file *f;
+
+	// If the file wasn't evaluated by the last analysis then nothing refers
+	// to its old contents and it can be replaced without re-analyzing.
+	if (lsp_find_src(srv, path, &src_idx)) {
+		const struct source *src = arr_get(&srv->wk.vm.src, src_idx);
+		if (src->len != text->len || memcmp(src->src, text->s, text->len) != 0) {
+			srv->stale = true;
+		}
+	}
+
+	if (!(f = lsp_find_file(srv, path, 0))) {
+		arr_push(&srv->files,
+			&(struct lsp_file){
+				.src = { .label = lsp_strdup(path, strlen(path)) },
+			});
+		f = arr_peek(&srv->files, 1);
+	}
+
+	lsp_file_set_src(srv, f, text);
+	f->closed = false;
+}
+
+static void
+lsp_did_close(struct lsp_server *srv, const char *path)
+{
+	uint32_t idx, src_idx;
+	struct lsp_file *f;
+
+	if (!(f = lsp_find_file(srv, path, &idx))) {
+		return;
+	}
+
+	if (lsp_find_src(srv, path, &src_idx)) {
+		// The file is dropped by the next analysis, and until then the
+		// current one may still refer to its contents.
+		struct source disk = { 0 };
+		const struct source *src = arr_get(&srv->wk.vm.src, src_idx);
+		if (fs_file_exists(path) && fs_read_entire_file(path, &disk)) {
+			if (disk.len != src->len || memcmp(disk.src, src->src, disk.len) != 0) {
+				srv->stale = true;
+			}
+			fs_source_destroy(&disk);
+		} else {
+			srv->stale = true;
+		}
+
+		f->closed = true;
+		return;
+	}
+
+	lsp_file_destroy(srv, idx);
+}
+
+static void
+lsp_did_change_watched_files(struct lsp_server *srv, struct workspace *wk, obj params)
+{
+	obj changes, change;
+	if (!lsp_get(wk, params, "changes", obj_array, &changes)) {
+		return;
+	}
+
+	obj_array_for(wk, changes, change) {
+		uint32_t src_idx;
+		SBUF(path);
+		if (lsp_get_path(wk, change, &path, "uri") && !lsp_find_file(srv, path.buf, 0)
+			&& lsp_find_src(srv, path.buf, &src_idx)) {
+			srv->stale = true;
+		}
+	}
+}
+
+/*
+ * Resolve the identifier under the cursor described by params to an
+ * assignment recorded by the last analysis.
+ */
+static bool
+lsp_lookup(struct lsp_server *srv, struct workspace *wk, obj params, struct sbuf *name, struct az_assignment_info *info)
+{
+	uint32_t src_idx;
+	obj line, character;
+	SBUF(path);
+
+	// A stale analysis is still good enough to answer from, and is
+	// replaced once the client is idle.
+	if (!srv->analyzed) {
+		lsp_analyze(srv);
+	}
+
+	if (!lsp_get_path(wk, params, &path, "textDocument.uri")
+		|| !lsp_get(wk, params, "position.line", obj_number, &line)
+		|| !lsp_get(wk, params, "position.character", obj_number, &character)
+		|| !lsp_find_src(srv, path.buf, &src_idx)) {
+		return false;
+	}
+
+	const struct source *src = arr_get(&srv->wk.vm.src, src_idx);
+	uint32_t start, end;
+	start = end = lsp_position_to_offset(srv, src, get_obj_number(wk, line), get_obj_number(wk, character));
+
+	while (start > 0 && is_valid_inside_of_identifier(src->src[start - 1])) {
+		--start;
+	}
+	while (end < src->len && is_valid_inside_of_identifier(src->src[end])) {
+		++end;
+	}
+
+	if (start == end || !is_valid_start_of_identifier(src->src[start])) {
+		return false;
+	}
+
+	sbuf_pushn(wk, name, &src->src[start], end - start);
+
+	// Assignment locations point at the assignment operator, so accept
+	// any assignment up to the end of the current line.
+	while (end < src->len && src->src[end] != '\n') {
+		++end;
+	}
+
+	return az_lookup_assignment(name->buf, src_idx, end, info);
+}
+
+static void
+lsp_definition(struct lsp_server *srv, struct workspace *wk, obj id, obj params)
+{
+	struct az_assignment_info info;
+	SBUF(name);
+	if (!lsp_lookup(srv, wk, params, &name, &info) || info.default_var || info.src_idx == UINT32_MAX) {
+		lsp_respond(wk, id, "null");
+		return;
+	}
+
+	const struct source *src = arr_get(&srv->wk.vm.src, info.src_idx);
+
+	SBUF_manual(buf);
+	sbuf_pushs(wk, &buf, "{\"uri\":");
+	lsp_push_uri(wk, &buf, src->label);
+	sbuf_pushs(wk, &buf, ",\"range\":");
+	lsp_push_range(srv, wk, &buf, src, info.location);
+	sbuf_push(wk, &buf, '}');
+	lsp_respond(wk, id, buf.buf);
+	sbuf_destroy(&buf);
+}
+
+static void
+lsp_hover(struct lsp_server *srv, struct workspace *wk, obj id, obj params)
+{
+	struct az_assignment_info info;
+	SBUF(name);
+	if (!lsp_lookup(srv, wk, params, &name, &info) || !info.o) {
+		lsp_respond(wk, id, "null");
+		return;
+	}
+
+	sbuf_pushf(wk, &name, ": %s", obj_typestr(&srv->wk, info.o));
+
+	SBUF_manual(buf);
+	sbuf_pushs(wk, &buf, "{\"contents\":{\"kind\":\"plaintext\",\"value\":");
+	sbuf_push_json_escaped_quoted(wk, &buf, &WKSTR(name.buf));
+	sbuf_pushs(wk, &buf, "}}");
+	lsp_respond(wk, id, buf.buf);
+	sbuf_destroy(&buf);
+}
+
+/*
+ * Returns true when the client asked the server to exit.
+ */
+static bool
+lsp_handle_message(struct lsp_server *srv, struct workspace *wk, obj msg)
+{
+	obj method, params = 0, id = 0, text;
+	if (!lsp_get(wk, msg, "method", obj_string, &method)) {
+		// Responses to server initiated requests are ignored
+		return false;
+	}
+
+	obj_dict_index_str(wk, msg, "params", &params);
+	bool is_request = obj_dict_index_str(wk, msg, "id", &id);
+
+	const struct str *m = get_str(wk, method);
+	SBUF(path);
+
+	if (str_eql(m, &WKSTR("initialize"))) {
+		obj encodings, encoding;
+		if (lsp_get_path(wk, params, &path, "rootUri")) {
+			SBUF(build_file);
+			path_join(wk, &build_file, path.buf, "meson.build");
+			lsp_set_root(srv, build_file.buf);
+		}
+
+		// Positions default to utf-16 code units, but counting bytes is
+		// preferred when the client supports it.
+		if (lsp_get(wk, params, "capabilities.general.positionEncodings", obj_array, &encodings)) {
+			obj_array_for(wk, encodings, encoding) {
+				if (get_obj_type(wk, encoding) == obj_string && str_eql(get_str(wk, encoding), &WKSTR("utf-8"))) {
+					srv->utf8_positions = true;
+				}
+			}
+		}
+
+		SBUF(result);
+		sbuf_pushf(wk,
+			&result,
+			"{\"capabilities\":{\"positionEncoding\":\"%s\",\"textDocumentSync\":1,"
+			"\"definitionProvider\":true,\"hoverProvider\":true},"
+			"\"serverInfo\":{\"name\":\"muon\"}}",
+			srv->utf8_positions ? "utf-8" : "utf-16");
+		lsp_respond(wk, id, result.buf);
+	} else if (str_eql(m, &WKSTR("shutdown"))) {
+		srv->shutdown = true;
+		lsp_respond(wk, id, "null");
+	} else if (str_eql(m, &WKSTR("exit"))) {
+		return true;
+	} else if (str_eql(m, &WKSTR("textDocument/didOpen"))) {
+		if (lsp_get_path(wk, params, &path, "textDocument.uri")
+			&& lsp_get(wk, params, "textDocument.text", obj_string, &text)) {
+			lsp_set_root(srv, path.buf);
+			lsp_did_open_or_change(srv, path.buf, get_str(wk, text));
+		}
+	} else if (str_eql(m, &WKSTR("textDocument/didChange"))) {
+		obj changes;
+		if (lsp_get_path(wk, params, &path, "textDocument.uri")
+			&& lsp_get(wk, params, "contentChanges", obj_array, &changes)
+			&& get_obj_array(wk, changes)->len
+			&& lsp_get(wk, obj_array_get_tail(wk, changes), "text", obj_string, &text)) {
+			lsp_did_open_or_change(srv, path.buf, get_str(wk, text));
+		}
+	} else if (str_eql(m, &WKSTR("textDocument/didClose"))) {
+		if (lsp_get_path(wk, params, &path, "textDocument.uri")) {
+			lsp_did_close(srv, path.buf);
+		}
+	} else if (str_eql(m, &WKSTR("workspace/didChangeWatchedFiles"))) {
+		lsp_did_change_watched_files(srv, wk, params);
+	} else if (str_eql(m, &WKSTR("textDocument/definition"))) {
+		lsp_definition(srv, wk, id, params);
+	} else if (str_eql(m, &WKSTR("textDocument/hover"))) {
+		lsp_hover(srv, wk, id, params);
+	} else if (is_request) {
+		lsp_respond_error(wk, id, -32601, "method not found");
+	}
+
+	return false;
+}
+
+bool
+analyze_lsp(struct az_opts *opts)
+{
+	struct lsp_server srv = { .opts = opts };
+	arr_init(&srv.files, 8, sizeof(struct lsp_file));
+	arr_init(&srv.overrides, 8, sizeof(struct source));
+	arr_init(&srv.diagnostics, 64, sizeof(struct error_diagnostic_message));
+	arr_init(&srv.published, 16, sizeof(char *));
+	arr_init(&srv.retired, 8, sizeof(char *));
+
+	// Reads must not be buffered so that fs_wait_for_input can tell whether
+	// another message is pending.
+	setvbuf(stdin, NULL, _IONBF, 0);
+
+	// stdout is reserved for the protocol
+	log_set_file(stderr);
+
+	bool done = false;
+	while (!done) {
+		if ((!srv.analyzed || srv.stale) && !fs_wait_for_input(0, lsp_idle_ms)) {
+			lsp_analyze(&srv);
+		}
+
+		if (!lsp_read_message(&srv)) {
+			break;
+		}
+
+		struct workspace wk;
+		workspace_init_bare(&wk);
+
+		obj msg;
+		if (muon_json_to_dict(&wk, srv.msg, &msg)) {
+			done = lsp_handle_message(&srv, &wk, msg);
+		}
+
+		workspace_destroy_bare(&wk);
+	}
+
+	lsp_reset_analysis(&srv);
+
+	uint32_t i;
+	while (srv.files.len) {
+		lsp_file_destroy(&srv, 0);
+	}
+	for (i = 0; i < srv.published.len; ++i) {
+		z_free(*(char **)arr_get(&srv.published, i));
+	}
+	arr_destroy(&srv.files);
+	arr_destroy(&srv.overrides);
+	arr_destroy(&srv.diagnostics);
+	arr_destroy(&srv.published);
+	arr_destroy(&srv.retired);
+	z_free(srv.msg);
+
+	return srv.shutdown;
+}
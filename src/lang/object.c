@@ -523,7 +523,14 @@ obj_equal(struct workspace *wk, obj left, obj right)
 	}
 
 	switch (t) {
-	case obj_string: return str_eql(get_str(wk, left), get_str(wk, right));
+	case obj_string: {
+		const struct str *l = get_str(wk, left), *r = get_str(wk, right);
+		// Distinct interned strings are never equal
+		if (l->flags & r->flags & str_flag_interned) {
+			return false;
+		}
+		return str_eql(l, r);
+	}
 	case obj_file: return str_eql(get_str(wk, *get_obj_file(wk, left)), get_str(wk, *get_obj_file(wk, right)));
 	case obj_number: return get_obj_number(wk, left) == get_obj_number(wk, right);
 	case obj_bool: return get_obj_bool(wk, left) == get_obj_bool(wk, right);
@@ -984,29 +991,103 @@ obj_array_pop(struct workspace *wk, obj arr)
 	return t;
 }
 
-static enum iteration_result
-obj_array_dedup_iter(struct workspace *wk, void *_ctx, obj val)
+struct obj_dedup_key {
+	struct workspace *wk;
+	obj o;
+};
+
+/*
+ * Hash an object by value.  Objects that are equal according to obj_equal
+ * must hash to the same value.  Containers and iterators all share one hash
+ * and rely on obj_equal to tell them apart.
+ */
+static uint64_t
+obj_dedup_hash_func(const struct hash *h, const void *_key)
 {
-	if (hash_get(&wk->vm.objects.obj_hash, &val)) {
-		return ir_cont;
-	}
-	hash_set(&wk->vm.objects.obj_hash, &val, true);
+	const struct obj_dedup_key *key = _key;
+	struct workspace *wk = key->wk;
+	const uint64_t basis = 14695981039346656037u;
+	const struct str *str;
 
-	obj *res = _ctx;
-	if (!obj_array_in(wk, *res, val)) {
-		obj_array_push(wk, *res, val);
+	switch (get_obj_type(wk, key->o)) {
+	case obj_string: str = get_str(wk, key->o); return hash_bytes(str->s, str->len, 0);
+	case obj_file: str = get_str(wk, *get_obj_file(wk, key->o)); return hash_bytes(str->s, str->len, obj_file);
+	case obj_include_directory: {
+		const struct obj_include_directory *inc = get_obj_include_directory(wk, key->o);
+		str = get_str(wk, inc->path);
+		return hash_bytes(str->s, str->len, obj_include_directory + inc->is_system);
+	}
+	case obj_number: return (uint64_t)get_obj_number(wk, key->o) * 1099511628211u;
+	case obj_bool: return get_obj_bool(wk, key->o);
+	case obj_feature_opt: return get_obj_feature_opt(wk, key->o);
+	case obj_array:
+	case obj_dict:
+	case obj_iterator: return basis;
+	default: return (uint64_t)key->o * 1099511628211u;
 	}
+}
 
-	return ir_cont;
+static bool
+obj_dedup_keycmp(const struct hash *h, const void *_a, const void *_b)
+{
+	const struct obj_dedup_key *a = _a, *b = _b;
+	return obj_equal(a->wk, a->o, b->o);
 }
 
 void
-obj_array_dedup(struct workspace *wk, obj arr, obj *res)
+obj_dedup_hash_init(struct hash *h)
+{
+	hash_init(h, 128, sizeof(struct obj_dedup_key));
+	h->keycmp = obj_dedup_keycmp;
+	h->hash_func = obj_dedup_hash_func;
+}
+
+/*
+ * Order preserving deduplication of arr into a new array.  If should_dedup
+ * is given, only elements it returns true for are deduplicated and all
+ * others are kept as is.
+ *
+ * Short arrays are scanned linearly, which avoids clearing a hash set that
+ * may have grown large.
+ */
+void
+obj_array_dedup_filtered(struct workspace *wk, obj arr, obj *res, obj_array_dedup_filter should_dedup)
 {
-	hash_clear(&wk->vm.objects.obj_hash);
+	struct hash *set = &wk->vm.objects.dedup_hash;
+	const bool linear = get_obj_array(wk, arr)->len <= 16;
+	obj v;
 
 	make_obj(wk, res, obj_array);
-	obj_array_foreach(wk, arr, res, obj_array_dedup_iter);
+
+	if (!linear) {
+		hash_clear(set);
+	}
+
+	obj_array_for(wk, arr, v) {
+		if (!should_dedup || should_dedup(wk, v)) {
+			if (linear) {
+				if (obj_array_in(wk, *res, v)) {
+					continue;
+				}
+			} else {
+				struct obj_dedup_key key = { .wk = wk, .o = v };
+
+				if (hash_get(set, &key)) {
+					continue;
+				}
+
+				hash_set(set, &key, true);
+			}
+		}
+
+		obj_array_push(wk, *res, v);
+	}
+}
+
+void
+obj_array_dedup(struct workspace *wk, obj arr, obj *res)
+{
+	obj_array_dedup_filtered(wk, arr, res, 0);
 }
 
 void
@@ -1251,6 +1332,13 @@ static bool
 obj_dict_key_comparison_func_string(struct workspace *wk, union obj_dict_key_comparison_key *key, obj other)
 {
 	const struct str *ss_a = get_str(wk, other);
+
+	// If the key was taken from an interned string object, and the other
+	// key is interned too, they are equal only if they are the same object
+	if (ss_a->flags & key->string.flags & str_flag_interned) {
+		return ss_a->s == key->string.s;
+	}
+
 	return str_eql(ss_a, &key->string);
 }
 
@@ -1306,11 +1394,11 @@ _obj_dict_index(struct workspace *wk,
 	return false;
 }
 
-obj *
-obj_dict_index_strn_pointer(struct workspace *wk, obj dict, const char *str, uint32_t len)
+static obj *
+obj_dict_index_str_pointer(struct workspace *wk, obj dict, const struct str *ss)
 {
 	obj *r = 0;
-	union obj_dict_key_comparison_key key = { .string = { .s = str, .len = len } };
+	union obj_dict_key_comparison_key key = { .string = *ss };
 
 	if (!_obj_dict_index(wk, dict, &key, obj_dict_key_comparison_func_string, &r)) {
 		return 0;
@@ -1319,6 +1407,12 @@ obj_dict_index_strn_pointer(struct workspace *wk, obj dict, const char *str, uin
 	return r;
 }
 
+obj *
+obj_dict_index_strn_pointer(struct workspace *wk, obj dict, const char *str, uint32_t len)
+{
+	return obj_dict_index_str_pointer(wk, dict, &(struct str){ .s = str, .len = len });
+}
+
 bool
 obj_dict_index_strn(struct workspace *wk, obj dict, const char *str, uint32_t len, obj *res)
 {
@@ -1339,8 +1433,12 @@ obj_dict_index_str(struct workspace *wk, obj dict, const char *str, obj *res)
 bool
 obj_dict_index(struct workspace *wk, obj dict, obj key, obj *res)
 {
-	const struct str *k = get_str(wk, key);
-	return obj_dict_index_strn(wk, dict, k->s, k->len, res);
+	obj *r = obj_dict_index_str_pointer(wk, dict, get_str(wk, key));
+	if (r) {
+		*res = *r;
+		return true;
+	}
+	return false;
 }
 
 bool
@@ -548,14 +548,14 @@ parse_fstring(struct parser *p, bool assignment_allowed)
 
 				if (str.len) {
 					lhs = make_node_t(p, node_type_string);
-					lhs->data.str = make_strn(p->wk, str.s, str.len);
+					lhs->data.str = make_strn_interned(p->wk, str.s, str.len);
 				} else {
 					lhs = 0;
 				}
 
 				rhs = make_node_t(p, node_type_stringify);
 				rhs->l = make_node_t(p, node_type_id);
-				rhs->l->data.str = make_strn(p->wk, identifier.s, identifier.len);
+				rhs->l->data.str = make_strn_interned(p->wk, identifier.s, identifier.len);
 
 				if (lhs) {
 					if (!n) {
@@ -618,7 +618,7 @@ parse_fstring(struct parser *p, bool assignment_allowed)
 			n->l = prev_rhs;
 			n = n->r = make_node_t(p, node_type_string);
 		}
-		n->data.str = make_strn(p->wk, str.s, str.len);
+		n->data.str = make_strn_interned(p->wk, str.s, str.len);
 	}
 
 	return res;
@@ -0,0 +1,294 @@
+/*
+ * SPDX-FileCopyrightText: Stone Tickle <lattis@mochiro.moe>
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#include "compat.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "error.h"
+#include "lang/profile.h"
+#include "lang/vm.h"
+#include "lang/workspace.h"
+#include "log.h"
+#include "platform/filesystem.h"
+#include "platform/mem.h"
+#include "platform/path.h"
+#include "platform/run_cmd.h"
+#include "platform/timer.h"
+
+/*
+ * An instrumenting profiler for evaluation.  A frame is pushed for every
+ * evaluated file, user function call, and native function call, and frames
+ * are merged into a call tree by call site.  Between two events, wall time,
+ * the number of objects created, and the cpu time of reaped child processes
+ * are charged to the frame on top of the stack.
+ */
+
+struct profile_node_key {
+	uint32_t parent, type, ip, id;
+};
+
+struct profile_node {
+	struct profile_node_key key;
+	const char *name;
+	uint32_t calls;
+	uint64_t objects;
+	double time, child_cpu_time;
+};
+
+struct profile {
+	struct arr nodes;
+	struct hash node_hash;
+	struct timer timer;
+	uint32_t cur;
+	uint64_t objects;
+	double child_cpu_time;
+};
+
+void
+profile_init(struct workspace *wk)
+{
+	struct profile *p;
+
+	if (wk->vm.profile) {
+		return;
+	}
+
+	p = z_calloc(1, sizeof(struct profile));
+	arr_init(&p->nodes, 256, sizeof(struct profile_node));
+	hash_init(&p->node_hash, 256, sizeof(struct profile_node_key));
+
+	arr_push(&p->nodes, &(struct profile_node){ .key = { .type = profile_frame_root }, .calls = 1 });
+
+	p->objects = wk->vm.objects.objs.len;
+	p->child_cpu_time = run_cmd_children_cpu_time();
+	timer_start(&p->timer);
+
+	wk->vm.profile = p;
+}
+
+void
+profile_destroy(struct workspace *wk)
+{
+	struct profile *p = wk->vm.profile;
+
+	if (!p) {
+		return;
+	}
+
+	arr_destroy(&p->nodes);
+	hash_destroy(&p->node_hash);
+	z_free(p);
+	wk->vm.profile = 0;
+}
+
+static void
+profile_charge(struct workspace *wk, struct profile *p)
+{
+	struct profile_node *n = arr_get(&p->nodes, p->cur);
+	double child_cpu_time = run_cmd_children_cpu_time();
+
+	n->time += timer_read(&p->timer);
+	timer_start(&p->timer);
+
+	n->objects += wk->vm.objects.objs.len - p->objects;
+	p->objects = wk->vm.objects.objs.len;
+
+	n->child_cpu_time += child_cpu_time - p->child_cpu_time;
+	p->child_cpu_time = child_cpu_time;
+}
+
+void
+profile_push(struct workspace *wk, enum profile_frame_type type, uint32_t ip, uint32_t id, const char *name)
+{
+	struct profile *p = wk->vm.profile;
+	struct profile_node_key key = { .parent = p->cur, .type = type, .ip = ip, .id = id };
+	uint64_t *idx;
+
+	profile_charge(wk, p);
+
+	if ((idx = hash_get(&p->node_hash, &key))) {
+		p->cur = *idx;
+	} else {
+		p->cur = arr_push(&p->nodes, &(struct profile_node){ .key = key, .name = name });
+		hash_set(&p->node_hash, &key, p->cur);
+	}
+
+	++((struct profile_node *)arr_get(&p->nodes, p->cur))->calls;
+}
+
+void
+profile_pop(struct workspace *wk)
+{
+	struct profile *p = wk->vm.profile;
+
+	profile_charge(wk, p);
+	p->cur = ((struct profile_node *)arr_get(&p->nodes, p->cur))->key.parent;
+}
+
+/******************************************************************************
+ * output
+ ******************************************************************************/
+
+struct profile_summary_entry {
+	obj label;
+	uint32_t calls;
+	uint64_t objects;
+	double time, self_time, child_cpu_time;
+};
+
+static void
+profile_push_source_label(struct workspace *wk, struct sbuf *buf, const struct source *src)
+{
+	if (src->type == source_type_embedded) {
+		sbuf_pushf(wk, buf, "[embedded] %s", src->label);
+	} else if (wk->source_root && path_is_absolute(src->label)) {
+		SBUF(rel);
+		path_relative_to(wk, &rel, wk->source_root, src->label);
+		sbuf_pushn(wk, buf, rel.buf, rel.len);
+	} else {
+		sbuf_pushs(wk, buf, src->label);
+	}
+}
+
+static obj
+profile_node_label(struct workspace *wk, const struct profile_node *n)
+{
+	SBUF(buf);
+
+	switch ((enum profile_frame_type)n->key.type) {
+	case profile_frame_root: sbuf_pushs(wk, &buf, "setup"); break;
+	case profile_frame_eval: profile_push_source_label(wk, &buf, arr_get(&wk->vm.src, n->key.id)); break;
+	case profile_frame_func:
+	case profile_frame_native: {
+		struct source_location loc;
+		struct source *src;
+		struct detailed_source_location dloc;
+
+		sbuf_pushf(wk, &buf, "%s (", n->name ? n->name : "<func>");
+
+		vm_lookup_inst_location(&wk->vm, n->key.ip, &loc, &src);
+		if (src->label) {
+			get_detailed_source_location(src, loc, &dloc, 0);
+			profile_push_source_label(wk, &buf, src);
+			sbuf_pushf(wk, &buf, ":%d)", dloc.line);
+		} else {
+			sbuf_pushs(wk, &buf, "<native>)");
+		}
+		break;
+	}
+	}
+
+	return sbuf_into_str(wk, &buf);
+}
+
+static int32_t
+profile_summary_entry_compare(const void *_a, const void *_b, void *_ctx)
+{
+	const struct profile_summary_entry *a = _a, *b = _b;
+	return a->time < b->time ? 1 : a->time > b->time ? -1 : 0;
+}
+
+bool
+profile_write(struct workspace *wk, const char *path)
+{
+	struct profile *p = wk->vm.profile;
+	struct profile_summary_entry *e;
+	struct profile_node *n;
+	struct arr summary;
+	struct hash summary_hash;
+	uint32_t i, len;
+	uint64_t *idx;
+	bool res;
+	obj *stacks, *labels;
+	double *totals;
+	SBUF_manual(buf);
+
+	profile_charge(wk, p);
+
+	len = p->nodes.len;
+	labels = z_calloc(len, sizeof(obj));
+	stacks = z_calloc(len, sizeof(obj));
+	totals = z_calloc(len * 3, sizeof(double));
+
+	// parents are always created before their children, so the folded stack
+	// of a node can be built from its parent's
+	for (i = 0; i < len; ++i) {
+		n = arr_get(&p->nodes, i);
+		labels[i] = profile_node_label(wk, n);
+		if (i) {
+			stacks[i] = make_strf(
+				wk, "%s;%s", get_cstr(wk, stacks[n->key.parent]), get_cstr(wk, labels[i]));
+		} else {
+			stacks[i] = labels[i];
+		}
+
+		totals[i * 3] = n->time;
+		totals[i * 3 + 1] = n->objects;
+		totals[i * 3 + 2] = n->child_cpu_time;
+
+		if ((uint64_t)(n->time * 1e6) > 0) {
+			sbuf_pushf(wk, &buf, "%s %" PRIu64 "\n", get_cstr(wk, stacks[i]), (uint64_t)(n->time * 1e6));
+		}
+	}
+
+	res = fs_write(path, (const uint8_t *)buf.buf, buf.len);
+
+	for (i = len - 1; i > 0; --i) {
+		n = arr_get(&p->nodes, i);
+		totals[n->key.parent * 3] += totals[i * 3];
+		totals[n->key.parent * 3 + 1] += totals[i * 3 + 1];
+		totals[n->key.parent * 3 + 2] += totals[i * 3 + 2];
+	}
+
+	// merge nodes with the same label, e.g. a function called from
+	// several places, for the summary
+	arr_init(&summary, 64, sizeof(struct profile_summary_entry));
+	hash_init_str(&summary_hash, 64);
+	for (i = 1; i < len; ++i) {
+		const struct str *label = get_str(wk, labels[i]);
+		n = arr_get(&p->nodes, i);
+
+		if ((idx = hash_get_strn(&summary_hash, label->s, label->len))) {
+			e = arr_get(&summary, *idx);
+		} else {
+			hash_set_strn(&summary_hash,
+				label->s,
+				label->len,
+				arr_push(&summary, &(struct profile_summary_entry){ .label = labels[i] }));
+			e = arr_get(&summary, summary.len - 1);
+		}
+
+		e->calls += n->calls;
+		e->self_time += n->time;
+		e->time += totals[i * 3];
+		e->objects += (uint64_t)totals[i * 3 + 1];
+		e->child_cpu_time += totals[i * 3 + 2];
+	}
+
+	arr_sort(&summary, NULL, profile_summary_entry_compare);
+
+	LOG_I("wrote profile to %s, %.3fs total", path, totals[0]);
+	LOG_I("%9s %9s %8s %9s %9s  %s", "total", "self", "calls", "objects", "child cpu", "frame");
+	for (i = 0; i < summary.len && i < 20; ++i) {
+		e = arr_get(&summary, i);
+		LOG_I("%8.3fs %8.3fs %8d %9" PRIu64 " %8.3fs  %s",
+			e->time,
+			e->self_time,
+			e->calls,
+			e->objects,
+			e->child_cpu_time,
+			get_cstr(wk, e->label));
+	}
+
+	arr_destroy(&summary);
+	hash_destroy(&summary_hash);
+	z_free(labels);
+	z_free(stacks);
+	z_free(totals);
+	sbuf_destroy(&buf);
+	return res;
+}
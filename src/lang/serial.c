@@ -284,9 +284,12 @@ dump_objs(struct workspace *wk, struct arr *big_string_offsets, FILE *f)
 			const struct str *ss
 				= bucket_arr_get(&wk->vm.objects.obj_aos[obj_string - _obj_aos_start], o->val);
 
+			// A loaded string's buffer is always exactly sized, so it
+			// can't keep str_flag_unique, and it isn't in the intern
+			// table of the loading workspace
 			ser_s = (struct serial_str){
 				.len = ss->len,
-				.flags = ss->flags,
+				.flags = ss->flags & ~(str_flag_unique | str_flag_interned),
 			};
 
 			if (ss->flags & str_flag_big) {
@@ -141,8 +141,14 @@ grow_str(struct workspace *wk, obj *s, uint32_t grow_by, bool alloc_nul)
 
 #define SMALL_STR_LEN 64
 
+/*
+ * Short immutable strings are interned, as are compile-time constants of any
+ * length (see make_strn_interned()), as long as no clear mark is set.  Two
+ * strings that both have str_flag_interned are equal only if they are the
+ * same object.
+ */
 static obj
-_make_str(struct workspace *wk, const char *p, uint32_t len, bool mutable)
+_make_str(struct workspace *wk, const char *p, uint32_t len, bool mutable, bool intern)
 {
 	obj s;
 
@@ -150,8 +156,10 @@ _make_str(struct workspace *wk, const char *p, uint32_t len, bool mutable)
 		return 0;
 	}
 
+	intern = !mutable && (intern || len <= SMALL_STR_LEN);
+
 	uint64_t *v;
-	if (!mutable && len <= SMALL_STR_LEN && (v = hash_get_strn(&wk->vm.objects.str_hash, p, len))) {
+	if (intern && (v = hash_get_strn(&wk->vm.objects.str_hash, p, len))) {
 		s = *v;
 		return s;
 	}
@@ -161,8 +169,9 @@ _make_str(struct workspace *wk, const char *p, uint32_t len, bool mutable)
 
 	if (mutable) {
 		str->flags |= str_flag_mutable;
-	} else if (!wk->vm.objects.obj_clear_mark_set && len <= SMALL_STR_LEN) {
+	} else if (intern && !wk->vm.objects.obj_clear_mark_set) {
 		hash_set_strn(&wk->vm.objects.str_hash, str->s, str->len, s);
+		str->flags |= str_flag_interned;
 	}
 	return s;
 }
@@ -170,13 +179,31 @@ _make_str(struct workspace *wk, const char *p, uint32_t len, bool mutable)
 obj
 make_strn(struct workspace *wk, const char *str, uint32_t n)
 {
-	return _make_str(wk, str, n, false);
+	return _make_str(wk, str, n, false, false);
 }
 
 obj
 make_str(struct workspace *wk, const char *str)
 {
-	return _make_str(wk, str, strlen(str), false);
+	return _make_str(wk, str, strlen(str), false, false);
+}
+
+obj
+make_strn_interned(struct workspace *wk, const char *str, uint32_t n)
+{
+	return _make_str(wk, str, n, false, true);
+}
+
+obj
+str_intern(struct workspace *wk, obj s)
+{
+	const struct str *ss = get_str(wk, s);
+
+	if (ss->flags & str_flag_interned) {
+		return s;
+	}
+
+	return _make_str(wk, ss->s, ss->len, false, true);
 }
 
 obj
@@ -227,6 +254,54 @@ str_apps(struct workspace *wk, obj *s, obj s_id)
 	str_appn(wk, s, str->s, str->len);
 }
 
+static uint32_t
+str_unique_cap(uint32_t len)
+{
+	uint32_t cap = 64;
+	while (cap < len) {
+		if (cap > UINT32_MAX / 2) {
+			return len;
+		}
+		cap *= 2;
+	}
+	return cap;
+}
+
+/*
+ * Append to a string flagged with str_flag_unique in place.  The first append
+ * moves the string to a heap buffer, which from then on is always sized with
+ * str_unique_cap(), so the capacity doesn't need to be stored and repeated
+ * appends take amortized linear time.
+ */
+void
+str_apps_unique(struct workspace *wk, obj s, obj s_id)
+{
+	struct str *ss = (struct str *)get_str(wk, s);
+	const struct str *str = get_str(wk, s_id);
+	uint32_t new_len = ss->len + str->len + 1;
+	char *p;
+
+	assert(ss->flags & str_flag_unique);
+	assert(s != s_id);
+
+	if (!(ss->flags & str_flag_mutable)) {
+		p = z_malloc(str_unique_cap(new_len));
+		memcpy(p, ss->s, ss->len);
+		if (ss->flags & str_flag_big) {
+			z_free((void *)ss->s);
+		}
+		ss->s = p;
+		ss->flags |= str_flag_big | str_flag_mutable;
+	} else if (new_len > str_unique_cap(ss->len + 1)) {
+		ss->s = z_realloc((void *)ss->s, str_unique_cap(new_len));
+	}
+
+	p = (char *)ss->s;
+	memcpy(&p[ss->len], str->s, str->len);
+	ss->len += str->len;
+	p[ss->len] = 0;
+}
+
 void
 str_app(struct workspace *wk, obj *s, const char *str)
 {
@@ -258,20 +333,20 @@ obj
 str_clone_mutable(struct workspace *wk, obj val)
 {
 	const struct str *ss = get_str(wk, val);
-	return _make_str(wk, ss->s, ss->len, true);
+	return _make_str(wk, ss->s, ss->len, true, false);
 }
 
 obj
 str_clone(struct workspace *wk_src, struct workspace *wk_dest, obj val)
 {
 	const struct str *ss = get_str(wk_src, val);
-	return _make_str(wk_dest, ss->s, ss->len, false);
+	return _make_str(wk_dest, ss->s, ss->len, false, false);
 }
 
 bool
 str_eql(const struct str *ss1, const struct str *ss2)
 {
-	return ss1->len == ss2->len && memcmp(ss1->s, ss2->s, ss1->len) == 0;
+	return ss1->len == ss2->len && (ss1->s == ss2->s || memcmp(ss1->s, ss2->s, ss1->len) == 0);
 }
 
 static bool
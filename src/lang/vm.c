@@ -16,6 +16,7 @@
 #include "lang/func_lookup.h"
 #include "lang/object_iterators.h"
 #include "lang/parser.h"
+#include "lang/profile.h"
 #include "lang/typecheck.h"
 #include "lang/vm.h"
 #include "lang/workspace.h"
@@ -37,6 +38,7 @@ const uint32_t op_operands[op_count] = {
 	[op_call] = 2,
 	[op_member] = 1,
 	[op_call_native] = 3,
+	[op_call_native_kw] = 4,
 	[op_jmp_if_true] = 1,
 	[op_jmp_if_false] = 1,
 	[op_jmp_if_disabler] = 1,
@@ -44,6 +46,11 @@ const uint32_t op_operands[op_count] = {
 	[op_jmp] = 1,
 	[op_typecheck] = 1,
 	[op_az_branch] = 3,
+	[op_constant_load] = 1,
+	[op_constant_store] = 2,
+	[op_call_member] = 3,
+	[op_iterator_keys] = 1,
+	[op_iterator_concat] = 1,
 };
 const uint32_t op_operand_size = 3;
 
@@ -343,14 +350,38 @@ vm_function_arg_type_error(struct workspace *wk, uint32_t ip, obj obj_id, type_t
 		name ? name : "");
 }
 
+/*
+ * Whether val is accepted as is by a plain (not listify or complex) type,
+ * which is the common case for arguments.  Anything this doesn't accept goes
+ * through the full check, which also handles disablers, typeinfo, and
+ * unpacking a single file from an array.
+ */
+static inline bool
+vm_function_arg_type_matches(enum obj_type t, type_tag type)
+{
+	if (!(type & obj_typechecking_type_tag)) {
+		return t == type;
+	} else if (type & (TYPE_TAG_LISTIFY | TYPE_TAG_COMPLEX)) {
+		return false;
+	} else if (!t || t == obj_typeinfo || (t == obj_array && (type & tc_file) == tc_file)) {
+		return false;
+	}
+
+	return (type & obj_type_to_tc_type(t) & ~TYPE_TAG_MASK) != 0;
+}
+
 static bool
 typecheck_and_mutate_function_arg(struct workspace *wk, uint32_t ip, obj *val, type_tag type, const char *name)
 {
+	enum obj_type t = get_obj_type(wk, *val);
+
+	if (vm_function_arg_type_matches(t, type)) {
+		return true;
+	}
+
 	bool listify = (type & TYPE_TAG_LISTIFY) == TYPE_TAG_LISTIFY;
 	type &= ~TYPE_TAG_LISTIFY;
 
-	enum obj_type t = get_obj_type(wk, *val);
-
 	// If obj_file or tc_file is requested, and the argument is an array of
 	// length 1, try to unpack it.
 	if (!listify && (type == obj_file || (type & tc_file) == tc_file)) {
@@ -427,13 +458,28 @@ typecheck_and_mutate_function_arg(struct workspace *wk, uint32_t ip, obj *val, t
 }
 
 static bool
-handle_kwarg(struct workspace *wk, struct args_kw akw[], const char *kw, uint32_t kw_ip, obj v, uint32_t v_ip)
+handle_kwarg(struct workspace *wk,
+	struct args_kw akw[],
+	uint32_t akw_len,
+	struct vm_kwarg_cache_entry *cache,
+	const char *kw,
+	uint32_t kw_ip,
+	obj v,
+	uint32_t v_ip)
 {
 	uint32_t i;
 
-	for (i = 0; akw[i].key; ++i) {
-		if (strcmp(kw, akw[i].key) == 0) {
-			break;
+	if (cache && cache->key && cache->slot < akw_len && akw[cache->slot].key == cache->key) {
+		i = cache->slot;
+	} else {
+		for (i = 0; akw[i].key; ++i) {
+			if (strcmp(kw, akw[i].key) == 0) {
+				break;
+			}
+		}
+
+		if (cache && akw[i].key) {
+			*cache = (struct vm_kwarg_cache_entry){ .key = akw[i].key, .slot = i };
 		}
 	}
 
@@ -460,9 +506,12 @@ vm_pop_args(struct workspace *wk, struct args_norm an[], struct args_kw akw[])
 {
 	const char *kw;
 	struct obj_stack_entry *entry;
-	uint32_t i, j, argi;
+	uint32_t i, j, argi, akw_len = 0;
 	uint32_t args_popped = 0;
 	bool got_kwargs_typeinfo = false;
+	uint32_t kwarg_cache_base = wk->vm.kwarg_cache_base;
+
+	wk->vm.kwarg_cache_base = UINT32_MAX;
 
 	if (wk->vm.dbg_state.dump_signature) {
 		dump_function_signature(wk, an, akw);
@@ -473,6 +522,7 @@ vm_pop_args(struct workspace *wk, struct args_norm an[], struct args_kw akw[])
 		for (i = 0; akw[i].key; ++i) {
 			akw[i].set = false;
 		}
+		akw_len = i;
 	} else if (wk->vm.nkwargs) {
 		vm_error(wk, "this function does not accept kwargs");
 		goto err;
@@ -503,16 +553,21 @@ vm_pop_args(struct workspace *wk, struct args_norm an[], struct args_kw akw[])
 
 			obj k, v;
 			obj_dict_for(wk, entry->o, k, v) {
-				if (!handle_kwarg(wk, akw, get_cstr(wk, k), entry->ip, v, entry->ip)) {
+				if (!handle_kwarg(wk, akw, akw_len, 0, get_cstr(wk, k), entry->ip, v, entry->ip)) {
 					goto err;
 				}
 				wk->vm.saw_disabler |= v == obj_disabler;
 			}
 		} else {
 			uint32_t kw_ip = entry->ip;
+			struct vm_kwarg_cache_entry *cache = 0;
+			if (kwarg_cache_base != UINT32_MAX) {
+				cache = arr_get(&wk->vm.kwarg_cache, kwarg_cache_base + i);
+			}
+
 			entry = object_stack_pop_entry(&wk->vm.stack);
 			++args_popped;
-			if (!handle_kwarg(wk, akw, kw, kw_ip, entry->o, entry->ip)) {
+			if (!handle_kwarg(wk, akw, akw_len, cache, kw, kw_ip, entry->o, entry->ip)) {
 				goto err;
 			}
 			wk->vm.saw_disabler |= entry->o == obj_disabler;
@@ -662,7 +717,7 @@ vm_dis_inst(struct workspace *wk, uint8_t *code, uint32_t base_ip)
 	uint32_t ip = base_ip;
 	buf_push("%04x ", ip);
 
-	uint32_t op = code[ip], constants[3];
+	uint32_t op = code[ip], constants[4];
 	{
 		++ip;
 		uint32_t j;
@@ -684,7 +739,9 @@ vm_dis_inst(struct workspace *wk, uint8_t *code, uint32_t base_ip)
 	op_case(op_div) break;
 	op_case(op_mod) break;
 	op_case(op_eq) break;
+	op_case(op_neq) break;
 	op_case(op_in) break;
+	op_case(op_not_in) break;
 	op_case(op_gt) break;
 	op_case(op_lt) break;
 	op_case(op_not) break;
@@ -737,6 +794,12 @@ vm_dis_inst(struct workspace *wk, uint8_t *code, uint32_t base_ip)
 		uint32_t id = constants[2];
 		buf_push("%s", native_funcs[id].name);
 		break;
+	op_case(op_call_native_kw)
+		buf_push(":");
+		buf_push("%d,%d,", constants[0], constants[1]);
+		buf_push("%s", native_funcs[constants[2]].name);
+		buf_push(",kw_cache:%d", constants[3]);
+		break;
 	op_case(op_jmp_if_true)
 		buf_push(":%04x", constants[0]);
 		break;
@@ -755,6 +818,21 @@ vm_dis_inst(struct workspace *wk, uint8_t *code, uint32_t base_ip)
 	op_case(op_typecheck)
 		buf_push(":%s", obj_type_to_s(constants[0]));
 		break;
+	op_case(op_constant_load)
+		buf_push(":%o", constants[0]);
+		break;
+	op_case(op_constant_store)
+		buf_push(":%o:%04x", constants[0], constants[1]);
+		break;
+	op_case(op_call_member)
+		buf_push(":%o:%d,%d", constants[0], constants[1], constants[2]);
+		break;
+	op_case(op_iterator_keys)
+		buf_push(":%04x", constants[0]);
+		break;
+	op_case(op_iterator_concat)
+		buf_push(":%04x", constants[0]);
+		break;
 
 	op_case(op_az_branch)
 		buf_push(":%d", constants[0]);
@@ -836,6 +914,14 @@ vm_execute_capture(struct workspace *wk, obj a)
 			.lang_mode = wk->vm.lang_mode,
 		});
 
+	if (wk->vm.profile) {
+		profile_push(wk,
+			profile_frame_func,
+			wk->vm.ip ? wk->vm.ip - 1 : 0,
+			capture->func->entry,
+			capture->func->name);
+	}
+
 	wk->vm.lang_mode = capture->func->lang_mode;
 
 	wk->vm.scope_stack = capture->scope_stack;
@@ -882,7 +968,13 @@ vm_execute_native(struct workspace *wk, uint32_t func_idx, obj self)
 		TracyCZoneName(tctx_func, func_name, strlen(func_name));
 #endif
 
-		ok = wk->vm.behavior.native_func_dispatch(wk, func_idx, self, &res);
+		if (wk->vm.profile) {
+			profile_push(wk, profile_frame_native, wk->vm.ip - 1, func_idx, native_funcs[func_idx].name);
+			ok = wk->vm.behavior.native_func_dispatch(wk, func_idx, self, &res);
+			profile_pop(wk);
+		} else {
+			ok = wk->vm.behavior.native_func_dispatch(wk, func_idx, self, &res);
+		}
 
 		TracyCZoneEnd(tctx_func);
 	}
@@ -1330,6 +1422,36 @@ vm_op_eq(struct workspace *wk)
 	object_stack_push(wk, res);
 }
 
+/*
+ * Invert the boolean on top of the stack, leaving typeinfo, disablers, and
+ * the dummy values pushed after errors alone.
+ */
+static void
+vm_invert_bool_result(struct workspace *wk)
+{
+	struct obj_stack_entry *res = object_stack_peek_entry(&wk->vm.stack, 1);
+
+	if (res->o == obj_bool_true) {
+		res->o = obj_bool_false;
+	} else if (res->o == obj_bool_false) {
+		res->o = obj_bool_true;
+	}
+}
+
+static void
+vm_op_neq(struct workspace *wk)
+{
+	vm_op_eq(wk);
+	vm_invert_bool_result(wk);
+}
+
+static void
+vm_op_not_in(struct workspace *wk)
+{
+	vm_op_in(wk);
+	vm_invert_bool_result(wk);
+}
+
 static void
 vm_op_not(struct workspace *wk)
 {
@@ -1482,6 +1604,8 @@ type_err:
 	return false;
 }
 
+static bool vm_get_local_variable(struct workspace *wk, const char *name, obj *res, obj *scope);
+
 static void
 vm_op_store(struct workspace *wk)
 {
@@ -1517,11 +1641,26 @@ vm_op_store(struct workspace *wk)
 	}
 
 	if (flags & op_store_flag_add_store) {
-		obj source;
+		obj source, _scope;
 		const struct str *id_str = 0;
 
+		/*
+		 * A string built up with += in a statement is only referenced
+		 * by its variable, since every read of a variable goes through
+		 * vm_get_variable() which clears str_flag_unique.  Such a
+		 * string can be appended to in place.
+		 */
+		bool unique_str = !member_target && !wk->vm.in_analyzer && wk->vm.code.e[wk->vm.ip] == op_pop;
+
 		if (member_target) {
 			source = *member_target;
+		} else if (unique_str) {
+			id_str = get_str(wk, id);
+			if (!vm_get_local_variable(wk, id_str->s, &source, &_scope)) {
+				vm_error(wk, "undefined object %o", id);
+				vm_push_dummy(wk);
+				return;
+			}
 		} else {
 			id_str = get_str(wk, id);
 			if (!wk->vm.behavior.get_variable(wk, id_str->s, &source)) {
@@ -1548,8 +1687,16 @@ vm_op_store(struct workspace *wk)
 			assign = true;
 			typecheck_operand(val, val_t, obj_string, tc_string, tc_string);
 
-			// TODO: could use str_appn, but would have to dup on store
-			res = str_join(wk, source, val);
+			if (unique_str && (get_str(wk, source)->flags & str_flag_unique)) {
+				str_apps_unique(wk, source, val);
+				res = source;
+				assign = false;
+			} else {
+				res = str_join(wk, source, val);
+				if (unique_str) {
+					((struct str *)get_str(wk, res))->flags |= str_flag_unique;
+				}
+			}
 			break;
 		}
 		case obj_array: {
@@ -1877,6 +2024,69 @@ vm_op_call_native(struct workspace *wk)
 	vm_execute_native(wk, idx, 0);
 }
 
+static void
+vm_op_call_native_kw(struct workspace *wk)
+{
+	wk->vm.nargs = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+	wk->vm.nkwargs = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+
+	uint32_t idx = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+	wk->vm.kwarg_cache_base = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+	vm_execute_native(wk, idx, 0);
+	wk->vm.kwarg_cache_base = UINT32_MAX;
+}
+
+/*
+ * Superinstructions.  Each one behaves exactly like the sequence of ops it
+ * replaces, whose operands it stores in the same order, but only costs a
+ * single dispatch.
+ */
+static void
+vm_op_constant_load(struct workspace *wk)
+{
+	vm_op_constant(wk);
+	vm_op_load(wk);
+}
+
+static void
+vm_op_constant_store(struct workspace *wk)
+{
+	vm_op_constant(wk);
+	vm_op_store(wk);
+}
+
+static void
+vm_op_call_member(struct workspace *wk)
+{
+	uint32_t end = wk->vm.ip + OP_WIDTH(op_call_member) - 1;
+
+	vm_op_member(wk);
+
+	if (!wk->vm.run) {
+		wk->vm.ip = end;
+		return;
+	}
+
+	vm_op_call(wk);
+}
+
+static void
+vm_iterator_init_dict(struct workspace *wk, struct obj_iterator *iterator, obj dict, uint32_t len)
+{
+	struct obj_dict *d = get_obj_dict(wk, dict);
+	if (d->flags & obj_dict_flag_big) {
+		iterator->type = obj_iterator_type_dict_big;
+		iterator->data.dict_big.h = bucket_arr_get(&wk->vm.objects.dict_hashes, d->data);
+		iterator->data.dict_big.len = len;
+	} else {
+		iterator->type = obj_iterator_type_dict_small;
+		iterator->data.dict_small.len = len;
+		if (d->len) {
+			iterator->data.dict_small.elem = bucket_arr_get(&wk->vm.objects.dict_elems, d->data);
+		}
+	}
+}
+
 static void
 vm_op_iterator(struct workspace *wk)
 {
@@ -1916,18 +2126,7 @@ vm_op_iterator(struct workspace *wk)
 
 		make_obj(wk, &iter, obj_iterator);
 		object_stack_push(wk, iter);
-		iterator = get_obj_iterator(wk, iter);
-
-		struct obj_dict *d = get_obj_dict(wk, a);
-		if (d->flags & obj_dict_flag_big) {
-			iterator->type = obj_iterator_type_dict_big;
-			iterator->data.dict_big.h = bucket_arr_get(&wk->vm.objects.dict_hashes, d->data);
-		} else {
-			iterator->type = obj_iterator_type_dict_small;
-			if (d->len) {
-				iterator->data.dict_small = bucket_arr_get(&wk->vm.objects.dict_elems, d->data);
-			}
-		}
+		vm_iterator_init_dict(wk, get_obj_iterator(wk, iter), a, UINT32_MAX);
 		break;
 	}
 	case obj_iterator: {
@@ -2026,23 +2225,42 @@ vm_op_iterator_next(struct workspace *wk)
 			iterator->data.range.i += iterator->data.range.step;
 		}
 		break;
+	case obj_iterator_type_array_concat:
+		if (!iterator->data.array_concat.len) {
+			if (!iterator->data.array_concat.next_len) {
+				should_break = true;
+				break;
+			}
+
+			iterator->data.array_concat.array = get_obj_array(wk, iterator->data.array_concat.next);
+			iterator->data.array_concat.len = iterator->data.array_concat.next_len;
+			iterator->data.array_concat.next_len = 0;
+		}
+
+		val = iterator->data.array_concat.array->val;
+		if (--iterator->data.array_concat.len) {
+			iterator->data.array_concat.array = get_obj_array(wk, iterator->data.array_concat.array->next);
+		}
+		break;
 	case obj_iterator_type_dict_small:
-		if (!iterator->data.dict_small) {
+		if (!iterator->data.dict_small.elem || !iterator->data.dict_small.len) {
 			should_break = true;
 		} else {
 			push_key = true;
-			key = iterator->data.dict_small->key;
-			val = iterator->data.dict_small->val;
-			if (iterator->data.dict_small->next) {
-				iterator->data.dict_small
-					= bucket_arr_get(&wk->vm.objects.dict_elems, iterator->data.dict_small->next);
+			key = iterator->data.dict_small.elem->key;
+			val = iterator->data.dict_small.elem->val;
+			--iterator->data.dict_small.len;
+			if (iterator->data.dict_small.elem->next) {
+				iterator->data.dict_small.elem
+					= bucket_arr_get(&wk->vm.objects.dict_elems, iterator->data.dict_small.elem->next);
 			} else {
-				iterator->data.dict_small = 0;
+				iterator->data.dict_small.elem = 0;
 			}
 		}
 		break;
 	case obj_iterator_type_dict_big:
-		if (iterator->data.dict_big.i >= iterator->data.dict_big.h->keys.len) {
+		if (iterator->data.dict_big.i >= iterator->data.dict_big.h->keys.len
+			|| iterator->data.dict_big.i >= iterator->data.dict_big.len) {
 			should_break = true;
 		} else {
 			push_key = true;
@@ -2087,12 +2305,82 @@ vm_op_iterator_next(struct workspace *wk)
 		return;
 	}
 
+	if (iterator->keys_only) {
+		object_stack_push(wk, key);
+		return;
+	}
+
 	object_stack_push(wk, val);
 	if (push_key) {
 		object_stack_push(wk, key);
 	}
 }
 
+/*
+ * Guarded forms of `foreach x : d.keys()` and `foreach x : a + b` that iterate
+ * over their operands directly instead of first building an array.  If the
+ * operands have the expected types, the iterator is pushed and execution
+ * continues at the operand ip, otherwise execution falls through to the
+ * unfused instructions that follow.
+ */
+static void
+vm_op_iterator_keys(struct workspace *wk)
+{
+	obj d, iter;
+	struct obj_iterator *iterator;
+	uint32_t end = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+
+	d = object_stack_peek(&wk->vm.stack, 1);
+	if (get_obj_type(wk, d) != obj_dict) {
+		return;
+	}
+
+	object_stack_pop(&wk->vm.stack);
+
+	make_obj(wk, &iter, obj_iterator);
+	object_stack_push(wk, iter);
+	iterator = get_obj_iterator(wk, iter);
+	// Snapshot the length so that keys added inside the loop aren't
+	// visited, just like the array returned by keys()
+	vm_iterator_init_dict(wk, iterator, d, get_obj_dict(wk, d)->len);
+	iterator->keys_only = true;
+
+	wk->vm.ip = end;
+}
+
+static void
+vm_op_iterator_concat(struct workspace *wk)
+{
+	obj a, b, iter;
+	struct obj_iterator *iterator;
+	struct obj_array *arr;
+	uint32_t end = vm_get_constant(wk->vm.code.e, &wk->vm.ip);
+
+	a = object_stack_peek(&wk->vm.stack, 2);
+	b = object_stack_peek(&wk->vm.stack, 1);
+	if (get_obj_type(wk, a) != obj_array || get_obj_type(wk, b) != obj_array) {
+		return;
+	}
+
+	object_stack_pop(&wk->vm.stack);
+	object_stack_pop(&wk->vm.stack);
+
+	make_obj(wk, &iter, obj_iterator);
+	object_stack_push(wk, iter);
+	iterator = get_obj_iterator(wk, iter);
+	iterator->type = obj_iterator_type_array_concat;
+
+	// Both lengths are snapshotted, since a += on either operand inside the
+	// loop must not be observed
+	arr = get_obj_array(wk, a);
+	iterator->data.array_concat.array = arr;
+	iterator->data.array_concat.len = arr->len;
+	iterator->data.array_concat.next = b;
+	iterator->data.array_concat.next_len = get_obj_array(wk, b)->len;
+
+	wk->vm.ip = end;
+}
+
 static void
 vm_op_pop(struct workspace *wk)
 {
@@ -2201,6 +2489,10 @@ vm_op_return(struct workspace *wk)
 		break;
 	}
 	case call_frame_type_func:
+		if (wk->vm.profile) {
+			profile_pop(wk);
+		}
+
 		wk->vm.behavior.pop_local_scope(wk);
 		wk->vm.scope_stack = frame->scope_stack;
 		wk->vm.lang_mode = frame->lang_mode;
@@ -2287,7 +2579,11 @@ vm_unwind_call_stack(struct workspace *wk)
 			wk->vm.ip = frame->return_ip;
 			return;
 		}
-		case call_frame_type_func: break;
+		case call_frame_type_func:
+			if (wk->vm.profile) {
+				profile_pop(wk);
+			}
+			break;
 		}
 
 		if (frame->return_ip) {
@@ -2351,7 +2647,7 @@ vm_execute(struct workspace *wk)
  */
 
 struct vm_check_scope_ctx {
-	const char *name;
+	struct str name;
 	obj res, scope;
 	bool found;
 };
@@ -2360,7 +2656,7 @@ static enum iteration_result
 vm_check_scope(struct workspace *wk, void *_ctx, obj scope)
 {
 	struct vm_check_scope_ctx *ctx = _ctx;
-	if (obj_dict_index_str(wk, scope, ctx->name, &ctx->res)) {
+	if (obj_dict_index_strn(wk, scope, ctx->name.s, ctx->name.len, &ctx->res)) {
 		ctx->scope = scope;
 		ctx->found = true;
 	}
@@ -2370,7 +2666,7 @@ vm_check_scope(struct workspace *wk, void *_ctx, obj scope)
 static bool
 vm_get_local_variable(struct workspace *wk, const char *name, obj *res, obj *scope)
 {
-	struct vm_check_scope_ctx ctx = { .name = name };
+	struct vm_check_scope_ctx ctx = { .name = { .s = name, .len = strlen(name) } };
 	obj_array_foreach(wk, wk->vm.scope_stack, &ctx, vm_check_scope);
 
 	if (ctx.found) {
@@ -2382,12 +2678,28 @@ vm_get_local_variable(struct workspace *wk, const char *name, obj *res, obj *sco
 	return false;
 }
 
+/*
+ * Called whenever a variable's value may gain a second reference.  A string
+ * built with += can no longer be appended to in place after this.
+ */
+static void
+vm_variable_escape(struct workspace *wk, obj o)
+{
+	if (get_obj_type(wk, o) == obj_string) {
+		struct str *ss = (struct str *)get_str(wk, o);
+		if (ss->flags & str_flag_unique) {
+			ss->flags &= ~(str_flag_unique | str_flag_mutable);
+		}
+	}
+}
+
 static bool
 vm_get_variable(struct workspace *wk, const char *name, obj *res)
 {
 	obj o, _scope;
 
 	if (vm_get_local_variable(wk, name, &o, &_scope)) {
+		vm_variable_escape(wk, o);
 		*res = o;
 		return true;
 	} else {
@@ -2395,11 +2707,19 @@ vm_get_variable(struct workspace *wk, const char *name, obj *res)
 	}
 }
 
+static enum iteration_result
+vm_scope_stack_dup_escape_iter(struct workspace *wk, void *_ctx, obj k, obj v)
+{
+	vm_variable_escape(wk, v);
+	return ir_cont;
+}
+
 static enum iteration_result
 vm_scope_stack_dup_iter(struct workspace *wk, void *_ctx, obj v)
 {
 	obj *r = _ctx;
 	obj scope;
+	obj_dict_foreach(wk, v, 0, vm_scope_stack_dup_escape_iter);
 	obj_dict_dup(wk, v, &scope);
 	obj_array_push(wk, *r, scope);
 	return ir_cont;
@@ -2596,11 +2916,250 @@ vm_check_break(struct workspace *wk, uint32_t ip)
 	}
 }
 
+static bool
+vm_dbg_active(struct workspace *wk)
+{
+	return wk->vm.dbg_state.stepping || wk->vm.dbg_state.breakpoints || wk->vm.dbg_state.break_after;
+}
+
+/*
+ * Runs until the vm stops or a debugger hook becomes active.  Ops are called
+ * directly instead of through wk->vm.ops, and are threaded with computed
+ * gotos where the compiler supports them.  Debugging can only be switched on
+ * by code that runs inside a call, so it is only checked after call ops.
+ *
+ * Only ops without a case below are looked up in wk->vm.ops, so this loop is
+ * only used while vm_fast_loop_usable() finds the default handlers for all of
+ * the others.
+ */
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+static void
+vm_execute_loop_fast(struct workspace *wk)
+{
+#if defined(__GNUC__)
+	static const void *const dispatch[op_count] = {
+		[op_constant] = &&vm_fast_op_constant,
+		[op_constant_list] = &&vm_fast_op_constant_list,
+		[op_constant_dict] = &&vm_fast_op_constant_dict,
+		[op_constant_func] = &&vm_fast_op_constant_func,
+		[op_add] = &&vm_fast_op_add,
+		[op_sub] = &&vm_fast_op_sub,
+		[op_mul] = &&vm_fast_op_mul,
+		[op_div] = &&vm_fast_op_div,
+		[op_mod] = &&vm_fast_op_mod,
+		[op_not] = &&vm_fast_op_not,
+		[op_eq] = &&vm_fast_op_eq,
+		[op_neq] = &&vm_fast_op_neq,
+		[op_in] = &&vm_fast_op_in,
+		[op_not_in] = &&vm_fast_op_not_in,
+		[op_gt] = &&vm_fast_op_gt,
+		[op_lt] = &&vm_fast_op_lt,
+		[op_negate] = &&vm_fast_op_negate,
+		[op_stringify] = &&vm_fast_op_stringify,
+		[op_store] = &&vm_fast_op_store,
+		[op_load] = &&vm_fast_op_load,
+		[op_try_load] = &&vm_fast_op_try_load,
+		[op_return] = &&vm_fast_op_return,
+		[op_return_end] = &&vm_fast_op_return,
+		[op_call] = &&vm_fast_op_call,
+		[op_call_native] = &&vm_fast_op_call_native,
+		[op_call_native_kw] = &&vm_fast_op_call_native_kw,
+		[op_member] = &&vm_fast_op_member,
+		[op_index] = &&vm_fast_op_index,
+		[op_iterator] = &&vm_fast_op_iterator,
+		[op_iterator_next] = &&vm_fast_op_iterator_next,
+		[op_jmp] = &&vm_fast_op_jmp,
+		[op_jmp_if_true] = &&vm_fast_op_jmp_if_true,
+		[op_jmp_if_false] = &&vm_fast_op_jmp_if_false,
+		[op_jmp_if_disabler] = &&vm_fast_op_jmp_if_disabler,
+		[op_jmp_if_disabler_keep] = &&vm_fast_op_jmp_if_disabler_keep,
+		[op_pop] = &&vm_fast_op_pop,
+		[op_dup] = &&vm_fast_op_dup,
+		[op_swap] = &&vm_fast_op_swap,
+		[op_typecheck] = &&vm_fast_op_typecheck,
+		[op_constant_load] = &&vm_fast_op_constant_load,
+		[op_constant_store] = &&vm_fast_op_constant_store,
+		[op_call_member] = &&vm_fast_op_call_member,
+		[op_iterator_keys] = &&vm_fast_other,
+		[op_iterator_concat] = &&vm_fast_other,
+		[op_az_branch] = &&vm_fast_other,
+		[op_az_merge] = &&vm_fast_other,
+	};
+
+#define vm_fast_case(__op) vm_fast_##__op:
+#define vm_fast_other_case() vm_fast_other:
+#define vm_fast_next()                                      \
+	if (!wk->vm.run) {                                  \
+		return;                                     \
+	}                                                   \
+	goto *dispatch[wk->vm.code.e[wk->vm.ip++]]
+
+	vm_fast_next();
+#else
+#define vm_fast_case(__op) case __op:
+#define vm_fast_other_case() default:
+#define vm_fast_next() continue
+
+	while (wk->vm.run) {
+		switch (wk->vm.code.e[wk->vm.ip++]) {
+#endif
+
+#define vm_fast_op(__op)     \
+	vm_fast_case(__op) { \
+		vm_##__op(wk);       \
+		vm_fast_next();      \
+	}
+#define vm_fast_call_op(__op)                \
+	vm_fast_case(__op) {                 \
+		vm_##__op(wk);                       \
+		if (vm_dbg_active(wk)) {             \
+			return;                      \
+		}                                    \
+		vm_fast_next();                      \
+	}
+
+	vm_fast_op(op_constant);
+	vm_fast_op(op_constant_list);
+	vm_fast_op(op_constant_dict);
+	vm_fast_op(op_constant_func);
+	vm_fast_op(op_add);
+	vm_fast_op(op_sub);
+	vm_fast_op(op_mul);
+	vm_fast_op(op_div);
+	vm_fast_op(op_mod);
+	vm_fast_op(op_not);
+	vm_fast_op(op_eq);
+	vm_fast_op(op_neq);
+	vm_fast_op(op_in);
+	vm_fast_op(op_not_in);
+	vm_fast_op(op_gt);
+	vm_fast_op(op_lt);
+	vm_fast_op(op_negate);
+	vm_fast_op(op_stringify);
+	vm_fast_op(op_store);
+	vm_fast_op(op_load);
+	vm_fast_op(op_try_load);
+	vm_fast_op(op_member);
+	vm_fast_op(op_index);
+	vm_fast_op(op_iterator);
+	vm_fast_op(op_iterator_next);
+	vm_fast_op(op_jmp);
+	vm_fast_op(op_jmp_if_true);
+	vm_fast_op(op_jmp_if_false);
+	vm_fast_op(op_jmp_if_disabler);
+	vm_fast_op(op_jmp_if_disabler_keep);
+	vm_fast_op(op_pop);
+	vm_fast_op(op_dup);
+	vm_fast_op(op_swap);
+	vm_fast_op(op_typecheck);
+	vm_fast_op(op_constant_load);
+	vm_fast_op(op_constant_store);
+#if !defined(__GNUC__)
+	case op_return_end:
+#endif
+	vm_fast_op(op_return);
+	vm_fast_call_op(op_call);
+	vm_fast_call_op(op_call_native);
+	vm_fast_call_op(op_call_native_kw);
+	vm_fast_call_op(op_call_member);
+
+	vm_fast_other_case()
+	{
+		wk->vm.ops.ops[wk->vm.code.e[wk->vm.ip - 1]](wk);
+		vm_fast_next();
+	}
+
+#if !defined(__GNUC__)
+		}
+	}
+#endif
+
+#undef vm_fast_case
+#undef vm_fast_other_case
+#undef vm_fast_next
+#undef vm_fast_op
+#undef vm_fast_call_op
+}
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+static bool
+vm_fast_loop_usable(struct workspace *wk)
+{
+	static const struct {
+		uint8_t op;
+		vm_op_fn fn;
+	} defaults[] = {
+		{ op_constant, vm_op_constant },
+		{ op_constant_list, vm_op_constant_list },
+		{ op_constant_dict, vm_op_constant_dict },
+		{ op_constant_func, vm_op_constant_func },
+		{ op_add, vm_op_add },
+		{ op_sub, vm_op_sub },
+		{ op_mul, vm_op_mul },
+		{ op_div, vm_op_div },
+		{ op_mod, vm_op_mod },
+		{ op_not, vm_op_not },
+		{ op_eq, vm_op_eq },
+		{ op_neq, vm_op_neq },
+		{ op_in, vm_op_in },
+		{ op_not_in, vm_op_not_in },
+		{ op_gt, vm_op_gt },
+		{ op_lt, vm_op_lt },
+		{ op_negate, vm_op_negate },
+		{ op_stringify, vm_op_stringify },
+		{ op_store, vm_op_store },
+		{ op_load, vm_op_load },
+		{ op_try_load, vm_op_try_load },
+		{ op_member, vm_op_member },
+		{ op_index, vm_op_index },
+		{ op_iterator, vm_op_iterator },
+		{ op_iterator_next, vm_op_iterator_next },
+		{ op_jmp, vm_op_jmp },
+		{ op_jmp_if_true, vm_op_jmp_if_true },
+		{ op_jmp_if_false, vm_op_jmp_if_false },
+		{ op_jmp_if_disabler, vm_op_jmp_if_disabler },
+		{ op_jmp_if_disabler_keep, vm_op_jmp_if_disabler_keep },
+		{ op_pop, vm_op_pop },
+		{ op_dup, vm_op_dup },
+		{ op_swap, vm_op_swap },
+		{ op_typecheck, vm_op_typecheck },
+		{ op_constant_load, vm_op_constant_load },
+		{ op_constant_store, vm_op_constant_store },
+		{ op_return, vm_op_return },
+		{ op_return_end, vm_op_return },
+		{ op_call, vm_op_call },
+		{ op_call_native, vm_op_call_native },
+		{ op_call_native_kw, vm_op_call_native_kw },
+		{ op_call_member, vm_op_call_member },
+	};
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_LEN(defaults); ++i) {
+		if (wk->vm.ops.ops[defaults[i].op] != defaults[i].fn) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static void
 vm_execute_loop(struct workspace *wk)
 {
 	uint32_t cip;
+	const bool fast = vm_fast_loop_usable(wk);
+
 	while (wk->vm.run) {
+		if (fast && !vm_dbg_active(wk)) {
+			vm_execute_loop_fast(wk);
+			continue;
+		}
+
 		if (log_should_print(log_debug)) {
 			/* LL("%-50s", vm_dis_inst(wk, wk->vm.code.e, wk->vm.ip)); */
 			/* object_stack_print(wk, &wk->vm.stack); */
@@ -2672,6 +3231,7 @@ vm_init_objects(struct workspace *wk)
 
 	hash_init(&wk->vm.objects.obj_hash, 128, sizeof(obj));
 	hash_init_str(&wk->vm.objects.str_hash, 128);
+	obj_dedup_hash_init(&wk->vm.objects.dedup_hash);
 
 	make_default_objects(wk);
 }
@@ -2687,6 +3247,8 @@ vm_init(struct workspace *wk)
 	arr_init(&wk->vm.code, 4 * 1024, 1);
 	arr_init(&wk->vm.src, 64, sizeof(struct source));
 	arr_init(&wk->vm.locations, 1024, sizeof(struct source_location_mapping));
+	arr_init(&wk->vm.kwarg_cache, 256, sizeof(struct vm_kwarg_cache_entry));
+	wk->vm.kwarg_cache_base = UINT32_MAX;
 
 	/* compiler state */
 	arr_init(&wk->vm.compiler_state.node_stack, 4096, sizeof(struct node *));
@@ -2722,7 +3284,9 @@ vm_init(struct workspace *wk)
 					      [op_mod] = vm_op_mod,
 					      [op_not] = vm_op_not,
 					      [op_eq] = vm_op_eq,
+					      [op_neq] = vm_op_neq,
 					      [op_in] = vm_op_in,
+					      [op_not_in] = vm_op_not_in,
 					      [op_gt] = vm_op_gt,
 					      [op_lt] = vm_op_lt,
 					      [op_negate] = vm_op_negate,
@@ -2735,6 +3299,7 @@ vm_init(struct workspace *wk)
 					      [op_call] = vm_op_call,
 					      [op_member] = vm_op_member,
 					      [op_call_native] = vm_op_call_native,
+					      [op_call_native_kw] = vm_op_call_native_kw,
 					      [op_index] = vm_op_index,
 					      [op_iterator] = vm_op_iterator,
 					      [op_iterator_next] = vm_op_iterator_next,
@@ -2747,6 +3312,11 @@ vm_init(struct workspace *wk)
 					      [op_dup] = vm_op_dup,
 					      [op_swap] = vm_op_swap,
 					      [op_typecheck] = vm_op_typecheck,
+					      [op_constant_load] = vm_op_constant_load,
+					      [op_constant_store] = vm_op_constant_store,
+					      [op_call_member] = vm_op_call_member,
+					      [op_iterator_keys] = vm_op_iterator_keys,
+					      [op_iterator_concat] = vm_op_iterator_concat,
 				      } };
 
 	/* objects */
@@ -2810,11 +3380,13 @@ vm_destroy_objects(struct workspace *wk)
 
 	hash_destroy(&wk->vm.objects.obj_hash);
 	hash_destroy(&wk->vm.objects.str_hash);
+	hash_destroy(&wk->vm.objects.dedup_hash);
 }
 
 void
 vm_destroy(struct workspace *wk)
 {
+	profile_destroy(wk);
 	vm_destroy_objects(wk);
 
 	bucket_arr_destroy(&wk->vm.stack.ba);
@@ -2828,6 +3400,7 @@ vm_destroy(struct workspace *wk)
 	}
 	arr_destroy(&wk->vm.src);
 	arr_destroy(&wk->vm.locations);
+	arr_destroy(&wk->vm.kwarg_cache);
 
 	arr_destroy(&wk->vm.compiler_state.node_stack);
 	arr_destroy(&wk->vm.compiler_state.if_jmp_stack);
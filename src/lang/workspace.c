@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "backend/backend.h"
+#include "backend/common_args.h"
 #include "backend/output.h"
 #include "buf_size.h"
 #include "embedded.h"
@@ -19,7 +20,10 @@
 #include "log.h"
 #include "options.h"
 #include "platform/assert.h"
+#include "platform/filesystem.h"
 #include "platform/path.h"
+#include "sha_256.h"
+#include "version.h"
 
 struct project *
 make_project(struct workspace *wk, uint32_t *id, const char *subproject_name, const char *cwd, const char *build_dir)
@@ -334,10 +338,133 @@ workspace_cwd(struct workspace *wk)
 	}
 }
 
+/*
+ * Regeneration fingerprint.  A successful setup records the sha256 of every
+ * regenerate dependency, along with a digest of the command line and
+ * environment-derived options it ran with.  When the regeneration rule runs
+ * setup -r and none of these changed, e.g. after a file was only touched,
+ * the existing build files are still valid and build.ninja is just touched.
+ */
+static void
+workspace_regenerate_fingerprint_line(struct workspace *wk,
+	struct sbuf *buf,
+	const uint8_t digest[32],
+	const char *label)
+{
+	uint32_t i;
+
+	sbuf_clear(buf);
+	for (i = 0; i < 32; ++i) {
+		sbuf_pushf(wk, buf, "%02x", digest[i]);
+	}
+	sbuf_pushf(wk, buf, " %s\n", label);
+}
+
+static bool
+workspace_regenerate_file_digest(const char *path, uint8_t digest[32])
+{
+	struct source src = { 0 };
+
+	if (!fs_file_exists(path) || !fs_read_entire_file(path, &src)) {
+		return false;
+	}
+
+	calc_sha_256(digest, src.src, src.len);
+	fs_source_destroy(&src);
+	return true;
+}
+
+static void
+workspace_regenerate_options_digest(struct workspace *wk, uint8_t digest[32])
+{
+	obj arg;
+	SBUF(buf);
+
+	sbuf_pushf(wk, &buf, "%s-%s", muon_version.version, muon_version.vcs_tag);
+	obj_array_for(wk, ca_regenerate_build_command(wk, false), arg) {
+		sbuf_push(wk, &buf, 0);
+		sbuf_pushs(wk, &buf, get_cstr(wk, arg));
+	}
+
+	calc_sha_256(digest, buf.buf, buf.len);
+}
+
+static bool
+workspace_regenerate_fingerprint_matches(struct workspace *wk, const char *path, const uint8_t options_digest[32])
+{
+	bool res = false;
+	struct source src = { 0 };
+	const char *line, *end, *src_end;
+	uint8_t digest[32];
+	SBUF(dep);
+	SBUF(buf);
+
+	if (!fs_file_exists(path) || !fs_read_entire_file(path, &src)) {
+		return false;
+	}
+
+	src_end = src.src + src.len;
+	for (line = src.src; line < src_end; line = end + 1) {
+		if (!(end = memchr(line, '\n', src_end - line)) || end - line < 66) {
+			goto ret;
+		}
+
+		if (line == src.src) {
+			workspace_regenerate_fingerprint_line(wk, &buf, options_digest, "options");
+		} else {
+			sbuf_clear(&dep);
+			sbuf_pushn(wk, &dep, line + 65, end - (line + 65));
+
+			if (!workspace_regenerate_file_digest(dep.buf, digest)) {
+				goto ret;
+			}
+
+			workspace_regenerate_fingerprint_line(wk, &buf, digest, dep.buf);
+		}
+
+		if (buf.len != (uint32_t)(end + 1 - line) || memcmp(buf.buf, line, buf.len) != 0) {
+			L("regenerate dependency changed: %.*s", (int)(end - (line + 65)), line + 65);
+			goto ret;
+		}
+	}
+
+	res = src.len > 0;
+ret:
+	fs_source_destroy(&src);
+	return res;
+}
+
+static bool
+workspace_regenerate_fingerprint_write(struct workspace *wk, const char *path, const uint8_t options_digest[32])
+{
+	obj deps, dep;
+	uint8_t digest[32];
+	SBUF(line);
+	SBUF(buf);
+
+	workspace_regenerate_fingerprint_line(wk, &line, options_digest, "options");
+	sbuf_pushn(wk, &buf, line.buf, line.len);
+
+	obj_array_dedup(wk, wk->regenerate_deps, &deps);
+	obj_array_for(wk, deps, dep) {
+		if (!workspace_regenerate_file_digest(get_cstr(wk, dep), digest)) {
+			// without a complete fingerprint, regeneration always runs setup
+			return true;
+		}
+
+		workspace_regenerate_fingerprint_line(wk, &line, digest, get_cstr(wk, dep));
+		sbuf_pushn(wk, &buf, line.buf, line.len);
+	}
+
+	return fs_write(path, (const uint8_t *)buf.buf, buf.len);
+}
+
 bool
 workspace_do_setup(struct workspace *wk, const char *build, const char *argv0, uint32_t argc, char *const argv[])
 {
 	bool res = false;
+	uint8_t options_digest[32];
+	SBUF(fingerprint_path);
 
 	if (!workspace_setup_paths(wk, build, argv0, argc, argv)) {
 		goto ret;
@@ -345,6 +472,24 @@ workspace_do_setup(struct workspace *wk, const char *build, const char *argv0, u
 
 	workspace_init_startup_files(wk);
 
+	workspace_regenerate_options_digest(wk, options_digest);
+	path_join(wk, &fingerprint_path, wk->muon_private, output_path.regenerate_fingerprint);
+
+	if (wk->regenerate_if_changed
+		&& workspace_regenerate_fingerprint_matches(wk, fingerprint_path.buf, options_digest)) {
+		SBUF(build_ninja);
+		path_join(wk, &build_ninja, wk->build_root, "build.ninja");
+		if (!fs_touch(build_ninja.buf)) {
+			goto ret;
+		}
+
+		LOG_I("no regenerate dependency changed, skipping setup");
+		res = true;
+		goto ret;
+	} else if (fs_file_exists(fingerprint_path.buf) && !fs_remove(fingerprint_path.buf)) {
+		goto ret;
+	}
+
 	{
 		SBUF(path);
 		path_join(wk, &path, wk->muon_private, output_path.compiler_check_cache);
@@ -359,6 +504,8 @@ workspace_do_setup(struct workspace *wk, const char *build, const char *argv0, u
 		}
 	}
 
+	fs_cache_enable(true);
+
 	uint32_t project_id;
 	if (!eval_project(wk, NULL, wk->source_root, wk->build_root, &project_id)) {
 		goto ret;
@@ -374,15 +521,22 @@ workspace_do_setup(struct workspace *wk, const char *build, const char *argv0, u
 		}
 	}
 
+	fs_cache_enable(false);
+
 	if (!backend_output(wk)) {
 		goto ret;
 	}
 
+	if (!workspace_regenerate_fingerprint_write(wk, fingerprint_path.buf, options_digest)) {
+		goto ret;
+	}
+
 	workspace_print_summaries(wk, _log_file());
 
 	LOG_I("setup complete");
 
 	res = true;
 ret:
+	fs_cache_enable(false);
 	return res;
 }
@@ -13,6 +13,7 @@
 #include "args.h"
 #include "backend/output.h"
 #include "buf_size.h"
+#include "cmd_fmt.h"
 #include "cmd_install.h"
 #include "cmd_subprojects.h"
 #include "cmd_test.h"
@@ -24,9 +25,11 @@
 #include "external/samurai.h"
 #include "lang/analyze.h"
 #include "lang/fmt.h"
+#include "lang/lsp.h"
 #include "lang/func_lookup.h"
 #include "lang/object_iterators.h"
 #include "lang/parser.h"
+#include "lang/profile.h"
 #include "lang/serial.h"
 #include "meson_opts.h"
 #include "options.h"
@@ -37,6 +40,7 @@
 #include "platform/os.h"
 #include "platform/path.h"
 #include "platform/run_cmd.h"
+#include "sha_256.h"
 #include "tracy.h"
 #include "ui.h"
 #include "version.h"
@@ -284,12 +288,14 @@ cmd_analyze(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 	enum {
 		action_trace,
 		action_define,
+		action_lsp,
 		action_default,
 	} action = action_default;
 
 	static const struct command commands[] = {
 		[action_trace] = { "trace", 0, "print a tree of all meson source files that are evaluated" },
 		[action_define] = { "define <var>", 0, "lookup the definition of a variable" },
+		[action_lsp] = { "lsp", 0, "run a language server over stdin and stdout" },
 		0,
 	};
 
@@ -371,6 +377,7 @@ cmd_analyze(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		opts.get_definition_for = argv[argi];
 		break;
 	}
+	case action_lsp: break;
 	}
 
 	if (opts.internal_file && opts.file_override) {
@@ -378,6 +385,15 @@ cmd_analyze(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		return false;
 	}
 
+	if (action == action_lsp) {
+		if (opts.internal_file || opts.file_override) {
+			LOG_E("-i and -O can't be used with lsp");
+			return false;
+		}
+
+		return analyze_lsp(&opts);
+	}
+
 	SBUF_manual(abs);
 	if (opts.file_override) {
 		path_make_absolute(NULL, &abs, opts.file_override);
@@ -769,6 +785,76 @@ cmd_dump_toolchains(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[]
 	return true;
 }
 
+static bool
+cmd_sha256sum(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
+{
+	bool res = false;
+	uint32_t i, chunk_size = 64 * 1024;
+	uint64_t len, n;
+	uint8_t hash[32], *buf;
+	struct sha_256 sha;
+	FILE *f;
+
+	OPTSTART("c:") {
+	case 'c': {
+		int64_t size;
+		if (!str_to_i(&WKSTR(optarg), &size, false) || size < 1 || size > 64 * 1024) {
+			LOG_E("invalid chunk size: %s", optarg);
+			return false;
+		}
+
+		chunk_size = size;
+		break;
+	}
+	}
+	OPTEND(argv[argi],
+		" <file> [<file>[...]]",
+		"  -c <size> - hash each file in reads of size bytes\n",
+		NULL,
+		-1)
+
+	buf = z_malloc(chunk_size);
+
+	for (; argi < argc; ++argi) {
+		if (!(f = fs_fopen(argv[argi], "rb"))) {
+			goto ret;
+		} else if (!fs_fsize(f, &len)) {
+			fs_fclose(f);
+			goto ret;
+		}
+
+		sha_256_init(&sha);
+
+		while (len) {
+			n = len > chunk_size ? chunk_size : len;
+
+			if (!fs_fread(buf, n, f)) {
+				fs_fclose(f);
+				goto ret;
+			}
+
+			sha_256_update(&sha, buf, n);
+			len -= n;
+		}
+
+		sha_256_final(&sha, hash);
+
+		if (!fs_fclose(f)) {
+			goto ret;
+		}
+
+		for (i = 0; i < 32; ++i) {
+			printf("%02x", hash[i]);
+		}
+		printf("  %s\n", argv[argi]);
+	}
+
+	res = true;
+ret:
+	z_free(buf);
+	return res;
+}
+
 static bool
 cmd_internal(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 {
@@ -778,6 +864,7 @@ cmd_internal(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		{ "repl", cmd_repl, "start a meson language repl" },
 		{ "dump_funcs", cmd_dump_signatures, "output all supported functions and arguments" },
 		{ "dump_toolchains", cmd_dump_toolchains, "output toolchain arguments" },
+		{ "sha256sum", cmd_sha256sum, "print sha256 checksums of files" },
 		0,
 	};
 
@@ -799,17 +886,38 @@ cmd_samu(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 	return samu_main(argc - argi, (char **)&argv[argi], 0);
 }
 
+static bool
+cmd_parse_u32(const char *arg, const char *desc, uint32_t *res)
+{
+	char *endptr;
+	unsigned long n = strtoul(arg, &endptr, 10);
+
+	if (n > UINT32_MAX || !*arg || *endptr) {
+		LOG_E("invalid %s: %s", desc, arg);
+		return false;
+	}
+
+	*res = n;
+	return true;
+}
+
 static bool
 cmd_test(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 {
-	struct test_options test_opts = { 0 };
+	struct test_options test_opts = {
+		.bench = {
+			.iterations = 1,
+			.threshold = 10.0f,
+		},
+	};
+	bool bench_opt = false;
 
 	if (strcmp(argv[argi], "benchmark") == 0) {
 		test_opts.cat = test_category_benchmark;
 		test_opts.print_summary = true;
 	}
 
-	OPTSTART("s:d:Sfj:lvRe:o:") {
+	OPTSTART("s:d:Sfj:lvRe:o:w:n:p:b:B:t:") {
 	case 'l': test_opts.list = true; break;
 	case 'e': test_opts.setup = optarg; break;
 	case 's':
@@ -846,20 +954,56 @@ cmd_test(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		break;
 	case 'f': test_opts.fail_fast = true; break;
 	case 'S': test_opts.print_summary = true; break;
-	case 'j': {
+	case 'j':
+		if (!cmd_parse_u32(optarg, "number of jobs", &test_opts.jobs)) {
+			return false;
+		}
+		break;
+	case 'v': ++test_opts.verbosity; break;
+	case 'R': test_opts.no_rebuild = true; break;
+	case 'w':
+		if (!cmd_parse_u32(optarg, "number of warmup runs", &test_opts.bench.warmup)) {
+			return false;
+		}
+		bench_opt = true;
+		break;
+	case 'n':
+		if (!cmd_parse_u32(optarg, "number of iterations", &test_opts.bench.iterations)) {
+			return false;
+		} else if (!test_opts.bench.iterations) {
+			LOG_E("number of iterations must be at least 1");
+			return false;
+		}
+		bench_opt = true;
+		break;
+	case 'p':
+		if (!cmd_parse_u32(optarg, "cpu", &test_opts.bench.cpu)) {
+			return false;
+		}
+		test_opts.bench.pin_cpu = true;
+		bench_opt = true;
+		break;
+	case 'b':
+		test_opts.bench.baseline = optarg;
+		bench_opt = true;
+		break;
+	case 'B':
+		test_opts.bench.save_baseline = optarg;
+		bench_opt = true;
+		break;
+	case 't': {
 		char *endptr;
-		unsigned long n = strtoul(optarg, &endptr, 10);
+		double n = strtod(optarg, &endptr);
 
-		if (n > UINT32_MAX || !*optarg || *endptr) {
-			LOG_E("invalid number of jobs: %s", optarg);
+		if (n < 0 || !*optarg || *endptr) {
+			LOG_E("invalid regression threshold: %s", optarg);
 			return false;
 		}
 
-		test_opts.jobs = n;
+		test_opts.bench.threshold = n;
+		bench_opt = true;
 		break;
 	}
-	case 'v': ++test_opts.verbosity; break;
-	case 'R': test_opts.no_rebuild = true; break;
 	}
 	OPTEND(argv[argi],
 		" [test [test [...]]]",
@@ -872,10 +1016,22 @@ cmd_test(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		"  -R - disable automatic rebuild\n"
 		"  -S - print a summary with elapsed time\n"
 		"  -s <suite> - only run items in <suite>, may be passed multiple times\n"
-		"  -v - increase verbosity, may be passed twice\n",
+		"  -v - increase verbosity, may be passed twice\n"
+		"benchmark options:\n"
+		"  -w <n> - perform <n> untimed warmup runs of each benchmark\n"
+		"  -n <n> - run each benchmark <n> times\n"
+		"  -p <cpu> - pin benchmarks to <cpu>\n"
+		"  -b <baseline.json> - compare results against <baseline.json>\n"
+		"  -B <baseline.json> - write results to <baseline.json>\n"
+		"  -t <percent> - fail if a benchmark is slower than the baseline by more than <percent>\n",
 		NULL,
 		-1)
 
+	if (bench_opt && test_opts.cat != test_category_benchmark) {
+		LOG_E("benchmark options are only valid for the benchmark subcommand");
+		return false;
+	}
+
 	if (!ensure_in_build_dir()) {
 		return false;
 	}
@@ -920,35 +1076,60 @@ cmd_setup(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 	workspace_init_bare(&wk);
 	workspace_init_runtime(&wk);
 
-	uint32_t original_argi = argi + 1;
+	const char *profile_path = 0;
+
+	/*
+	 * The options recorded for the regeneration rule.  -r is added by the
+	 * rule itself, and -p would make every regeneration overwrite the
+	 * profile, so neither is recorded.  Each recorded option takes at most
+	 * two entries, followed by the remaining operands.
+	 */
+	uint32_t regen_argc = 0;
+	char **regen_argv = z_calloc(2 * argc, sizeof(char *));
 
-	OPTSTART("D:b:") {
+	OPTSTART("D:b:p:r") {
 	case 'D':
 		if (!parse_and_set_cmdline_option(&wk, optarg)) {
 			goto ret;
 		}
+		regen_argv[regen_argc++] = "-D";
+		regen_argv[regen_argc++] = optarg;
 		break;
 	case 'b': {
 		vm_dbg_push_breakpoint_str(&wk, optarg);
+		regen_argv[regen_argc++] = "-b";
+		regen_argv[regen_argc++] = optarg;
 		break;
 	}
+	case 'p':
+		profile_path = optarg;
+		profile_init(&wk);
+		break;
+	case 'r': wk.regenerate_if_changed = true; break;
 	}
 	OPTEND(argv[argi],
 		" <build dir>",
 		"  -D <option>=<value> - set project options\n"
-		"  -b <breakpoint> - set breakpoint\n",
+		"  -b <breakpoint> - set breakpoint\n"
+		"  -p <file> - profile evaluation and write folded stacks to <file>\n"
+		"  -r - skip setup if no regenerate dependency changed\n",
 		NULL,
 		1)
 
 	const char *build = argv[argi];
-	++argi;
 
-	if (!workspace_do_setup(&wk, build, argv[0], argc - original_argi, &argv[original_argi])) {
-		goto ret;
+	for (; argi < argc; ++argi) {
+		regen_argv[regen_argc++] = argv[argi];
+	}
+
+	res = workspace_do_setup(&wk, build, argv[0], regen_argc, regen_argv);
+
+	if (profile_path && !profile_write(&wk, profile_path)) {
+		res = false;
 	}
 
-	res = true;
 ret:
+	z_free(regen_argv);
 	workspace_destroy(&wk);
 	TracyCZoneAutoE;
 	return res;
@@ -961,77 +1142,44 @@ cmd_format(void *_ctx, uint32_t argc, uint32_t argi, char *const argv[])
 		LOG_W("the subcommand name fmt_unstable is deprecated, please use fmt instead");
 	}
 
-	struct {
-		char *const *filenames;
-		const char *cfg_path;
-		bool in_place, check_only, editorconfig;
-	} opts = { 0 };
+	struct format_options opts = { .argv0 = argv[0] };
 
-	OPTSTART("ic:qe") {
+	OPTSTART("ic:qerj:k:") {
 	case 'i': opts.in_place = true; break;
 	case 'c': opts.cfg_path = optarg; break;
+	case 'k': opts.cache_path = optarg; break;
 	case 'q': opts.check_only = true; break;
 	case 'e': opts.editorconfig = true; break;
+	case 'r': opts.recursive = true; break;
+	case 'j':
+		if (!cmd_parse_u32(optarg, "number of jobs", &opts.jobs)) {
+			return false;
+		}
+		break;
 	}
 	OPTEND(argv[argi],
 		" <file>[ <file>[...]]",
 		"  -q - exit with 1 if files would be modified by muon fmt\n"
 		"  -i - format files in-place\n"
 		"  -c <muon_fmt.ini> - read configuration from muon_fmt.ini\n"
-		"  -e - try to read configuration from .editorconfig\n",
+		"  -e - try to read configuration from .editorconfig\n"
+		"  -r - recursively format meson files in directory arguments\n"
+		"  -j <jobs> - set the number of parallel jobs\n"
+		"  -k <cache> - skip files that passed a previous -q run recorded in <cache>\n",
 		NULL,
 		-1)
 
 	if (opts.in_place && opts.check_only) {
 		LOG_E("-q and -i are mutually exclusive");
 		return false;
+	} else if (opts.cache_path && !opts.check_only) {
+		LOG_E("-k requires -q");
+		return false;
 	}
 
 	log_set_file(stderr);
 
-	opts.filenames = &argv[argi];
-	const uint32_t num_files = argc - argi;
-
-	bool ret = true;
-	bool opened_out;
-	FILE *out;
-	uint32_t i;
-	for (i = 0; i < num_files; ++i) {
-		bool fmt_ret = true;
-		opened_out = false;
-
-		struct source src = { 0 };
-		if (!fs_read_entire_file(opts.filenames[i], &src)) {
-			ret = false;
-			goto cont;
-		}
-
-		if (opts.in_place) {
-			if (!(out = fs_fopen(opts.filenames[i], "wb"))) {
-				ret = false;
-				goto cont;
-			}
-			opened_out = true;
-		} else if (opts.check_only) {
-			out = NULL;
-		} else {
-			out = stdout;
-		}
-
-		fmt_ret = fmt(&src, out, opts.cfg_path, opts.check_only, opts.editorconfig);
-cont:
-		if (opened_out) {
-			fs_fclose(out);
-
-			if (!fmt_ret) {
-				fs_write(opts.filenames[i], (const uint8_t *)src.src, src.len);
-			}
-		}
-		fs_source_destroy(&src);
-		ret &= fmt_ret;
-	}
-
-	return ret;
+	return format_run(&opts, &argv[argi], argc - argi);
 }
 
 static bool
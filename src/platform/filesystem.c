@@ -90,6 +90,11 @@ FILE *
 fs_fopen(const char *path, const char *mode)
 {
 	FILE *f;
+
+	if (strpbrk(mode, "wa+")) {
+		fs_cache_invalidate(path);
+	}
+
 	if (!(f = fopen(path, mode))) {
 		LOG_E("failed to open '%s': %s", path, strerror(errno));
 		return NULL;
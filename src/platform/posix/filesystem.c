@@ -8,12 +8,16 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "buf_size.h"
+#include "datastructures/arr.h"
+#include "datastructures/hash.h"
 #include "lang/string.h"
 #include "log.h"
 #include "platform/assert.h"
@@ -32,6 +36,548 @@ fs_lstat(const char *path, struct stat *sb)
 	return true;
 }
 
+/*
+ * Directory listing cache.  While enabled, existence and type queries for
+ * absolute paths are answered from a cached listing of the containing
+ * directory.  A directory is only listed once it has been queried twice, so
+ * one-off lookups in large directories still cost a single stat.  Entry types
+ * are filled in lazily with stat() and then remembered.
+ *
+ * Listings are dropped whenever muon writes to a directory, and entirely
+ * whenever a subprocess exits, since it may have modified anything.
+ */
+enum fs_cache_type {
+	fs_cache_type_unknown,
+	fs_cache_type_missing,
+	fs_cache_type_file,
+	fs_cache_type_dir,
+	fs_cache_type_other,
+};
+
+struct fs_cache_dir {
+	char *path;
+	struct hash entries;
+	struct sbuf names;
+	uint32_t queries;
+	bool listed, missing;
+};
+
+static struct {
+	struct hash dirs;
+	struct arr dir_list;
+	bool enabled;
+	uint32_t hits, misses, listings;
+} fs_cache;
+
+static void
+fs_cache_dir_reset(struct fs_cache_dir *d)
+{
+	if (d->listed) {
+		hash_destroy(&d->entries);
+		sbuf_destroy(&d->names);
+	}
+
+	d->listed = d->missing = false;
+	d->queries = 0;
+}
+
+void
+fs_cache_enable(bool enable)
+{
+	uint32_t i;
+
+	if (fs_cache.enabled == enable) {
+		return;
+	}
+
+	if (enable) {
+		hash_init_str(&fs_cache.dirs, 256);
+		arr_init(&fs_cache.dir_list, 256, sizeof(struct fs_cache_dir));
+		fs_cache.hits = fs_cache.misses = fs_cache.listings = 0;
+	} else {
+		for (i = 0; i < fs_cache.dir_list.len; ++i) {
+			struct fs_cache_dir *d = arr_get(&fs_cache.dir_list, i);
+			fs_cache_dir_reset(d);
+			z_free(d->path);
+		}
+
+		hash_destroy(&fs_cache.dirs);
+		arr_destroy(&fs_cache.dir_list);
+
+		L("fs cache: %d hits, %d misses, %d directories listed",
+			fs_cache.hits,
+			fs_cache.misses,
+			fs_cache.listings);
+	}
+
+	fs_cache.enabled = enable;
+}
+
+static void
+fs_cache_invalidate_dir(const char *path, uint32_t len)
+{
+	uint64_t *idx;
+
+	if ((idx = hash_get_strn(&fs_cache.dirs, path, len))) {
+		fs_cache_dir_reset(arr_get(&fs_cache.dir_list, *idx));
+	}
+}
+
+/*
+ * PATH index.  The first basename lookup lists every absolute directory in
+ * PATH once and hashes the names it finds, so later lookups only have to check
+ * the directories that actually contain the command.  Whether a candidate is
+ * an executable regular file is checked on first use and then remembered.
+ *
+ * The index is rebuilt whenever the value of PATH changes, and dropped when
+ * muon writes to one of the indexed directories.  A subprocess may have
+ * changed them too, so after one exits the next lookup re-stats the indexed
+ * directories and only rebuilds the index if one of their mtimes changed.
+ * The remembered executable checks are redone, since making a file executable
+ * doesn't change the mtime of its directory.  A directory modified within the
+ * last second could change again without its mtime changing, so it is always
+ * treated as changed.
+ */
+#define FS_PATH_INDEX_MTIME_MISSING -1
+#define FS_PATH_INDEX_MTIME_RECENT INT64_MIN
+
+enum fs_path_index_exe {
+	fs_path_index_exe_unknown,
+	fs_path_index_exe_yes,
+	fs_path_index_exe_no,
+};
+
+struct fs_path_index_entry {
+	uint32_t dir, next, exe_gen;
+	enum fs_path_index_exe exe;
+};
+
+static struct {
+	char *env_path;
+	struct hash names;
+	struct sbuf name_buf;
+	struct arr dirs, mtimes, entries;
+	uint32_t exe_gen;
+	bool valid, usable, stale;
+} fs_path_index;
+
+static void
+fs_path_index_destroy(void)
+{
+	uint32_t i;
+
+	if (fs_path_index.usable) {
+		for (i = 0; i < fs_path_index.dirs.len; ++i) {
+			z_free(*(char **)arr_get(&fs_path_index.dirs, i));
+		}
+
+		hash_destroy(&fs_path_index.names);
+		sbuf_destroy(&fs_path_index.name_buf);
+		arr_destroy(&fs_path_index.dirs);
+		arr_destroy(&fs_path_index.mtimes);
+		arr_destroy(&fs_path_index.entries);
+	}
+
+	if (fs_path_index.env_path) {
+		z_free(fs_path_index.env_path);
+		fs_path_index.env_path = NULL;
+	}
+
+	fs_path_index.valid = fs_path_index.usable = fs_path_index.stale = false;
+}
+
+static void
+fs_path_index_invalidate(const char *dir, uint32_t len)
+{
+	uint32_t i;
+	const char *d;
+
+	if (!fs_path_index.usable) {
+		return;
+	}
+
+	for (i = 0; i < fs_path_index.dirs.len; ++i) {
+		d = *(char **)arr_get(&fs_path_index.dirs, i);
+		if (strlen(d) == len && memcmp(d, dir, len) == 0) {
+			fs_path_index_destroy();
+			return;
+		}
+	}
+}
+
+static void
+fs_path_index_build(const char *env_path)
+{
+	const char *p, *base_start;
+	char *dir_path;
+	DIR *dir;
+	struct dirent *ent;
+	struct arr name_dirs;
+	uint32_t i, off, len, dir_idx;
+	int64_t mtime, now = (int64_t)time(NULL);
+	uint64_t *v;
+
+	fs_path_index_destroy();
+	fs_path_index.env_path = z_malloc(strlen(env_path) + 1);
+	memcpy(fs_path_index.env_path, env_path, strlen(env_path) + 1);
+	fs_path_index.valid = true;
+
+	/* relative entries depend on the working directory and can't be indexed */
+	for (p = base_start = env_path;; ++p) {
+		if (!*p || *p == ENV_PATH_SEP) {
+			if (p == base_start || *base_start != PATH_SEP) {
+				return;
+			} else if (!*p) {
+				break;
+			}
+
+			base_start = p + 1;
+		}
+	}
+
+	arr_init(&fs_path_index.dirs, 16, sizeof(char *));
+	arr_init(&fs_path_index.mtimes, 16, sizeof(int64_t));
+	arr_init(&fs_path_index.entries, 1024, sizeof(struct fs_path_index_entry));
+	arr_init(&name_dirs, 1024, sizeof(uint32_t));
+	sbuf_init(&fs_path_index.name_buf, 0, 0, sbuf_flag_overflow_alloc);
+
+	for (p = base_start = env_path;; ++p) {
+		if (!*p || *p == ENV_PATH_SEP) {
+			len = p - base_start;
+			dir_path = z_malloc(len + 1);
+			memcpy(dir_path, base_start, len);
+			dir_path[len] = 0;
+
+			dir_idx = arr_push(&fs_path_index.dirs, &dir_path);
+
+			if (fs_mtime(dir_path, &mtime) != fs_mtime_result_ok) {
+				mtime = FS_PATH_INDEX_MTIME_MISSING;
+			} else if (mtime / 1000000000 >= now - 1) {
+				mtime = FS_PATH_INDEX_MTIME_RECENT;
+			}
+			arr_push(&fs_path_index.mtimes, &mtime);
+
+			if ((dir = opendir(dir_path))) {
+				while ((ent = readdir(dir))) {
+					if (ent->d_name[0] == '.'
+						&& (!ent->d_name[1] || (ent->d_name[1] == '.' && !ent->d_name[2]))) {
+						continue;
+					}
+
+					sbuf_pushn(NULL, &fs_path_index.name_buf, ent->d_name, strlen(ent->d_name) + 1);
+					arr_push(&name_dirs, &dir_idx);
+				}
+				closedir(dir);
+			}
+
+			if (!*p) {
+				break;
+			}
+
+			base_start = p + 1;
+		}
+	}
+
+	/*
+	 * The names buffer is complete, so keys can now point into it.  Names
+	 * were collected in PATH order, so appending to each chain keeps the
+	 * first match first.
+	 */
+	hash_init_str(&fs_path_index.names, 1024);
+	for (i = 0, off = 0; off < fs_path_index.name_buf.len; ++i, off += len + 1) {
+		const char *name = &fs_path_index.name_buf.buf[off];
+		struct fs_path_index_entry *e;
+		uint32_t entry_idx;
+
+		len = strlen(name);
+		entry_idx = arr_push(&fs_path_index.entries,
+			&(struct fs_path_index_entry){
+				.dir = *(uint32_t *)arr_get(&name_dirs, i),
+				.next = UINT32_MAX,
+			});
+
+		if (!(v = hash_get_strn(&fs_path_index.names, name, len))) {
+			hash_set_strn(&fs_path_index.names, name, len, entry_idx);
+			continue;
+		}
+
+		for (e = arr_get(&fs_path_index.entries, *v); e->next != UINT32_MAX;
+			e = arr_get(&fs_path_index.entries, e->next)) {
+		}
+		e->next = entry_idx;
+	}
+
+	arr_destroy(&name_dirs);
+	fs_path_index.usable = true;
+
+	L("indexed %d names in %d PATH directories", fs_path_index.entries.len, fs_path_index.dirs.len);
+}
+
+static bool
+fs_path_index_dirs_unchanged(void)
+{
+	uint32_t i;
+	int64_t mtime, indexed;
+
+	for (i = 0; i < fs_path_index.dirs.len; ++i) {
+		if ((indexed = *(int64_t *)arr_get(&fs_path_index.mtimes, i)) == FS_PATH_INDEX_MTIME_RECENT) {
+			return false;
+		} else if (fs_mtime(*(char **)arr_get(&fs_path_index.dirs, i), &mtime) != fs_mtime_result_ok) {
+			mtime = FS_PATH_INDEX_MTIME_MISSING;
+		}
+
+		if (mtime != indexed) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Returns false if the index cannot answer the query, in which case the
+ * caller should search PATH itself.
+ */
+static bool
+fs_path_index_lookup(struct workspace *wk, struct sbuf *buf, const char *env_path, const char *cmd, bool *found)
+{
+	uint64_t *v;
+	uint32_t idx;
+	struct fs_path_index_entry *e;
+
+	if (!fs_path_index.valid || strcmp(fs_path_index.env_path, env_path) != 0) {
+		fs_path_index_build(env_path);
+	} else if (fs_path_index.stale) {
+		if (fs_path_index_dirs_unchanged()) {
+			fs_path_index.stale = false;
+			++fs_path_index.exe_gen;
+		} else {
+			L("PATH directory changed, rebuilding index");
+			fs_path_index_build(env_path);
+		}
+	}
+
+	if (!fs_path_index.usable) {
+		return false;
+	}
+
+#ifdef __APPLE__
+	/* the filesystem may be case-insensitive, so don't trust a miss */
+	if (!(v = hash_get_strn(&fs_path_index.names, cmd, strlen(cmd)))) {
+		return false;
+	}
+#else
+	if (!(v = hash_get_strn(&fs_path_index.names, cmd, strlen(cmd)))) {
+		*found = false;
+		return true;
+	}
+#endif
+
+	for (idx = *v; idx != UINT32_MAX; idx = e->next) {
+		e = arr_get(&fs_path_index.entries, idx);
+
+		sbuf_clear(buf);
+		sbuf_pushs(wk, buf, *(char **)arr_get(&fs_path_index.dirs, e->dir));
+		path_push(wk, buf, cmd);
+
+		if (e->exe == fs_path_index_exe_unknown || e->exe_gen != fs_path_index.exe_gen) {
+			e->exe = fs_exe_exists(buf->buf) ? fs_path_index_exe_yes : fs_path_index_exe_no;
+			e->exe_gen = fs_path_index.exe_gen;
+		}
+
+		if (e->exe == fs_path_index_exe_yes) {
+			*found = true;
+			return true;
+		}
+	}
+
+	*found = false;
+	return true;
+}
+
+/*
+ * Called after something outside of muon's control, such as a subprocess, may
+ * have modified the filesystem.
+ */
+void
+fs_cache_invalidate_all(void)
+{
+	uint32_t i;
+
+	if (fs_path_index.usable) {
+		fs_path_index.stale = true;
+	}
+
+	if (!fs_cache.enabled) {
+		return;
+	}
+
+	for (i = 0; i < fs_cache.dir_list.len; ++i) {
+		fs_cache_dir_reset(arr_get(&fs_cache.dir_list, i));
+	}
+}
+
+/*
+ * Called after muon creates, modifies, or removes path.  Both the listing of
+ * its parent and, if path is a directory, its own listing are dropped.
+ */
+void
+fs_cache_invalidate(const char *path)
+{
+	const char *sep;
+	uint32_t len, dir_len;
+
+	if (!fs_cache.enabled && !fs_path_index.usable) {
+		return;
+	} else if (!path_is_absolute(path)) {
+		/* relative paths can't be matched against cached directories */
+		fs_cache_invalidate_all();
+		return;
+	}
+
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == PATH_SEP) {
+		--len;
+	}
+
+	for (sep = &path[len - 1]; sep > path && *sep != PATH_SEP; --sep) {
+	}
+	dir_len = sep == path ? 1 : sep - path;
+
+	fs_path_index_invalidate(path, len);
+	fs_path_index_invalidate(path, dir_len);
+
+	if (fs_cache.enabled) {
+		fs_cache_invalidate_dir(path, len);
+		fs_cache_invalidate_dir(path, dir_len);
+	}
+}
+
+static bool
+fs_cache_list_dir(struct fs_cache_dir *d)
+{
+	struct stat sb;
+	DIR *dir;
+	struct dirent *ent;
+	uint32_t off, len;
+
+	if (stat(d->path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+		d->missing = true;
+		return true;
+	} else if (!(dir = opendir(d->path))) {
+		return false;
+	}
+
+	sbuf_init(&d->names, 0, 0, sbuf_flag_overflow_alloc);
+	while ((ent = readdir(dir))) {
+		sbuf_pushn(NULL, &d->names, ent->d_name, strlen(ent->d_name) + 1);
+	}
+	closedir(dir);
+
+	/* the names buffer is complete, so keys can now point into it */
+	hash_init_str(&d->entries, 64);
+	for (off = 0; off < d->names.len; off += len + 1) {
+		len = strlen(&d->names.buf[off]);
+		hash_set_strn(&d->entries, &d->names.buf[off], len, fs_cache_type_unknown);
+	}
+
+	d->listed = true;
+	++fs_cache.listings;
+	return true;
+}
+
+/*
+ * Returns false if the cache cannot answer the query, in which case the
+ * caller should ask the filesystem.
+ */
+static bool
+fs_cache_lookup(const char *path, enum fs_cache_type *type)
+{
+	const char *p, *name = NULL;
+	uint64_t *v;
+	struct fs_cache_dir *d;
+	uint32_t dir_len;
+
+	if (!fs_cache.enabled || !path_is_absolute(path)) {
+		return false;
+	}
+
+	/* only handle normalized paths */
+	for (p = path; *p; ++p) {
+		if (*p != PATH_SEP) {
+			continue;
+		}
+
+		name = p + 1;
+		if (!*name || *name == PATH_SEP || (name[0] == '.' && (!name[1] || name[1] == PATH_SEP))
+			|| (name[0] == '.' && name[1] == '.' && (!name[2] || name[2] == PATH_SEP))) {
+			return false;
+		}
+	}
+
+	if (!name) {
+		return false;
+	}
+
+	dir_len = name - path - 1;
+	if (!dir_len) {
+		dir_len = 1;
+	}
+
+	if ((v = hash_get_strn(&fs_cache.dirs, path, dir_len))) {
+		d = arr_get(&fs_cache.dir_list, *v);
+	} else {
+		char *dir_path = z_malloc(dir_len + 1);
+		memcpy(dir_path, path, dir_len);
+		dir_path[dir_len] = 0;
+
+		hash_set_strn(&fs_cache.dirs, dir_path, dir_len, fs_cache.dir_list.len);
+		d = arr_get(&fs_cache.dir_list, arr_push(&fs_cache.dir_list, &(struct fs_cache_dir){ .path = dir_path }));
+	}
+
+	if (!d->listed && !d->missing) {
+		if (++d->queries < 2 || !fs_cache_list_dir(d)) {
+			++fs_cache.misses;
+			return false;
+		}
+	}
+
+	if (d->missing) {
+		*type = fs_cache_type_missing;
+		++fs_cache.hits;
+		return true;
+	} else if (!(v = hash_get_strn(&d->entries, name, strlen(name)))) {
+#ifdef __APPLE__
+		/* the filesystem may be case-insensitive, so don't trust a miss */
+		++fs_cache.misses;
+		return false;
+#endif
+		*type = fs_cache_type_missing;
+		++fs_cache.hits;
+		return true;
+	}
+
+	if (*v == fs_cache_type_unknown) {
+		struct stat sb;
+
+		++fs_cache.misses;
+		if (stat(path, &sb) != 0) {
+			*v = fs_cache_type_missing;
+		} else if (S_ISREG(sb.st_mode)) {
+			*v = fs_cache_type_file;
+		} else if (S_ISDIR(sb.st_mode)) {
+			*v = fs_cache_type_dir;
+		} else {
+			*v = fs_cache_type_other;
+		}
+	} else {
+		++fs_cache.hits;
+	}
+
+	*type = *v;
+	return true;
+}
+
 enum fs_mtime_result
 fs_mtime(const char *path, int64_t *mtime)
 {
@@ -63,6 +609,11 @@ fs_mtime(const char *path, int64_t *mtime)
 bool
 fs_exists(const char *path)
 {
+	enum fs_cache_type t;
+	if (fs_cache_lookup(path, &t)) {
+		return t != fs_cache_type_missing;
+	}
+
 	return access(path, F_OK) == 0;
 }
 
@@ -84,6 +635,11 @@ fs_lexists(const char *path)
 bool
 fs_file_exists(const char *path)
 {
+	enum fs_cache_type t;
+	if (fs_cache_lookup(path, &t)) {
+		return t == fs_cache_type_file;
+	}
+
 	struct stat sb;
 	if (access(path, F_OK) != 0) {
 		return false;
@@ -99,6 +655,11 @@ fs_file_exists(const char *path)
 bool
 fs_exe_exists(const char *path)
 {
+	enum fs_cache_type t;
+	if (fs_cache_lookup(path, &t) && t != fs_cache_type_file) {
+		return false;
+	}
+
 	struct stat sb;
 	if (access(path, X_OK) != 0) {
 		return false;
@@ -114,6 +675,11 @@ fs_exe_exists(const char *path)
 bool
 fs_dir_exists(const char *path)
 {
+	enum fs_cache_type t;
+	if (fs_cache_lookup(path, &t)) {
+		return t == fs_cache_type_dir;
+	}
+
 	struct stat sb;
 	if (access(path, F_OK) != 0) {
 		return false;
@@ -129,6 +695,8 @@ fs_dir_exists(const char *path)
 bool
 fs_mkdir(const char *path, bool exist_ok)
 {
+	fs_cache_invalidate(path);
+
 	if (mkdir(path, 0755) == -1) {
 		if (exist_ok && errno == EEXIST) {
 			return true;
@@ -144,6 +712,8 @@ fs_mkdir(const char *path, bool exist_ok)
 bool
 fs_rmdir(const char *path, bool force)
 {
+	fs_cache_invalidate(path);
+
 	if (rmdir(path) == -1) {
 		if (force) {
 			return true;
@@ -196,6 +766,8 @@ fs_copy_file(const char *src, const char *dest, bool force)
 	FILE *f_src = NULL;
 	int f_dest = 0;
 
+	fs_cache_invalidate(dest);
+
 	struct stat st;
 	if (!fs_lstat(src, &st)) {
 		goto ret;
@@ -304,6 +876,8 @@ fs_dir_foreach(const char *path, void *_ctx, fs_dir_foreach_cb cb)
 bool
 fs_remove(const char *path)
 {
+	fs_cache_invalidate(path);
+
 	if (remove(path) != 0) {
 		LOG_E("failed remove(\"%s\"): %s", path, strerror(errno));
 		return false;
@@ -312,9 +886,25 @@ fs_remove(const char *path)
 	return true;
 }
 
+bool
+fs_rename(const char *old_path, const char *new_path)
+{
+	fs_cache_invalidate(old_path);
+	fs_cache_invalidate(new_path);
+
+	if (rename(old_path, new_path) != 0) {
+		LOG_E("failed rename(\"%s\", \"%s\"): %s", old_path, new_path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 bool
 fs_make_symlink(const char *target, const char *path, bool force)
 {
+	fs_cache_invalidate(path);
+
 	if (force && fs_lexists(path)) {
 		if (!fs_remove(path)) {
 			return false;
@@ -346,6 +936,18 @@ fs_is_a_tty_from_fd(int fd)
 	}
 }
 
+bool
+fs_wait_for_input(int fd, uint32_t timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int r;
+
+	while ((r = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR) {
+	}
+
+	return r != 0;
+}
+
 bool
 fs_chmod(const char *path, uint32_t mode)
 {
@@ -384,6 +986,7 @@ fs_find_cmd(struct workspace *wk, struct sbuf *buf, const char *cmd)
 	assert(*cmd);
 	uint32_t len;
 	const char *env_path, *base_start;
+	bool found;
 
 	sbuf_clear(buf);
 
@@ -402,6 +1005,10 @@ fs_find_cmd(struct workspace *wk, struct sbuf *buf, const char *cmd)
 		return false;
 	}
 
+	if (fs_path_index_lookup(wk, buf, env_path, cmd, &found)) {
+		return found;
+	}
+
 	base_start = env_path;
 	while (true) {
 		if (!*env_path || *env_path == ENV_PATH_SEP) {
@@ -429,6 +1036,17 @@ fs_find_cmd(struct workspace *wk, struct sbuf *buf, const char *cmd)
 	return false;
 }
 
+bool
+fs_touch(const char *path)
+{
+	if (utimensat(AT_FDCWD, path, NULL, 0) == -1) {
+		LOG_E("failed utimensat(AT_FDCWD, %s, NULL, 0): %s", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 bool
 fs_has_extension(const char *path, const char *ext)
 {
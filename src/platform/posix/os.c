@@ -71,3 +71,9 @@ os_set_env(const struct str *k, const struct str *v)
 
 	setenv(buf_k.buf, buf_v.buf, true);
 }
+
+uint32_t
+os_get_pid(void)
+{
+	return getpid();
+}
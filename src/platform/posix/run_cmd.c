@@ -5,11 +5,26 @@
 
 #include "compat.h"
 
+// wait4 and sched_setaffinity are not part of posix
+#if defined(MUON_BOOTSTRAPPED)
+#if defined(__linux__)
+#define _GNU_SOURCE
+#define MUON_HAVE_WAIT4
+#define MUON_HAVE_SCHED_SETAFFINITY
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) \
+	|| defined(__DragonFly__)
+#undef _POSIX_C_SOURCE
+#define MUON_HAVE_WAIT4
+#endif
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <time.h>
 
@@ -104,6 +119,34 @@ run_cmd_ctx_close_fds(struct run_cmd_ctx *ctx)
 	ctx->input_fd_open = false;
 }
 
+static int
+run_cmd_wait(struct run_cmd_ctx *ctx, int *status)
+{
+#ifdef MUON_HAVE_WAIT4
+	struct rusage ru;
+	int r = wait4(ctx->pid, status, WNOHANG, &ru);
+	if (r > 0) {
+		ctx->rusage = (struct run_cmd_rusage){
+			.user = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1e6,
+			.sys = (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1e6,
+#ifdef __APPLE__
+			// ru_maxrss is in bytes on macos and KiB everywhere else
+			.max_rss = (uint64_t)ru.ru_maxrss / 1024,
+#else
+			.max_rss = (uint64_t)ru.ru_maxrss,
+#endif
+			.nvcsw = (uint64_t)ru.ru_nvcsw,
+			.nivcsw = (uint64_t)ru.ru_nivcsw,
+			.have = true,
+		};
+		run_cmd_record_rusage(&ctx->rusage);
+	}
+	return r;
+#else
+	return waitpid(ctx->pid, status, WNOHANG);
+#endif
+}
+
 enum run_cmd_state
 run_cmd_collect(struct run_cmd_ctx *ctx)
 {
@@ -119,7 +162,7 @@ run_cmd_collect(struct run_cmd_ctx *ctx)
 			}
 		}
 
-		if ((r = waitpid(ctx->pid, &status, WNOHANG)) == -1) {
+		if ((r = run_cmd_wait(ctx, &status)) == -1) {
 			return run_cmd_error;
 		} else if (r == 0) {
 			if (ctx->flags & run_cmd_ctx_flag_async) {
@@ -139,6 +182,11 @@ run_cmd_collect(struct run_cmd_ctx *ctx)
 
 	assert(r == ctx->pid);
 
+	// the child may have modified the filesystem
+	if (!(ctx->flags & run_cmd_ctx_flag_known_outputs)) {
+		fs_cache_invalidate_all();
+	}
+
 	if (!(ctx->flags & run_cmd_ctx_flag_dont_capture)) {
 		while (pipe_res != copy_pipe_result_finished) {
 			if ((pipe_res = copy_pipes(ctx)) == copy_pipe_result_failed) {
@@ -264,6 +312,18 @@ run_cmd_internal(struct run_cmd_ctx *ctx, const char *_cmd, char *const *argv, c
 			}
 		}
 
+		if (ctx->flags & run_cmd_ctx_flag_pin_cpu) {
+#ifdef MUON_HAVE_SCHED_SETAFFINITY
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(ctx->cpu, &set);
+			if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+				LOG_E("failed to pin to cpu %d: %s", ctx->cpu, strerror(errno));
+				exit(1);
+			}
+#endif
+		}
+
 		if (ctx->stdin_path) {
 			if (dup2(ctx->input_fd, 0) == -1) {
 				LOG_E("failed to dup stdin: %s", strerror(errno));
@@ -486,6 +546,28 @@ run_cmd_kill(struct run_cmd_ctx *ctx, bool force)
 	return true;
 }
 
+bool
+run_cmd_check_cpu_affinity(uint32_t cpu)
+{
+#ifdef MUON_HAVE_SCHED_SETAFFINITY
+	cpu_set_t set;
+	if (cpu >= CPU_SETSIZE) {
+		LOG_E("cpu %d is out of range", cpu);
+		return false;
+	} else if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+		LOG_E("failed to get cpu affinity: %s", strerror(errno));
+		return false;
+	} else if (!CPU_ISSET(cpu, &set)) {
+		LOG_E("cpu %d is not available", cpu);
+		return false;
+	}
+	return true;
+#else
+	LOG_E("cpu pinning is not supported on this platform");
+	return false;
+#endif
+}
+
 bool
 run_cmd_unsplit(struct run_cmd_ctx *ctx, char *cmd, const char *envstr, uint32_t envc)
 {
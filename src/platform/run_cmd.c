@@ -143,3 +143,17 @@ run_cmd_determine_interpreter(struct source *src,
 
 	return true;
 }
+
+static double run_cmd_children_cpu;
+
+void
+run_cmd_record_rusage(const struct run_cmd_rusage *rusage)
+{
+	run_cmd_children_cpu += (double)rusage->user + (double)rusage->sys;
+}
+
+double
+run_cmd_children_cpu_time(void)
+{
+	return run_cmd_children_cpu;
+}
@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <io.h>
 #include <stdlib.h>
+#include <sys/utime.h>
 #include <windows.h>
 
 #include "lang/string.h"
@@ -312,6 +313,33 @@ _is_wprefix(const WCHAR *s, const WCHAR *prefix, uint32_t n)
 
 #define is_wprefix(__s, __p) _is_wprefix(__s, __p, sizeof(__p) / sizeof(WCHAR) - 1)
 
+/*
+ * Only pipes can be polled, anything else is reported as readable.
+ */
+bool
+fs_wait_for_input(int fd, uint32_t timeout_ms)
+{
+	HANDLE h;
+	DWORD avail;
+	uint32_t waited = 0;
+
+	h = (HANDLE *)_get_osfhandle(fd);
+	if (h == INVALID_HANDLE_VALUE) {
+		return true;
+	}
+
+	while (true) {
+		if (!PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL) || avail) {
+			return true;
+		} else if (waited >= timeout_ms) {
+			return false;
+		}
+
+		Sleep(10);
+		waited += 10;
+	}
+}
+
 bool
 fs_is_a_tty_from_fd(int fd)
 {
@@ -446,6 +474,17 @@ fs_chmod(const char *path, uint32_t mode)
 	return true;
 }
 
+bool
+fs_touch(const char *path)
+{
+	if (_utime(path, NULL) == -1) {
+		LOG_E("failed _utime(%s, NULL): %s", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 bool
 fs_has_extension(const char *path, const char *ext)
 {
@@ -547,6 +586,17 @@ fs_remove(const char *path)
 	return true;
 }
 
+bool
+fs_rename(const char *old_path, const char *new_path)
+{
+	if (!MoveFileExA(old_path, new_path, MOVEFILE_REPLACE_EXISTING)) {
+		LOG_E("failed MoveFileEx(\"%s\", \"%s\"): %s", old_path, new_path, win32_error());
+		return false;
+	}
+
+	return true;
+}
+
 FILE *
 fs_make_tmp_file(const char *name, const char *suffix, char *buf, uint32_t len)
 {
@@ -565,3 +615,22 @@ fs_make_tmp_file(const char *name, const char *suffix, char *buf, uint32_t len)
 
 	return fs_fopen(buf, "w+b");
 }
+
+/*
+ * The directory listing cache is not implemented on windows, where
+ * filesystems are usually case-insensitive.
+ */
+void
+fs_cache_enable(bool enable)
+{
+}
+
+void
+fs_cache_invalidate(const char *path)
+{
+}
+
+void
+fs_cache_invalidate_all(void)
+{
+}
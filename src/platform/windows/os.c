@@ -235,3 +235,9 @@ os_set_env(const struct str *k, const struct str *v)
 
 	putenv(buf_kv.buf);
 }
+
+uint32_t
+os_get_pid(void)
+{
+	return GetCurrentProcessId();
+}
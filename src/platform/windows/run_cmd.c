@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include <windows.h>
+#include <psapi.h>
 #define STRSAFE_NO_CB_FUNCTIONS
 #include <strsafe.h>
 
@@ -157,6 +158,36 @@ run_cmd_ctx_close_pipes(struct run_cmd_ctx *ctx)
 #endif
 }
 
+static double
+filetime_to_seconds(const FILETIME *ft)
+{
+	ULARGE_INTEGER v = { .LowPart = ft->dwLowDateTime, .HighPart = ft->dwHighDateTime };
+	// FILETIME durations are in 100ns units
+	return (double)v.QuadPart / 1e7;
+}
+
+static void
+run_cmd_collect_rusage(struct run_cmd_ctx *ctx)
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(ctx->process, &creation, &exit, &kernel, &user)) {
+		return;
+	}
+
+	ctx->rusage = (struct run_cmd_rusage){
+		.user = filetime_to_seconds(&user),
+		.sys = filetime_to_seconds(&kernel),
+		.have = true,
+	};
+
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (K32GetProcessMemoryInfo(ctx->process, &pmc, sizeof(pmc))) {
+		ctx->rusage.max_rss = pmc.PeakWorkingSetSize / 1024;
+	}
+
+	run_cmd_record_rusage(&ctx->rusage);
+}
+
 enum run_cmd_state
 run_cmd_collect(struct run_cmd_ctx *ctx)
 {
@@ -196,6 +227,8 @@ run_cmd_collect(struct run_cmd_ctx *ctx)
 
 	ctx->status = (int)status;
 
+	run_cmd_collect_rusage(ctx);
+
 	if (!(ctx->flags & run_cmd_ctx_flag_dont_capture)) {
 		while (!(ctx->pipe_out.is_eof && ctx->pipe_err.is_eof)) {
 			if (copy_pipes(ctx) == copy_pipe_result_failed) {
@@ -444,6 +477,10 @@ run_cmd_internal(struct run_cmd_ctx *ctx, char *command_line, const char *envstr
 	}
 
 	DWORD process_flags = 0;
+	if (ctx->flags & run_cmd_ctx_flag_pin_cpu) {
+		// the affinity is set before the child gets to run
+		process_flags |= CREATE_SUSPENDED;
+	}
 
 	if (strlen(command_line) >= 32767) {
 		LOG_E("command too long");
@@ -478,6 +515,19 @@ run_cmd_internal(struct run_cmd_ctx *ctx, char *command_line, const char *envstr
 	}
 
 	record_handle(&ctx->process, process_info.hProcess);
+
+	if (ctx->flags & run_cmd_ctx_flag_pin_cpu) {
+		if (!SetProcessAffinityMask(process_info.hProcess, (DWORD_PTR)1 << ctx->cpu)) {
+			LOG_E("failed to pin to cpu %d: %s", ctx->cpu, win32_error());
+			ctx->err_msg = "failed to set cpu affinity";
+			TerminateProcess(process_info.hProcess, 1);
+			CloseHandle(process_info.hThread);
+			return false;
+		}
+
+		ResumeThread(process_info.hThread);
+	}
+
 	CloseHandle(process_info.hThread);
 
 	if (ctx->flags & run_cmd_ctx_flag_async) {
@@ -586,6 +636,24 @@ argv_to_command_line(struct run_cmd_ctx *ctx,
 	return true;
 }
 
+bool
+run_cmd_check_cpu_affinity(uint32_t cpu)
+{
+	DWORD_PTR process_mask, system_mask;
+
+	if (cpu >= sizeof(DWORD_PTR) * 8) {
+		LOG_E("cpu %d is out of range", cpu);
+		return false;
+	} else if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+		LOG_E("failed to get cpu affinity: %s", win32_error());
+		return false;
+	} else if (!(process_mask & ((DWORD_PTR)1 << cpu))) {
+		LOG_E("cpu %d is not available", cpu);
+		return false;
+	}
+	return true;
+}
+
 bool
 run_cmd_unsplit(struct run_cmd_ctx *ctx, char *cmd, const char *envstr, uint32_t envc)
 {
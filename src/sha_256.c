@@ -8,8 +8,27 @@
 
 #include <string.h>
 
+#include "platform/os.h"
 #include "sha_256.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA_256_X86_SHA
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define SHA_256_ARMV8_SHA2
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#if defined(__clang__)
+#define SHA_256_ARMV8_TARGET __attribute__((target("sha2")))
+#else
+#define SHA_256_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
 #define CHUNK_SIZE 64
 #define TOTAL_LEN_LEN 8
 
@@ -91,14 +110,6 @@ static const uint32_t k[] = { 0x428a2f98,
 	0xbef9a3f7,
 	0xc67178f2 };
 
-struct buffer_state {
-	const uint8_t *p;
-	size_t len;
-	size_t total_len;
-	int single_one_delivered; /* bool */
-	int total_len_delivered; /* bool */
-};
-
 static inline uint32_t
 right_rot(uint32_t value, unsigned int count)
 {
@@ -108,183 +119,387 @@ right_rot(uint32_t value, unsigned int count)
 	return value >> count | value << (32 - count);
 }
 
+/*
+ * Process a single 512-bit chunk, updating the hash values h.
+ */
 static void
-init_buf_state(struct buffer_state *state, const void *input, size_t len)
+sha_256_block(uint32_t h[8], const uint8_t *p)
 {
-	state->p = input;
-	state->len = len;
-	state->total_len = len;
-	state->single_one_delivered = 0;
-	state->total_len_delivered = 0;
+	/*
+	 * Note 1: All integers (expect indexes) are 32-bit unsigned integers and addition is calculated modulo 2^32.
+	 *
+	 * Note 2: For each round, there is one round constant k[i] and one entry in the message schedule array w[i], 0
+	 * <= i <= 63.
+	 *
+	 * Note 3: The compression function uses 8 working variables, a through h.
+	 *
+	 * Note 4: Big-endian convention is used when expressing the constants in this pseudocode, and when parsing
+	 * message block data from bytes to words, for example, the first word of the input message "abc" after padding
+	 * is 0x61626380.
+	 */
+	unsigned i, j;
+	uint32_t ah[8];
+
+	/* Initialize working variables to current hash value: */
+	for (i = 0; i < 8; i++) {
+		ah[i] = h[i];
+	}
+
+	/*
+	 * The w-array is really w[64], but since we only need 16 of them at a time, we save stack by calculating 16 at
+	 * a time.
+	 *
+	 * This optimization was not there initially and the rest of the comments about w[64] are kept in their initial
+	 * state.
+	 */
+
+	/*
+	 * create a 64-entry message schedule array w[0..63] of 32-bit words (The initial values in w[0..63] don't
+	 * matter, so many implementations zero them here) copy chunk into first 16 words w[0..15] of the message
+	 * schedule array
+	 */
+	uint32_t w[16];
+
+	/* Compression function main loop: */
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 16; j++) {
+			if (i == 0) {
+				w[j] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+				p += 4;
+			} else {
+				/* Extend the first 16 words into the remaining 48 words w[16..63] of the message
+				 * schedule array: */
+				const uint32_t s0 = right_rot(w[(j + 1) & 0xf], 7) ^ right_rot(w[(j + 1) & 0xf], 18)
+						    ^ (w[(j + 1) & 0xf] >> 3);
+				const uint32_t s1 = right_rot(w[(j + 14) & 0xf], 17) ^ right_rot(w[(j + 14) & 0xf], 19)
+						    ^ (w[(j + 14) & 0xf] >> 10);
+				w[j] = w[j] + s0 + w[(j + 9) & 0xf] + s1;
+			}
+			const uint32_t s1 = right_rot(ah[4], 6) ^ right_rot(ah[4], 11) ^ right_rot(ah[4], 25);
+			const uint32_t ch = (ah[4] & ah[5]) ^ (~ah[4] & ah[6]);
+			const uint32_t temp1 = ah[7] + s1 + ch + k[i << 4 | j] + w[j];
+			const uint32_t s0 = right_rot(ah[0], 2) ^ right_rot(ah[0], 13) ^ right_rot(ah[0], 22);
+			const uint32_t maj = (ah[0] & ah[1]) ^ (ah[0] & ah[2]) ^ (ah[1] & ah[2]);
+			const uint32_t temp2 = s0 + maj;
+
+			ah[7] = ah[6];
+			ah[6] = ah[5];
+			ah[5] = ah[4];
+			ah[4] = ah[3] + temp1;
+			ah[3] = ah[2];
+			ah[2] = ah[1];
+			ah[1] = ah[0];
+			ah[0] = temp1 + temp2;
+		}
+	}
+
+	/* Add the compressed chunk to the current hash value: */
+	for (i = 0; i < 8; i++) {
+		h[i] += ah[i];
+	}
 }
 
-static inline const uint8_t *
-calc_chunk(uint8_t chunk[CHUNK_SIZE], struct buffer_state *state)
+/*
+ * Process n consecutive 512-bit chunks, updating the hash values h.
+ */
+typedef void (*sha_256_blocks_func)(uint32_t h[8], const uint8_t *p, size_t n);
+
+static void
+sha_256_blocks_generic(uint32_t h[8], const uint8_t *p, size_t n)
 {
-	if (state->total_len_delivered) {
-		return NULL;
+	for (; n; --n, p += CHUNK_SIZE) {
+		sha_256_block(h, p);
 	}
+}
 
-	/* For whole chunks, there is no need to copy data, we just return the original chunk. */
-	if (state->len >= CHUNK_SIZE) {
-		const uint8_t *const chunk_start = state->p;
-		state->p += CHUNK_SIZE;
-		state->len -= CHUNK_SIZE;
-		return chunk_start;
+#if defined(SHA_256_X86_SHA)
+/*
+ * The SHA extensions keep the state as ABEF and CDGH, and each
+ * sha256rnds2 performs two rounds using the low two words of msg.
+ */
+#define SHA_256_X86_ROUNDS(w, i)                                                                 \
+	do {                                                                                     \
+		msg = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)&k[(i) * 4]));          \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                             \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));    \
+	} while (0)
+
+/*
+ * Compute the next four message schedule words into w0, given the previous
+ * sixteen words in w0..w3.
+ */
+#define SHA_256_X86_SCHEDULE(w0, w1, w2, w3)                                                                \
+	w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3)
+
+__attribute__((target("sha,sse4.1"))) static void
+sha_256_blocks_x86_sha(uint32_t h[8], const uint8_t *p, size_t n)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, w0, w1, w2, w3;
+	unsigned i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; n; --n, p += CHUNK_SIZE) {
+		abef = state0;
+		cdgh = state1;
+
+		w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), bswap);
+		w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap);
+		w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap);
+		w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap);
+
+		SHA_256_X86_ROUNDS(w0, 0);
+		SHA_256_X86_ROUNDS(w1, 1);
+		SHA_256_X86_ROUNDS(w2, 2);
+		SHA_256_X86_ROUNDS(w3, 3);
+
+		for (i = 4; i < 16; i += 4) {
+			SHA_256_X86_SCHEDULE(w0, w1, w2, w3);
+			SHA_256_X86_ROUNDS(w0, i);
+			SHA_256_X86_SCHEDULE(w1, w2, w3, w0);
+			SHA_256_X86_ROUNDS(w1, i + 1);
+			SHA_256_X86_SCHEDULE(w2, w3, w0, w1);
+			SHA_256_X86_ROUNDS(w2, i + 2);
+			SHA_256_X86_SCHEDULE(w3, w0, w1, w2);
+			SHA_256_X86_ROUNDS(w3, i + 3);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
 	}
 
-	const uint8_t *const chunk_start = chunk;
-	memcpy(chunk, state->p, state->len);
-	chunk += state->len;
-	size_t space_in_chunk = CHUNK_SIZE - state->len;
-	state->p += state->len;
-	state->len = 0;
-
-	/* If we are here, space_in_chunk is one at minimum. */
-	if (!state->single_one_delivered) {
-		*chunk++ = 0x80;
-		space_in_chunk -= 1;
-		state->single_one_delivered = 1;
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *)&h[0], state0);
+	_mm_storeu_si128((__m128i *)&h[4], state1);
+}
+
+#undef SHA_256_X86_ROUNDS
+#undef SHA_256_X86_SCHEDULE
+
+static int
+sha_256_have_x86_sha(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d)) {
+		return 0;
 	}
 
-	/*
-	 * Now:
-	 * - either there is enough space left for the total length, and we can conclude,
-	 * - or there is too little space left, and we have to pad the rest of this chunk with zeroes. In the latter
-	 *   case, we will conclude at the next invocation of this function.
-	 */
-	if (space_in_chunk >= TOTAL_LEN_LEN) {
-		const size_t left = space_in_chunk - TOTAL_LEN_LEN;
-		size_t len = state->total_len;
-		int i;
-		memset(chunk, 0x00, left);
-		chunk += left;
-
-		/* Storing of len * 8 as a big endian 64-bit without overflow. */
-		chunk[7] = (uint8_t)(len << 3);
-		len >>= 5;
-		for (i = 6; i >= 0; i--) {
-			chunk[i] = (uint8_t)len;
-			len >>= 8;
+	/* SSSE3 and SSE4.1 */
+	if (!(c & (1 << 9)) || !(c & (1 << 19))) {
+		return 0;
+	}
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+		return 0;
+	}
+
+	/* SHA */
+	return (b & (1 << 29)) != 0;
+}
+#endif
+
+#if defined(SHA_256_ARMV8_SHA2)
+#define SHA_256_ARMV8_ROUNDS(w, i)                                      \
+	do {                                                            \
+		msg = vaddq_u32(w, vld1q_u32(&k[(i) * 4]));             \
+		tmp = state0;                                           \
+		state0 = vsha256hq_u32(state0, state1, msg);            \
+		state1 = vsha256h2q_u32(state1, tmp, msg);              \
+	} while (0)
+
+#define SHA_256_ARMV8_SCHEDULE(w0, w1, w2, w3) w0 = vsha256su1q_u32(vsha256su0q_u32(w0, w1), w2, w3)
+
+SHA_256_ARMV8_TARGET static void
+sha_256_blocks_armv8_sha2(uint32_t h[8], const uint8_t *p, size_t n)
+{
+	uint32x4_t state0, state1, abcd, efgh, msg, tmp, w0, w1, w2, w3;
+	unsigned i;
+
+	state0 = vld1q_u32(&h[0]);
+	state1 = vld1q_u32(&h[4]);
+
+	for (; n; --n, p += CHUNK_SIZE) {
+		abcd = state0;
+		efgh = state1;
+
+		w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 0)));
+		w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16)));
+		w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 32)));
+		w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 48)));
+
+		SHA_256_ARMV8_ROUNDS(w0, 0);
+		SHA_256_ARMV8_ROUNDS(w1, 1);
+		SHA_256_ARMV8_ROUNDS(w2, 2);
+		SHA_256_ARMV8_ROUNDS(w3, 3);
+
+		for (i = 4; i < 16; i += 4) {
+			SHA_256_ARMV8_SCHEDULE(w0, w1, w2, w3);
+			SHA_256_ARMV8_ROUNDS(w0, i);
+			SHA_256_ARMV8_SCHEDULE(w1, w2, w3, w0);
+			SHA_256_ARMV8_ROUNDS(w1, i + 1);
+			SHA_256_ARMV8_SCHEDULE(w2, w3, w0, w1);
+			SHA_256_ARMV8_ROUNDS(w2, i + 2);
+			SHA_256_ARMV8_SCHEDULE(w3, w0, w1, w2);
+			SHA_256_ARMV8_ROUNDS(w3, i + 3);
 		}
-		state->total_len_delivered = 1;
-	} else {
-		memset(chunk, 0x00, space_in_chunk);
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
 	}
 
-	return chunk_start;
+	vst1q_u32(&h[0], state0);
+	vst1q_u32(&h[4], state1);
 }
 
+#undef SHA_256_ARMV8_ROUNDS
+#undef SHA_256_ARMV8_SCHEDULE
+#endif
+
 /*
- * Limitations:
- * - Since input is a pointer, the data to hash must be directly accessible to the processor, which could be a problem
- *   for large data sizes.
- * - SHA algorithms theoretically operate on bit strings. However, this implementation has no support for bit string
- *   lengths that are not multiples of eight, and it really operates on arrays of bytes.  In particular, the len
- *   parameter is a number of bytes.
+ * Pick the fastest block function supported by the running cpu.  Setting
+ * MUON_SHA_256_IMPL=generic forces the portable implementation, which is
+ * useful for benchmarking and for ruling out the accelerated paths.
  */
-void
-calc_sha_256(uint8_t hash[32], const void *input, size_t len)
+static sha_256_blocks_func
+sha_256_select_blocks_func(void)
 {
-	/*
-	 * Note 1: All integers (expect indexes) are 32-bit unsigned integers and addition is calculated modulo 2^32.
-	 *
-	 * Note 2: For each round, there is one round constant k[i] and one entry in the message schedule array w[i], 0
-	 * <= i <= 63.
-	 *
-	 * Note 3: The compression function uses 8 working variables, a through h.
-	 *
-	 * Note 4: Big-endian convention is used when expressing the constants in this pseudocode, and when parsing
-	 * message block data from bytes to words, for example, the first word of the input message "abc" after padding
-	 * is 0x61626380.
-	 */
+	const char *impl = os_get_env("MUON_SHA_256_IMPL");
+	if (impl && strcmp(impl, "generic") == 0) {
+		return sha_256_blocks_generic;
+	}
 
+#if defined(SHA_256_X86_SHA)
+	if (sha_256_have_x86_sha()) {
+		return sha_256_blocks_x86_sha;
+	}
+#elif defined(SHA_256_ARMV8_SHA2)
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+		return sha_256_blocks_armv8_sha2;
+	}
+#endif
+
+	return sha_256_blocks_generic;
+}
+
+static sha_256_blocks_func sha_256_blocks;
+
+void
+sha_256_init(struct sha_256 *sha)
+{
 	/*
 	 * Initialize hash values (first 32 bits of the fractional parts of the square roots of the first 8 primes
 	 * 2..19):
 	 */
-	uint32_t h[]
+	static const uint32_t h0[]
 		= { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
-	unsigned i, j;
-
-	/* 512-bit chunks is what we will operate on. */
-	uint8_t chunk[CHUNK_SIZE];
 
-	struct buffer_state state;
+	if (!sha_256_blocks) {
+		sha_256_blocks = sha_256_select_blocks_func();
+	}
 
-	init_buf_state(&state, input, len);
+	memcpy(sha->h, h0, sizeof(h0));
+	sha->chunk_len = 0;
+	sha->total_len = 0;
+}
 
-	const uint8_t *p;
+/*
+ * SHA algorithms theoretically operate on bit strings. However, this implementation has no support for bit string
+ * lengths that are not multiples of eight, and it really operates on arrays of bytes.  In particular, the len
+ * parameter is a number of bytes.
+ */
+void
+sha_256_update(struct sha_256 *sha, const void *input, size_t len)
+{
+	const uint8_t *p = input;
 
-	while ((p = calc_chunk(chunk, &state))) {
-		uint32_t ah[8];
+	sha->total_len += len;
 
-		/* Initialize working variables to current hash value: */
-		for (i = 0; i < 8; i++) {
-			ah[i] = h[i];
+	if (sha->chunk_len) {
+		size_t n = CHUNK_SIZE - sha->chunk_len;
+		if (n > len) {
+			n = len;
 		}
 
-		/*
-		 * The w-array is really w[64], but since we only need 16 of them at a time, we save stack by
-		 * calculating 16 at a time.
-		 *
-		 * This optimization was not there initially and the rest of the comments about w[64] are kept in their
-		 * initial state.
-		 */
-
-		/*
-		 * create a 64-entry message schedule array w[0..63] of 32-bit words (The initial values in w[0..63]
-		 * don't matter, so many implementations zero them here) copy chunk into first 16 words w[0..15] of the
-		 * message schedule array
-		 */
-		uint32_t w[16];
-
-		/* Compression function main loop: */
-		for (i = 0; i < 4; i++) {
-			for (j = 0; j < 16; j++) {
-				if (i == 0) {
-					w[j] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8
-					       | (uint32_t)p[3];
-					p += 4;
-				} else {
-					/* Extend the first 16 words into the remaining 48 words w[16..63] of the
-					 * message schedule array: */
-					const uint32_t s0 = right_rot(w[(j + 1) & 0xf], 7)
-							    ^ right_rot(w[(j + 1) & 0xf], 18) ^ (w[(j + 1) & 0xf] >> 3);
-					const uint32_t s1 = right_rot(w[(j + 14) & 0xf], 17)
-							    ^ right_rot(w[(j + 14) & 0xf], 19)
-							    ^ (w[(j + 14) & 0xf] >> 10);
-					w[j] = w[j] + s0 + w[(j + 9) & 0xf] + s1;
-				}
-				const uint32_t s1 = right_rot(ah[4], 6) ^ right_rot(ah[4], 11) ^ right_rot(ah[4], 25);
-				const uint32_t ch = (ah[4] & ah[5]) ^ (~ah[4] & ah[6]);
-				const uint32_t temp1 = ah[7] + s1 + ch + k[i << 4 | j] + w[j];
-				const uint32_t s0 = right_rot(ah[0], 2) ^ right_rot(ah[0], 13) ^ right_rot(ah[0], 22);
-				const uint32_t maj = (ah[0] & ah[1]) ^ (ah[0] & ah[2]) ^ (ah[1] & ah[2]);
-				const uint32_t temp2 = s0 + maj;
-
-				ah[7] = ah[6];
-				ah[6] = ah[5];
-				ah[5] = ah[4];
-				ah[4] = ah[3] + temp1;
-				ah[3] = ah[2];
-				ah[2] = ah[1];
-				ah[1] = ah[0];
-				ah[0] = temp1 + temp2;
-			}
-		}
+		memcpy(&sha->chunk[sha->chunk_len], p, n);
+		sha->chunk_len += n;
+		p += n;
+		len -= n;
 
-		/* Add the compressed chunk to the current hash value: */
-		for (i = 0; i < 8; i++) {
-			h[i] += ah[i];
+		if (sha->chunk_len < CHUNK_SIZE) {
+			return;
 		}
+
+		sha_256_blocks(sha->h, sha->chunk, 1);
+		sha->chunk_len = 0;
 	}
 
+	/* For whole chunks, there is no need to copy data, we just process the original chunk. */
+	if (len >= CHUNK_SIZE) {
+		sha_256_blocks(sha->h, p, len / CHUNK_SIZE);
+		p += len & ~(size_t)(CHUNK_SIZE - 1);
+		len &= CHUNK_SIZE - 1;
+	}
+
+	if (len) {
+		memcpy(sha->chunk, p, len);
+		sha->chunk_len = len;
+	}
+}
+
+void
+sha_256_final(struct sha_256 *sha, uint8_t hash[32])
+{
+	uint64_t len = sha->total_len;
+	unsigned i, j;
+
+	sha->chunk[sha->chunk_len++] = 0x80;
+
+	/*
+	 * If there is too little space left for the total length, we have to pad the rest of this chunk with zeroes
+	 * and store the length in an additional chunk.
+	 */
+	if (sha->chunk_len > CHUNK_SIZE - TOTAL_LEN_LEN) {
+		memset(&sha->chunk[sha->chunk_len], 0x00, CHUNK_SIZE - sha->chunk_len);
+		sha_256_blocks(sha->h, sha->chunk, 1);
+		sha->chunk_len = 0;
+	}
+
+	memset(&sha->chunk[sha->chunk_len], 0x00, CHUNK_SIZE - TOTAL_LEN_LEN - sha->chunk_len);
+
+	/* Storing of len * 8 as a big endian 64-bit without overflow. */
+	sha->chunk[CHUNK_SIZE - 1] = (uint8_t)(len << 3);
+	len >>= 5;
+	for (i = CHUNK_SIZE - 2; i >= CHUNK_SIZE - TOTAL_LEN_LEN; i--) {
+		sha->chunk[i] = (uint8_t)len;
+		len >>= 8;
+	}
+
+	sha_256_blocks(sha->h, sha->chunk, 1);
+
 	/* Produce the final hash value (big-endian): */
 	for (i = 0, j = 0; i < 8; i++) {
-		hash[j++] = (uint8_t)(h[i] >> 24);
-		hash[j++] = (uint8_t)(h[i] >> 16);
-		hash[j++] = (uint8_t)(h[i] >> 8);
-		hash[j++] = (uint8_t)h[i];
+		hash[j++] = (uint8_t)(sha->h[i] >> 24);
+		hash[j++] = (uint8_t)(sha->h[i] >> 16);
+		hash[j++] = (uint8_t)(sha->h[i] >> 8);
+		hash[j++] = (uint8_t)sha->h[i];
 	}
 }
+
+void
+calc_sha_256(uint8_t hash[32], const void *input, size_t len)
+{
+	struct sha_256 sha;
+
+	sha_256_init(&sha);
+	sha_256_update(&sha, input, len);
+	sha_256_final(&sha, hash);
+}
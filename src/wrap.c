@@ -5,6 +5,7 @@
 
 #include "compat.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,6 +20,7 @@
 #include "platform/assert.h"
 #include "platform/filesystem.h"
 #include "platform/mem.h"
+#include "platform/os.h"
 #include "platform/path.h"
 #include "platform/run_cmd.h"
 #include "sha_256.h"
@@ -236,18 +238,22 @@ wrap_parse_provides_cb(void *_ctx,
 }
 
 static bool
-checksum(const uint8_t *file_buf, uint64_t len, const char *sha256)
+checksum_validate(const char *sha256)
 {
-	char buf[3] = { 0 };
-	uint32_t i;
-	uint8_t b, hash[32];
-
 	if (strlen(sha256) != 64) {
 		LOG_E("checksum '%s' is not 64 characters long", sha256);
 		return false;
 	}
 
-	calc_sha_256(hash, file_buf, len);
+	return true;
+}
+
+static bool
+checksum_compare(const uint8_t hash[32], const char *sha256)
+{
+	char buf[3] = { 0 };
+	uint32_t i;
+	uint8_t b;
 
 	for (i = 0; i < 64; i += 2) {
 		memcpy(buf, &sha256[i], 2);
@@ -262,38 +268,216 @@ checksum(const uint8_t *file_buf, uint64_t len, const char *sha256)
 }
 
 static bool
-checksum_extract(const char *buf, size_t len, const char *sha256, const char *dest_dir)
+checksum_file(const char *path, const char *sha256)
 {
-	if (sha256 && !checksum((const uint8_t *)buf, len, sha256)) {
+	bool res = false;
+	uint8_t buf[64 * 1024], hash[32];
+	uint64_t len, n;
+	struct sha_256 sha;
+	FILE *f;
+
+	if (!checksum_validate(sha256)) {
 		return false;
-	} else if (!muon_archive_extract(buf, len, dest_dir)) {
+	} else if (!(f = fs_fopen(path, "rb"))) {
 		return false;
+	} else if (!fs_fsize(f, &len)) {
+		goto ret;
 	}
 
+	sha_256_init(&sha);
+
+	while (len) {
+		n = len > sizeof(buf) ? sizeof(buf) : len;
+
+		if (!fs_fread(buf, n, f)) {
+			goto ret;
+		}
+
+		sha_256_update(&sha, buf, n);
+		len -= n;
+	}
+
+	sha_256_final(&sha, hash);
+
+	res = checksum_compare(hash, sha256);
+ret:
+	if (!fs_fclose(f)) {
+		return false;
+	}
+	return res;
+}
+
+struct fetch_ctx {
+	FILE *f;
+	struct sha_256 sha;
+};
+
+static bool
+fetch_write_cb(void *_ctx, const uint8_t *buf, uint64_t len)
+{
+	struct fetch_ctx *ctx = _ctx;
+
+	sha_256_update(&ctx->sha, buf, len);
+	return fs_fwrite(buf, len, ctx->f);
+}
+
+/*
+ * The user-level package cache is shared between all projects.  Archives are
+ * stored under their sha256 so that an entry can always be verified before it
+ * is used.  Setting MUON_PACKAGE_CACHE_DIR to an empty string disables it.
+ */
+static bool
+wrap_package_cache_dir(struct sbuf *buf)
+{
+	const char *dir;
+
+	if ((dir = os_get_env("MUON_PACKAGE_CACHE_DIR"))) {
+		if (!*dir) {
+			return false;
+		}
+
+		path_copy(NULL, buf, dir);
+		return true;
+	} else if ((dir = os_get_env("XDG_CACHE_HOME")) && *dir) {
+		path_join(NULL, buf, dir, "muon");
+	} else if ((dir = fs_user_home()) && *dir) {
+		path_join(NULL, buf, dir, ".cache");
+		path_push(NULL, buf, "muon");
+	} else {
+		return false;
+	}
+
+	path_push(NULL, buf, "packagecache");
 	return true;
 }
 
+/*
+ * Extract a previously downloaded archive if it exists and matches sha256.
+ * Entries in the user package cache that fail verification are removed so
+ * they will be fetched again, but a mismatching file in the project's
+ * packagecache is reported as an error and left alone.
+ */
 static bool
-fetch_checksum_extract(const char *src, const char *dest, const char *sha256, const char *dest_dir)
+fetch_use_cached(const char *path, const char *sha256, const char *dest_dir, bool discard, bool *res)
 {
-	bool res = false;
-	uint8_t *dlbuf = NULL;
-	uint64_t dlbuf_len;
+	if (!fs_file_exists(path)) {
+		return false;
+	}
+
+	if (!checksum_file(path, sha256)) {
+		if (discard) {
+			LOG_W("discarding cached file '%s'", path);
+			fs_remove(path);
+			return false;
+		}
+
+		LOG_E("cached file '%s' does not match the expected hash %s", path, sha256);
+		*res = false;
+		return true;
+	}
+
+	LOG_I("using cached file '%s'", path);
+	*res = muon_archive_extract(path, dest_dir);
+	return true;
+}
+
+/*
+ * Download src to a temporary file, hashing it as it arrives.  The archive is
+ * only extracted once the download is complete and its checksum has been
+ * verified.  When a checksum is given, the download is stored in the user
+ * package cache, and a cached or project-local copy is used instead of
+ * downloading if one is available.
+ *
+ * Several muon processes may share the user package cache, so downloads go
+ * to a file named after the current process, which is verified once more
+ * after it has been written and then renamed into place.
+ */
+static bool
+fetch_checksum_extract(const char *src,
+	const char *dest,
+	const char *sha256,
+	const char *dest_dir,
+	struct wrap_opts *opts)
+{
+	bool res = false, fetched, cached = false;
+	uint8_t hash[32];
+	struct fetch_ctx ctx = { 0 };
+	SBUF_manual(tmp_path);
+	SBUF_manual(cache_path);
+
+	if (sha256 && !checksum_validate(sha256)) {
+		return false;
+	}
+
+	path_join(NULL, &tmp_path, opts->subprojects, "packagecache");
+	path_push(NULL, &tmp_path, dest);
+
+	if (sha256 && fetch_use_cached(tmp_path.buf, sha256, dest_dir, false, &res)) {
+		sbuf_clear(&tmp_path);
+		goto ret;
+	}
+
+	if (sha256 && wrap_package_cache_dir(&cache_path)) {
+		path_push(NULL, &cache_path, sha256);
+
+		if (fetch_use_cached(cache_path.buf, sha256, dest_dir, true, &res)) {
+			sbuf_clear(&tmp_path);
+			goto ret;
+		}
+
+		cached = true;
+		sbuf_clear(&tmp_path);
+		sbuf_pushs(NULL, &tmp_path, cache_path.buf);
+	}
+
+	sbuf_pushf(NULL, &tmp_path, ".%" PRIu32 ".part", os_get_pid());
+
+	{
+		SBUF_manual(dir);
+		path_dirname(NULL, &dir, tmp_path.buf);
+		bool ok = fs_mkdir_p(dir.buf);
+		sbuf_destroy(&dir);
+		if (!ok) {
+			goto ret;
+		}
+	}
+
+	if (!(ctx.f = fs_fopen(tmp_path.buf, "wb"))) {
+		goto ret;
+	}
+
+	sha_256_init(&ctx.sha);
 
 	muon_curl_init();
+	fetched = muon_curl_fetch(src, fetch_write_cb, &ctx);
+	muon_curl_deinit();
 
-	if (!muon_curl_fetch(src, &dlbuf, &dlbuf_len)) {
+	if (!fs_fclose(ctx.f) || !fetched) {
 		goto ret;
-	} else if (!checksum_extract((const char *)dlbuf, dlbuf_len, sha256, dest_dir)) {
+	}
+
+	sha_256_final(&ctx.sha, hash);
+
+	if (sha256 && !checksum_compare(hash, sha256)) {
 		goto ret;
 	}
 
-	res = true;
+	if (cached) {
+		if (!checksum_file(tmp_path.buf, sha256)) {
+			goto ret;
+		} else if (fs_rename(tmp_path.buf, cache_path.buf)) {
+			res = muon_archive_extract(cache_path.buf, dest_dir);
+			goto ret;
+		}
+	}
+
+	res = muon_archive_extract(tmp_path.buf, dest_dir);
 ret:
-	if (dlbuf) {
-		z_free(dlbuf);
+	if (tmp_path.len && fs_file_exists(tmp_path.buf)) {
+		fs_remove(tmp_path.buf);
 	}
-	muon_curl_deinit();
+	sbuf_destroy(&cache_path);
+	sbuf_destroy(&tmp_path);
 	return res;
 }
 
@@ -319,18 +503,12 @@ wrap_download_or_check_packagefiles(const char *filename,
 			LOG_W("url specified, but local file '%s' is being used", source_path.buf);
 		}
 
-		struct source src = { 0 };
-		if (!fs_read_entire_file(source_path.buf, &src)) {
+		if (hash && !checksum_file(source_path.buf, hash)) {
 			goto ret;
-		}
-
-		if (!checksum_extract(src.src, src.len, hash, dest_dir)) {
-			fs_source_destroy(&src);
+		} else if (!muon_archive_extract(source_path.buf, dest_dir)) {
 			goto ret;
 		}
 
-		fs_source_destroy(&src);
-
 		res = true;
 	} else if (fs_dir_exists(source_path.buf)) {
 		if (url) {
@@ -347,7 +525,7 @@ wrap_download_or_check_packagefiles(const char *filename,
 			LOG_E("wrap downloading is disabled");
 			goto ret;
 		}
-		res = fetch_checksum_extract(url, filename, hash, dest_dir);
+		res = fetch_checksum_extract(url, filename, hash, dest_dir, opts);
 	} else {
 		LOG_E("no url specified, but '%s' is not a file or directory", source_path.buf);
 	}